@@ -30,14 +30,31 @@
 *  CUDA streams can be used for H.264 ME-only, HEVC ME-only, H264 encode and HEVC encode.
 */
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <limits.h>
+#include <stdlib.h>
 #include <cuda.h>
 #include "../Utils/NvCodecUtils.h"
 #include "NvEncoder/NvEncoderCuda.h"
 #include "../Utils/Logger.h"
 #include "../Utils/NvEncoderCLIOptions.h"
+#include "OutputSink.h"
+#include "GpuMatEncoder.h"
+#include "EncodeDaemon.h"
+#include "BatchEncoder.h"
+#include "ImageDecoder.h"
+#include "VideoFrameSource.h"
+#include "TimelapseSource.h"
+#include "SlideshowSource.h"
+#include "KenBurnsSource.h"
+#include "MosaicSource.h"
+#include "CropFanout.h"
+#include "LayerFanoutSink.h"
+#include "WatchFolder.h"
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -115,8 +132,56 @@ void ShowHelpAndExit(const char *szBadOption = NULL)
         oss << "Error parsing \"" << szBadOption << "\"" << std::endl;
     }
     oss << "Options:" << std::endl
-        << "-i               Input file path" << std::endl
-        << "-o               Output file path" << std::endl
+        << "-i               Input image or video file path" << std::endl
+        << "-o               Output file path, - for stdout" << std::endl
+        << "-sink            Output sink: file (default) direct fstream pipe mmap uring shm" << std::endl
+        << "-frames          Number of frames to encode (default: 375, all frames of a video)" << std::endl
+        << "-outSize         Encode every input at this size: WxH" << std::endl
+        << "-fit             Fit of inputs into -outSize: pad (default) letterbox scale" << std::endl
+        << "                 Without -outSize, inputs are padded to an encodable size" << std::endl
+        << "-manifest        Batch: file with one \"input output\" path pair per line" << std::endl
+        << "                 Several -i/-o pairs also make a batch" << std::endl
+        << "-report          Batch: CSV file with the result of every job" << std::endl
+        << "-daemon          Run as encode daemon listening on this Unix socket path" << std::endl
+        << "                 With -s WxH, one session per GPU is created at startup" << std::endl
+        << "-timelapse       Encode the images of this directory or list file as a timelapse at the -fps rate" << std::endl
+        << "-tlStep          Timelapse images per frame, below 1 holds each image (default: 1)" << std::endl
+        << "-tlBlend         Timelapse frames average their images, or crossfade with -tlStep below 1" << std::endl
+        << "-slideshow       Encode the images of this directory or list file as a slideshow" << std::endl
+        << "-slideHold       Seconds each slideshow image is shown (default: 3)" << std::endl
+        << "-slideFade       Seconds of transition between slideshow images, 0 cuts (default: 1)" << std::endl
+        << "-transition      Slideshow transition: crossfade (default) wipe" << std::endl
+        << "-kenburns        Pan and zoom over this large image, read by tiles, at -outSize (default: 1920x1080)" << std::endl
+        << "-kbFrom          Ken Burns start view: x,y,width as fractions of the image (default: 0.5,0.5,1)" << std::endl
+        << "-kbTo            Ken Burns end view: x,y,width as fractions of the image (default: 0.5,0.5,0.5)" << std::endl
+        << "-mosaic          Compose the feeds listed in this file into a grid at -outSize (default: 3840x2160)" << std::endl
+        << "-mosaicCols      Columns of the mosaic grid (default: as square as possible)" << std::endl
+        << "-crop            Encode this crop of the input as a stream of its own: WxH+X+Y[:WxH]" << std::endl
+        << "                 Repeatable; crop i is written to the -o path with _i before the extension" << std::endl
+        << "-timecode        Burn an HH:MM:SS:FF timecode at the -fps rate into the top left corner" << std::endl
+        << "-overlayText     Burn this text into the bottom left corner" << std::endl
+        << "-logo            Burn this image, with its alpha channel, into the top right corner" << std::endl
+        << "-sceneCut        Detect scene cuts on the GPU and code them as: idr intra (keeps the GOP)" << std::endl
+        << "-denoise         Temporal denoise strength from 0 to 1 for camera and sensor inputs" << std::endl
+        << "-denoiseReport   Encode a video input again without -denoise and report the size reduction" << std::endl
+        << "-dropDuplicates  Do not encode frames identical to the previous one; frame times for muxing" << std::endl
+        << "                 as variable frame rate go to the -o path with suffix '_timestamps.txt'" << std::endl
+        << "-ltr             Mark still backgrounds as long-term references and predict from them" << std::endl
+        << "-ltrReport       Encode the input again with the default GOP structure and report the size reduction" << std::endl
+        << "-temporalLayers  Encode with this many temporal layers (hierarchical P)" << std::endl
+        << "-maxLayer        Write only the temporal layers up to this one to the -o path" << std::endl
+        << "-layerOut        Also write the temporal layers up to this one to the -o path with suffix '_L<n>'" << std::endl
+        << "-fanoutReport    Encode the input again for every -layerOut and report the CPU time against the fan-out" << std::endl
+        << "-abr             Adapt the bitrate within min:max (e.g. 1M:8M) to how fast the sink drains" << std::endl
+        << "-watch           Encode what is dropped into this directory, outputs go to the -o directory" << std::endl
+        << "-watchIdle       Seconds without a new image that complete a sequence directory (default: 10)" << std::endl
+        << "-maxSessions     Encoder sessions per GPU of the daemon, batch or watch (default: 3)" << std::endl
+        << "-connect         Send the job to the encode daemon at this Unix socket path" << std::endl
+        << "-class           Daemon job class: interactive normal (default) batch" << std::endl
+        << "-tenant          Daemon job owner for fair sharing of encoder sessions" << std::endl
+        << "-deadline        Daemon job deadline in ms after submission" << std::endl
+        << "-stats           Write the daemon queue statistics instead of encoding" << std::endl
+        << "-throttle        Read the daemon bitstream at no more than this bitrate, to simulate a slow link" << std::endl
         << "-s               Input resolution in this form: WxH" << std::endl
         << "-if              Input format: iyuv nv12 yuv444 p010 yuv444p16 bgra bgra10 ayuv abgr abgr10" << std::endl
         << "-gpu             Ordinal of GPU to use" << std::endl
@@ -141,9 +206,60 @@ void ShowHelpAndExit(const char *szBadOption = NULL)
     }
 }
 
+/**
+*  @brief Options added on top of the ones of the SDK encode samples.
+*/
+struct AppOptions
+{
+    std::string strSinkType = "file";
+    // 0: nDefaultFrameCount copies of an image, every frame of a video
+    int nFrame = 0;
+    std::string strDaemonSocket;
+    std::string strConnectSocket;
+    std::string strWatchDir;
+    int nWatchIdleSeconds = 10;
+    std::string strTimelapse;
+    double fTimelapseStep = 1;
+    bool bTimelapseBlend = false;
+    std::string strSlideshow;
+    double fSlideHold = 3, fSlideFade = 1;
+    TransitionType eTransition = TRANSITION_CROSSFADE;
+    std::string strKenBurns;
+    KenBurnsView kbFrom, kbTo = {0.5, 0.5, 0.5};
+    std::string strMosaic;
+    int nMosaicCol = 0;
+    std::vector<CropWindow> vCrop;
+    bool bTimecode = false;
+    std::string strOverlayText;
+    std::string strLogo;
+    // Empty, "idr" or "intra"
+    std::string strSceneCut;
+    double fDenoise = 0;
+    bool bDenoiseReport = false;
+    bool bDropDuplicates = false;
+    bool bLtr = false;
+    bool bLtrReport = false;
+    bool bFanoutReport = false;
+    int nTemporalLayers = 0;
+    int nMaxLayer = -1;
+    std::vector<int> vLayerOut;
+    std::string strBitrateBounds;
+    double fThrottle = 0;
+    int nMaxSessions = 3;
+    std::string strEncoderParams;
+    // Arguments forwarded to the daemon with -connect
+    std::vector<std::string> vJobArg;
+    // All -i and -o, more than one pair or a manifest make a batch
+    std::vector<std::string> vInput, vOutput;
+    std::string strManifest;
+    std::string strReport;
+    FitMode eFit = FIT_PAD;
+    int nOutWidth = 0, nOutHeight = 0;
+};
+
 void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth, int &nHeight, 
     NV_ENC_BUFFER_FORMAT &eFormat, char *szOutputFileName, NvEncoderInitParam &initParam, int &iGpu, 
-    int32_t &cuStreamType)
+    int32_t &cuStreamType, AppOptions &options)
 {
     std::ostringstream oss;
     int i;
@@ -160,6 +276,13 @@ void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth
                 ShowHelpAndExit("-i");
             }
             sprintf(szInputFileName, "%s", argv[i]);
+            options.vInput.push_back(argv[i]);
+#ifndef _WIN32
+            // The daemon does not share our working directory
+            char szAbsPath[PATH_MAX];
+            options.vJobArg.push_back("-i");
+            options.vJobArg.push_back(realpath(argv[i], szAbsPath) ? szAbsPath : argv[i]);
+#endif
             continue;
         }
         if (!_stricmp(argv[i], "-o"))
@@ -169,6 +292,7 @@ void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth
                 ShowHelpAndExit("-o");
             }
             sprintf(szOutputFileName, "%s", argv[i]);
+            options.vOutput.push_back(argv[i]);
             continue;
         }
         if (!_stricmp(argv[i], "-s"))
@@ -177,6 +301,8 @@ void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth
             {
                 ShowHelpAndExit("-s");
             }
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
             continue;
         }
         std::vector<std::string> vszFileFormatName =
@@ -217,6 +343,8 @@ void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth
                 ShowHelpAndExit("-gpu");
             }
             iGpu = atoi(argv[i]);
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
             continue;
         }
         if (!_stricmp(argv[i], "-cuStreamType"))
@@ -228,6 +356,348 @@ void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth
             cuStreamType = atoi(argv[i]);
             continue;
         }
+        if (!_stricmp(argv[i], "-sink"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-sink");
+            }
+            options.strSinkType = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-frames"))
+        {
+            if (++i == argc || (options.nFrame = atoi(argv[i])) <= 0)
+            {
+                ShowHelpAndExit("-frames");
+            }
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-daemon"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-daemon");
+            }
+            options.strDaemonSocket = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-watch"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-watch");
+            }
+            options.strWatchDir = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-watchIdle"))
+        {
+            if (++i == argc || (options.nWatchIdleSeconds = atoi(argv[i])) <= 0)
+            {
+                ShowHelpAndExit("-watchIdle");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-timelapse"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-timelapse");
+            }
+            options.strTimelapse = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-tlStep"))
+        {
+            if (++i == argc || !((options.fTimelapseStep = atof(argv[i])) > 0))
+            {
+                ShowHelpAndExit("-tlStep");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-tlBlend"))
+        {
+            options.bTimelapseBlend = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-slideshow"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-slideshow");
+            }
+            options.strSlideshow = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-slideHold"))
+        {
+            if (++i == argc || !((options.fSlideHold = atof(argv[i])) > 0))
+            {
+                ShowHelpAndExit("-slideHold");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-slideFade"))
+        {
+            if (++i == argc || (options.fSlideFade = atof(argv[i])) < 0)
+            {
+                ShowHelpAndExit("-slideFade");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-transition"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-transition");
+            }
+            options.eTransition = ParseTransitionType(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-kenburns"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-kenburns");
+            }
+            options.strKenBurns = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-kbFrom"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-kbFrom");
+            }
+            options.kbFrom = ParseKenBurnsView(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-kbTo"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-kbTo");
+            }
+            options.kbTo = ParseKenBurnsView(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-mosaic"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-mosaic");
+            }
+            options.strMosaic = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-mosaicCols"))
+        {
+            if (++i == argc || (options.nMosaicCol = atoi(argv[i])) <= 0)
+            {
+                ShowHelpAndExit("-mosaicCols");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-crop"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-crop");
+            }
+            options.vCrop.push_back(ParseCropWindow(argv[i]));
+            continue;
+        }
+        if (!_stricmp(argv[i], "-timecode"))
+        {
+            options.bTimecode = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-overlayText"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-overlayText");
+            }
+            options.strOverlayText = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-logo"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-logo");
+            }
+            options.strLogo = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-sceneCut"))
+        {
+            if (++i == argc || (_stricmp(argv[i], "idr") && _stricmp(argv[i], "intra")))
+            {
+                ShowHelpAndExit("-sceneCut");
+            }
+            options.strSceneCut = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-denoise"))
+        {
+            if (++i == argc || (options.fDenoise = atof(argv[i])) <= 0 || options.fDenoise > 1)
+            {
+                ShowHelpAndExit("-denoise");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-denoiseReport"))
+        {
+            options.bDenoiseReport = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-dropDuplicates"))
+        {
+            options.bDropDuplicates = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-ltr"))
+        {
+            options.bLtr = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-ltrReport"))
+        {
+            options.bLtrReport = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-fanoutReport"))
+        {
+            options.bFanoutReport = true;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-temporalLayers"))
+        {
+            if (++i == argc || (options.nTemporalLayers = atoi(argv[i])) < 2)
+            {
+                ShowHelpAndExit("-temporalLayers");
+            }
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-maxLayer"))
+        {
+            if (++i == argc || (options.nMaxLayer = atoi(argv[i])) < 0)
+            {
+                ShowHelpAndExit("-maxLayer");
+            }
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-abr"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-abr");
+            }
+            // Validated here, the daemon would only report it after queueing
+            BitrateController::Parse(argv[i]);
+            options.strBitrateBounds = argv[i];
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-throttle"))
+        {
+            if (++i == argc || !(options.fThrottle = BitrateController::ParseBitrate(argv[i])))
+            {
+                ShowHelpAndExit("-throttle");
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-layerOut"))
+        {
+            if (++i == argc || atoi(argv[i]) < 0)
+            {
+                ShowHelpAndExit("-layerOut");
+            }
+            options.vLayerOut.push_back(atoi(argv[i]));
+            continue;
+        }
+        if (!_stricmp(argv[i], "-connect"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-connect");
+            }
+            options.strConnectSocket = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-class") || !_stricmp(argv[i], "-tenant") || !_stricmp(argv[i], "-deadline"))
+        {
+            // Scheduling options, only used by the daemon
+            if (i + 1 == argc)
+            {
+                ShowHelpAndExit(argv[i]);
+            }
+            options.vJobArg.push_back(argv[i]);
+            options.vJobArg.push_back(argv[++i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-stats"))
+        {
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-fit"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-fit");
+            }
+            options.eFit = ParseFitMode(argv[i]);
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-outSize"))
+        {
+            if (++i == argc || 2 != sscanf(argv[i], "%dx%d", &options.nOutWidth, &options.nOutHeight)
+                || options.nOutWidth <= 0 || options.nOutHeight <= 0)
+            {
+                ShowHelpAndExit("-outSize");
+            }
+            options.vJobArg.push_back(argv[i - 1]);
+            options.vJobArg.push_back(argv[i]);
+            continue;
+        }
+        if (!_stricmp(argv[i], "-manifest"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-manifest");
+            }
+            options.strManifest = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-report"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("-report");
+            }
+            options.strReport = argv[i];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-maxSessions"))
+        {
+            if (++i == argc || (options.nMaxSessions = atoi(argv[i])) <= 0)
+            {
+                ShowHelpAndExit("-maxSessions");
+            }
+            continue;
+        }
 
         // Regard as encoder parameter
         if (argv[i][0] != '-')
@@ -235,75 +705,114 @@ void ParseCommandLine(int argc, char *argv[], char *szInputFileName, int &nWidth
             ShowHelpAndExit(argv[i]);
         }
         oss << argv[i] << " ";
+        options.vJobArg.push_back(argv[i]);
         while (i + 1 < argc && argv[i + 1][0] != '-')
         {
             oss << argv[++i] << " ";
+            options.vJobArg.push_back(argv[i]);
         }
     }
     initParam = NvEncoderInitParam(oss.str().c_str());
+    options.strEncoderParams = oss.str();
 }
 
-template<class EncoderClass> 
-void InitializeEncoder(EncoderClass &pEnc, NvEncoderInitParam encodeCLIOptions, NV_ENC_BUFFER_FORMAT eFormat)
+// Inserts strSuffix before the extension of the file name in strPath
+static std::string InsertSuffix(std::string strPath, const std::string &strSuffix)
 {
-    NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
-    NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
-
-    initializeParams.encodeConfig = &encodeConfig;
-    pEnc->CreateDefaultEncoderParams(&initializeParams, encodeCLIOptions.GetEncodeGUID(), encodeCLIOptions.GetPresetGUID(), encodeCLIOptions.GetTuningInfo());
-    encodeCLIOptions.SetInitParams(&initializeParams, eFormat);
-
-    pEnc->CreateEncoder(&initializeParams);
+    size_t iDot = strPath.find_last_of('.');
+    size_t iSlash = strPath.find_last_of("/\\");
+    if (iDot == std::string::npos || (iSlash != std::string::npos && iDot < iSlash))
+    {
+        iDot = strPath.size();
+    }
+    return strPath.insert(iDot, strSuffix);
 }
 
-void EncodeGpuMat(int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions, CUcontext cuContext, cv::cuda::GpuMat srcIn, std::ofstream& fpOut)
+/**
+*  @brief Encodes the input at szInFilePath, a video or a still image, again
+*  into a NullSink with the settings of control and returns the bytes. The
+*  stateful stages of control are replaced with fresh ones.
+*/
+static uint64_t EncodeAgain(const char *szInFilePath, int nFrame, int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions,
+    CUcontext cuContext, EncodeControl control)
 {
-    NV_ENC_BUFFER_FORMAT eFormat = NV_ENC_BUFFER_FORMAT_ABGR;
-
-    std::unique_ptr<NvEncoderCuda> pEnc(new NvEncoderCuda(cuContext, nWidth, nHeight, eFormat));
-
-    InitializeEncoder(pEnc, encodeCLIOptions, eFormat);
+    std::unique_ptr<FrameSource> pSource;
+    if (VideoFrameSource::IsVideoFile(szInFilePath))
+    {
+        pSource.reset(new VideoFrameSource(szInFilePath, nFrame));
+    }
+    else
+    {
+        ImageDecoder decoder(1);
+        pSource.reset(new StillFrameSource(decoder.Decode(szInFilePath), nFrame ? nFrame : nDefaultFrameCount));
+    }
+    std::unique_ptr<TemporalDenoiser> pDenoiser;
+    if (control.pDenoiser)
+    {
+        pDenoiser.reset(new TemporalDenoiser(control.pDenoiser->GetStrength()));
+        control.pDenoiser = pDenoiser.get();
+    }
+    DuplicateFrameFilter duplicate;
+    if (control.pDuplicate)
+    {
+        control.pDuplicate = &duplicate;
+    }
+    SceneCutDetector sceneCut;
+    if (control.pSceneCut)
+    {
+        control.pSceneCut = &sceneCut;
+    }
+    LtrController ltr;
+    if (control.pLtr)
+    {
+        control.pLtr = &ltr;
+    }
+    // A NullSink never backs up, the configured bitrate is the comparable one
+    control.pBitrate = NULL;
+    NullSink sink;
+    EncodeFrameSource(nWidth, nHeight, encodeCLIOptions, cuContext, *pSource, sink, control);
+    return sink.GetBytesWritten();
+}
 
-    int nFrameSize = pEnc->GetFrameSize();
-    int nFrame = 0;
-    int last_frame = 15*25;
-    for (int i = 0; i <= last_frame; i++)
+static void ReportSizes(const char *szWithout, uint64_t nWithoutBytes, uint64_t nWithBytes)
+{
+    std::cout << "Without " << szWithout << ": " << nWithoutBytes << " bytes, with: " << nWithBytes << " bytes";
+    if (nWithoutBytes)
     {
-        std::streamsize nRead = nFrameSize;
-        // For receiving encoded packets
-        std::vector<std::vector<uint8_t>> vPacket;
-        
-        if (i < last_frame)
-        {
-            const NvEncInputFrame* encoderInputFrame = pEnc->GetNextInputFrame();
-            NvEncoderCuda::CopyToDeviceFrame(cuContext, srcIn.data, 0, (CUdeviceptr)encoderInputFrame->inputPtr,
-                (int)encoderInputFrame->pitch,
-                pEnc->GetEncodeWidth(),
-                pEnc->GetEncodeHeight(),
-                CU_MEMORYTYPE_HOST,
-                encoderInputFrame->bufferFormat,
-                encoderInputFrame->chromaOffsets,
-                encoderInputFrame->numChromaPlanes);
-            pEnc->EncodeFrame(vPacket);
-        }
-        else
-        {
-            pEnc->EndEncode(vPacket);
-        }
-        nFrame += (int)vPacket.size();
-        for (std::vector<uint8_t>& packet : vPacket)
-        {
-            // For each encoded packet
-            fpOut.write(reinterpret_cast<char*>(packet.data()), packet.size());
-        }
+        std::cout << " (" << 100.0 * ((double)nWithoutBytes - (double)nWithBytes) / nWithoutBytes << "% smaller)";
     }
+    std::cout << std::endl;
+}
 
-    pEnc->DestroyEncoder();
+/**
+*  @brief Checks control.pDenoiser against its CPU reference on the first
+*  frames of the video szInFilePath, then encodes the video again without it
+*  and reports how much smaller nDenoisedBytes is. With a constant QP, that
+*  is the bitrate the noise cost.
+*/
+static void ReportDenoise(const char *szInFilePath, int nFrame, int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions,
+    CUcontext cuContext, EncodeControl control, uint64_t nDenoisedBytes)
+{
+    TemporalDenoiser denoiser(control.pDenoiser->GetStrength());
+    VideoFrameSource checkSource(szInFilePath, 30);
+    cv::cuda::Stream stream;
+    cv::cuda::GpuMat frame;
+    cv::Mat hostFrame, filtered, reference;
+    double fMaxDiff = 0;
+    while (checkSource.GetNextFrame(frame))
+    {
+        denoiser.Filter(frame, stream).download(filtered, stream);
+        frame.download(hostFrame, stream);
+        stream.waitForCompletion();
+        denoiser.FilterReference(hostFrame, reference);
+        fMaxDiff = std::max(fMaxDiff, cv::norm(filtered, reference, cv::NORM_INF));
+    }
+    std::cout << "Denoise on the GPU and the CPU reference differ by at most " << fMaxDiff << std::endl;
 
-    std::cout << "Total frames encoded: " << nFrame << std::endl;
+    control.pDenoiser = NULL;
+    ReportSizes("denoise", EncodeAgain(szInFilePath, nFrame, nWidth, nHeight, encodeCLIOptions, cuContext, control), nDenoisedBytes);
 }
 
-
 int main(int argc, char **argv)
 {
 
@@ -317,19 +826,77 @@ int main(int argc, char **argv)
         NvEncoderInitParam encodeCLIOptions;
         int cuStreamType = -1;
         bool bOutputInVideoMem = false;
+        AppOptions options;
         ParseCommandLine(argc, argv, szInFilePath, nWidth, nHeight, eFormat, szOutFilePath, encodeCLIOptions, iGpu, 
-                         cuStreamType);
+                         cuStreamType, options);
 
-        
-        cv::Mat srcImgHost = cv::imread(szInFilePath);
+        if (!strcmp(szOutFilePath, "-"))
+        {
+            // The bitstream goes to stdout; keep the console output out of it
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
 
-        nWidth = srcImgHost.cols;
-        nHeight = srcImgHost.rows;
-        cv::cuda::GpuMat srcImgDevice;
-        srcImgDevice.upload(srcImgHost);
-        cv::cuda::cvtColor(srcImgDevice, srcImgDevice, cv::ColorConversionCodes::COLOR_BGR2RGBA);
+#ifndef _WIN32
+        if (!options.strDaemonSocket.empty())
+        {
+            return RunEncodeDaemon(options.strDaemonSocket.c_str(), options.nMaxSessions, nWidth, nHeight, options.strEncoderParams);
+        }
+        if (!options.strConnectSocket.empty())
+        {
+            std::unique_ptr<OutputSink> pSink = CreateOutputSink(options.strSinkType, szOutFilePath);
+            RunEncodeClient(options.strConnectSocket.c_str(), options.vJobArg, *pSink, options.fThrottle);
+            pSink->Close();
+            std::cout << "Bitstream saved in file " << szOutFilePath << std::endl;
+            return 0;
+        }
+#endif
+#ifdef __linux__
+        if (!options.strWatchDir.empty())
+        {
+            WatchOptions watchOptions;
+            watchOptions.strWatchDir = options.strWatchDir;
+            watchOptions.strOutputDir = szOutFilePath;
+            watchOptions.strEncoderParams = options.strEncoderParams;
+            watchOptions.strSinkType = options.strSinkType;
+            watchOptions.nFrame = options.nFrame ? options.nFrame : nDefaultFrameCount;
+            watchOptions.iGpu = iGpu;
+            watchOptions.eFit = options.eFit;
+            watchOptions.nOutWidth = options.nOutWidth;
+            watchOptions.nOutHeight = options.nOutHeight;
+            watchOptions.nSessions = options.nMaxSessions;
+            watchOptions.nIdleSeconds = options.nWatchIdleSeconds;
+            return RunWatchFolder(watchOptions);
+        }
+#endif
 
-        ValidateResolution(nWidth, nHeight);
+        if (!options.strManifest.empty() || options.vInput.size() > 1)
+        {
+            std::vector<BatchJob> vJob;
+            if (!options.strManifest.empty())
+            {
+                vJob = ReadBatchManifest(options.strManifest.c_str());
+            }
+            if (options.vInput.size() != options.vOutput.size())
+            {
+                std::cout << "Batch needs one -o for every -i" << std::endl;
+                return 1;
+            }
+            for (size_t i = 0; i < options.vInput.size(); i++)
+            {
+                vJob.push_back(BatchJob{options.vInput[i], options.vOutput[i]});
+            }
+            BatchOptions batchOptions;
+            batchOptions.strEncoderParams = options.strEncoderParams;
+            batchOptions.strSinkType = options.strSinkType;
+            batchOptions.nFrame = options.nFrame ? options.nFrame : nDefaultFrameCount;
+            batchOptions.iGpu = iGpu;
+            batchOptions.nSessions = options.nMaxSessions;
+            batchOptions.strReportPath = options.strReport;
+            batchOptions.eFit = options.eFit;
+            batchOptions.nOutWidth = options.nOutWidth;
+            batchOptions.nOutHeight = options.nOutHeight;
+            return RunBatchEncode(vJob, batchOptions) ? 1 : 0;
+        }
 
         ck(cuInit(0));
         int nGpu = 0;
@@ -344,24 +911,285 @@ int main(int argc, char **argv)
         char szDeviceName[80];
         ck(cuDeviceGetName(szDeviceName, sizeof(szDeviceName), cuDevice));
         std::cout << "GPU in use: " << szDeviceName << std::endl;
+        // The primary context is the one of the OpenCV CUDA modules, so the
+        // GpuMat operations can write straight into the encoder input buffers
         CUcontext cuContext = NULL;
-        ck(cuCtxCreate(&cuContext, 0, cuDevice));
+        ck(cuDevicePrimaryCtxRetain(&cuContext, cuDevice));
+        cv::cuda::setDevice(iGpu);
+
+        std::unique_ptr<FrameSource> pSource;
+        FrameNormalizer normalizer(options.eFit, options.nOutWidth, options.nOutHeight);
+        // Renderers draw the encode size themselves
+        const FrameNormalizer *pNormalizer = &normalizer;
+        SlideshowSource *pSlideshow = NULL;
+        KenBurnsSource *pKenBurns = NULL;
+        MosaicSource *pMosaic = NULL;
+        // The encoder rate, 30 fps unless -fps says otherwise, for seconds to frames
+        double fFps = 30;
+        for (size_t i = 0; i + 1 < options.vJobArg.size(); i++)
+        {
+            if (!_stricmp(options.vJobArg[i].c_str(), "-fps"))
+            {
+                fFps = atof(options.vJobArg[i + 1].c_str());
+            }
+        }
+        if (!options.strMosaic.empty())
+        {
+            cv::Size outSize = options.nOutWidth ? cv::Size(options.nOutWidth, options.nOutHeight) : cv::Size(3840, 2160);
+            pMosaic = new MosaicSource(ReadMosaicFeeds(options.strMosaic), outSize, options.nMosaicCol);
+            pSource.reset(pMosaic);
+            nWidth = outSize.width;
+            nHeight = outSize.height;
+            pNormalizer = NULL;
+        }
+        else if (!options.strKenBurns.empty())
+        {
+            // Never loaded whole, the output size cannot follow the image
+            cv::Size outSize = options.nOutWidth ? cv::Size(options.nOutWidth, options.nOutHeight) : cv::Size(1920, 1080);
+            pKenBurns = new KenBurnsSource(options.strKenBurns, outSize, options.nFrame ? options.nFrame : nDefaultFrameCount,
+                options.kbFrom, options.kbTo);
+            pSource.reset(pKenBurns);
+            nWidth = outSize.width;
+            nHeight = outSize.height;
+            std::cout << "Ken Burns over " << pKenBurns->GetImageSize().width << "x" << pKenBurns->GetImageSize().height << std::endl;
+            pNormalizer = NULL;
+        }
+        else if (!options.strSlideshow.empty())
+        {
+            pSlideshow = new SlideshowSource(TimelapseSource::ListImages(options.strSlideshow),
+                cv::Size(options.nOutWidth, options.nOutHeight), std::max(1, (int)std::lround(options.fSlideHold * fFps)),
+                (int)std::lround(options.fSlideFade * fFps), options.eTransition,
+                options.nOutWidth ? options.eFit : FIT_LETTERBOX);
+            pSource.reset(pSlideshow);
+            nWidth = pSlideshow->GetSize().width;
+            nHeight = pSlideshow->GetSize().height;
+            pNormalizer = NULL;
+        }
+        else if (!options.strTimelapse.empty())
+        {
+            // Decoded ahead by a pool of workers, -frames does not apply
+            TimelapseSource *pTimelapse = new TimelapseSource(TimelapseSource::ListImages(options.strTimelapse),
+                options.fTimelapseStep, options.bTimelapseBlend);
+            pSource.reset(pTimelapse);
+            nWidth = pTimelapse->GetSize().width;
+            nHeight = pTimelapse->GetSize().height;
+            std::cout << "Timelapse of " << pTimelapse->GetFrameCount() << " frames" << std::endl;
+        }
+        else if (VideoFrameSource::IsVideoFile(szInFilePath))
+        {
+            // Transcoding, decoded by NVDEC into GpuMat when possible
+            VideoFrameSource *pVideo = new VideoFrameSource(szInFilePath, options.nFrame);
+            pSource.reset(pVideo);
+            nWidth = pVideo->GetSize().width;
+            nHeight = pVideo->GetSize().height;
+            std::cout << "Video decoded by " << (pVideo->IsNvdec() ? "NVDEC" : "cv::VideoCapture") << std::endl;
+        }
+        else
+        {
+            // RGBA, decoded on the GPU for JPEG when built with nvJPEG
+            ImageDecoder decoder(1);
+            cv::cuda::GpuMat srcImgDevice = decoder.Decode(szInFilePath);
+            nWidth = srcImgDevice.cols;
+            nHeight = srcImgDevice.rows;
+            pSource.reset(new StillFrameSource(srcImgDevice, options.nFrame ? options.nFrame : nDefaultFrameCount));
+        }
+        if (!options.vCrop.empty())
+        {
+            // One session per crop, all fed from the same decoded frames
+            std::vector<std::unique_ptr<OutputSink>> vSink;
+            std::vector<OutputSink *> vpSink;
+            std::vector<std::string> vPath;
+            for (size_t i = 0; i < options.vCrop.size(); i++)
+            {
+                ValidateResolution(options.vCrop[i].outSize.width, options.vCrop[i].outSize.height);
+                std::string strPath = InsertSuffix(szOutFilePath, "_" + std::to_string(i));
+                vSink.push_back(CreateOutputSink(options.strSinkType, strPath.c_str()));
+                vpSink.push_back(vSink.back().get());
+                vPath.push_back(strPath);
+            }
+            std::vector<int> vPacket = EncodeCrops(*pSource, options.vCrop, encodeCLIOptions, cuContext, vpSink);
+            for (size_t i = 0; i < vSink.size(); i++)
+            {
+                vSink[i]->Close();
+                std::cout << "Crop " << i << ": " << vPacket[i] << " frames saved in file " << vPath[i] << std::endl;
+            }
+            return 0;
+        }
+        ValidateResolution(nWidth, nHeight);
 
       
         // Open output file
-        std::ofstream fpOut(szOutFilePath, std::ios::out | std::ios::binary);
-        if (!fpOut)
+        std::unique_ptr<OutputSink> pSink = CreateOutputSink(options.strSinkType, szOutFilePath);
+
+        EncodeControl control;
+        control.pNormalizer = pNormalizer;
+        std::unique_ptr<FrameOverlay> pOverlay;
+        if (options.bTimecode || !options.strOverlayText.empty() || !options.strLogo.empty())
         {
-            std::ostringstream err;
-            err << "Unable to open output file: " << szOutFilePath << std::endl;
-            throw std::invalid_argument(err.str());
+            // 16 pixels off the corners
+            pOverlay.reset(new FrameOverlay());
+            if (options.bTimecode)
+            {
+                pOverlay->AddTimecode(cv::Point(16, 16), fFps);
+            }
+            if (!options.strOverlayText.empty())
+            {
+                pOverlay->AddText(cv::Point(16, -16), options.strOverlayText);
+            }
+            if (!options.strLogo.empty())
+            {
+                pOverlay->SetLogo(FrameOverlay::ReadLogo(options.strLogo), cv::Point(-16, 16));
+            }
         }
 
-        EncodeGpuMat(nWidth, nHeight, encodeCLIOptions, cuContext, srcImgDevice, fpOut);
+        control.pOverlay = pOverlay.get();
+        std::unique_ptr<SceneCutDetector> pSceneCut;
+        if (!options.strSceneCut.empty())
+        {
+            pSceneCut.reset(new SceneCutDetector());
+            control.pSceneCut = pSceneCut.get();
+            control.bSceneCutIntra = !_stricmp(options.strSceneCut.c_str(), "intra");
+        }
+        std::unique_ptr<TemporalDenoiser> pDenoiser;
+        if (options.fDenoise > 0)
+        {
+            pDenoiser.reset(new TemporalDenoiser(options.fDenoise));
+            control.pDenoiser = pDenoiser.get();
+        }
+        std::unique_ptr<DuplicateFrameFilter> pDuplicate;
+        if (options.bDropDuplicates)
+        {
+            if (!strcmp(szOutFilePath, "-"))
+            {
+                throw std::invalid_argument("-dropDuplicates writes its frame times next to the -o file, not with -o -\n");
+            }
+            pDuplicate.reset(new DuplicateFrameFilter());
+            control.pDuplicate = pDuplicate.get();
+        }
+        std::unique_ptr<LtrController> pLtr;
+        if (options.bLtr)
+        {
+            pLtr.reset(new LtrController());
+            control.pLtr = pLtr.get();
+        }
+        if (options.bLtrReport && (!pLtr || (!dynamic_cast<VideoFrameSource *>(pSource.get())
+            && !dynamic_cast<StillFrameSource *>(pSource.get()))))
+        {
+            throw std::invalid_argument("-ltrReport needs -ltr and a video or image input\n");
+        }
+        if (options.bDenoiseReport && (!pDenoiser || !dynamic_cast<VideoFrameSource *>(pSource.get())))
+        {
+            throw std::invalid_argument("-denoiseReport needs -denoise and a video input\n");
+        }
+        control.nTemporalLayers = options.nTemporalLayers;
+        std::unique_ptr<BitrateController> pBitrate;
+        if (!options.strBitrateBounds.empty())
+        {
+            pBitrate.reset(new BitrateController(BitrateController::Parse(options.strBitrateBounds)));
+            control.pBitrate = pBitrate.get();
+        }
+        // One encode for all outputs, each gets the temporal layers it takes
+        LayerFanoutSink fanout;
+        std::vector<std::unique_ptr<OutputSink>> vLayerSink;
+        std::vector<std::string> vLayerPath;
+        fanout.AddOutput(pSink.get(), options.nMaxLayer);
+        for (int nLayer : options.vLayerOut)
+        {
+            vLayerPath.push_back(InsertSuffix(szOutFilePath, "_L" + std::to_string(nLayer)));
+            vLayerSink.push_back(CreateOutputSink(options.strSinkType, vLayerPath.back().c_str()));
+            fanout.AddOutput(vLayerSink.back().get(), nLayer);
+        }
+        bool bFanout = options.nMaxLayer >= 0 || !vLayerSink.empty();
+        if (options.bFanoutReport && (vLayerSink.empty() || (!dynamic_cast<VideoFrameSource *>(pSource.get())
+            && !dynamic_cast<StillFrameSource *>(pSource.get()))))
+        {
+            throw std::invalid_argument("-fanoutReport needs -layerOut and a video or image input\n");
+        }
+
+        double fEncodeCpu = GetCpuSeconds(true);
+        EncodeFrameSource(nWidth, nHeight, encodeCLIOptions, cuContext, *pSource, bFanout ? fanout : *pSink, control);
+        fEncodeCpu = GetCpuSeconds(true) - fEncodeCpu;
+        if (bFanout)
+        {
+            for (size_t i = 0; i < vLayerSink.size(); i++)
+            {
+                vLayerSink[i]->Close();
+                std::cout << "Temporal layers up to " << options.vLayerOut[i] << ": " << fanout.GetDropCount((int)i + 1)
+                    << " packets dropped, saved in file " << vLayerPath[i] << std::endl;
+            }
+            std::cout << "Layer fan-out to " << vLayerSink.size() + 1 << " outputs: " << fanout.GetFanoutCpuTime() * 1000
+                << " ms CPU, decode and encode: " << (fEncodeCpu - fanout.GetFanoutCpuTime()) * 1000 << " ms CPU" << std::endl;
+        }
+        if (pSlideshow)
+        {
+            std::cout << "Hold frames copied: " << pSlideshow->GetHoldCopyCount() << ", left as they were: "
+                << pSlideshow->GetHoldSkipCount() << std::endl;
+        }
+        if (pMosaic)
+        {
+            std::cout << "Mosaic cells drawn: " << pMosaic->GetDrawCount() << ", left as they were: "
+                << pMosaic->GetSkipCount() << std::endl;
+        }
+        if (pDuplicate && pDuplicate->GetFrameCount())
+        {
+            std::string strTimestamps = std::string(szOutFilePath) + "_timestamps.txt";
+            pDuplicate->WriteTimestamps(strTimestamps, fFps);
+            std::cout << "Duplicate frames dropped: " << pDuplicate->GetDropCount() << " of " << pDuplicate->GetFrameCount()
+                << " (" << 100.0 * pDuplicate->GetDropCount() / pDuplicate->GetFrameCount() << "% fewer frames encoded)" << std::endl;
+            std::cout << "Frame times saved in file " << strTimestamps << std::endl;
+        }
+        if (pBitrate)
+        {
+            std::cout << "Bitrate: " << pBitrate->GetDecreaseCount() << " decreases, " << pBitrate->GetIncreaseCount()
+                << " increases, lowest " << pBitrate->GetLowestBitrate() << ", final " << pBitrate->GetBitrate() << " bit/s"
+                << std::endl;
+        }
+        if (pLtr && pLtr->GetFrameCount())
+        {
+            std::cout << "Long-term references marked: " << pLtr->GetMarkCount() << ", frames predicted from them: "
+                << pLtr->GetUseCount() << " of " << pLtr->GetFrameCount() << std::endl;
+        }
+        if (pSceneCut && pSceneCut->GetFrameCount())
+        {
+            std::cout << "Scene cuts: " << pSceneCut->GetCutCount() << ", detection "
+                << pSceneCut->GetGpuTime() / pSceneCut->GetFrameCount() << " ms per frame on the GPU" << std::endl;
+        }
+        if (pOverlay)
+        {
+            std::cout << "Overlay glyphs copied: " << pOverlay->GetGlyphCopyCount() << std::endl;
+        }
+        if (pKenBurns)
+        {
+            std::cout << "Tiles read: " << pKenBurns->GetReadCount() << ", downscaled: " << pKenBurns->GetBuildCount()
+                << ", cache hits: " << pKenBurns->GetHitCount() << std::endl;
+        }
         
-        fpOut.close();
+        pSink->Close();
 
         std::cout << "Bitstream saved in file " << szOutFilePath << std::endl;
+        if (options.bDenoiseReport)
+        {
+            ReportDenoise(szInFilePath, options.nFrame, nWidth, nHeight, encodeCLIOptions, cuContext, control,
+                pSink->GetBytesWritten());
+        }
+        if (options.bFanoutReport)
+        {
+            // What a decode and encode per output would cost instead of the fan-out
+            double fTranscodeCpu = GetCpuSeconds(true);
+            for (size_t i = 0; i < vLayerSink.size(); i++)
+            {
+                EncodeAgain(szInFilePath, options.nFrame, nWidth, nHeight, encodeCLIOptions, cuContext, control);
+            }
+            fTranscodeCpu = GetCpuSeconds(true) - fTranscodeCpu;
+            std::cout << "Decode and encode again for each of the " << vLayerSink.size() << " other outputs: "
+                << fTranscodeCpu * 1000 << " ms CPU, layer fan-out: " << fanout.GetFanoutCpuTime() * 1000 << " ms CPU" << std::endl;
+        }
+        if (options.bLtrReport)
+        {
+            control.pLtr = NULL;
+            ReportSizes("long-term references", EncodeAgain(szInFilePath, options.nFrame, nWidth, nHeight, encodeCLIOptions,
+                cuContext, control), pSink->GetBytesWritten());
+        }
     }
     catch (const std::exception &ex)
     {
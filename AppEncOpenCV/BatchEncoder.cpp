@@ -0,0 +1,358 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "../Utils/NvCodecUtils.h"
+#include "BatchEncoder.h"
+#include "EncoderSessionPool.h"
+#include "ImageDecoder.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/highgui.hpp>
+
+std::vector<BatchJob> ReadBatchManifest(const char *szManifestPath)
+{
+    std::ifstream fManifest(szManifestPath);
+    if (!fManifest)
+    {
+        std::ostringstream err;
+        err << "Unable to open manifest " << szManifestPath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    std::vector<BatchJob> vJob;
+    std::string strLine;
+    for (int iLine = 1; std::getline(fManifest, strLine); iLine++)
+    {
+        strLine.erase(strLine.find_last_not_of(" \t\r\n") + 1);
+        size_t iStart = strLine.find_first_not_of(" \t");
+        if (iStart == std::string::npos || strLine[iStart] == '#')
+        {
+            continue;
+        }
+        strLine.erase(0, iStart);
+        size_t iSep = strLine.find('\t');
+        if (iSep == std::string::npos)
+        {
+            iSep = strLine.find_last_of(' ');
+        }
+        if (iSep == std::string::npos)
+        {
+            std::ostringstream err;
+            err << szManifestPath << ":" << iLine << ": expected input and output path" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        BatchJob job;
+        job.strInput = strLine.substr(0, strLine.find_last_not_of(" \t", iSep) + 1);
+        job.strOutput = strLine.substr(strLine.find_first_not_of(" \t", iSep));
+        vJob.push_back(job);
+    }
+    return vJob;
+}
+
+namespace
+{
+
+struct BatchResult
+{
+    std::string strError;
+    bool bEncoded = false;
+    int nPacket = 0;
+    uint64_t nBytes = 0;
+    double dEncodeMs = 0;
+};
+
+struct DecodedImage
+{
+    size_t iJob;
+    // RGBA
+    cv::cuda::GpuMat image;
+};
+
+/**
+*  @brief Decoded images waiting for an encoder, bucketed by geometry.
+*/
+class DecodedQueue
+{
+public:
+    DecodedQueue(size_t nMaxQueued, int nDecoder) : m_nMaxQueued(nMaxQueued), m_nDecoder(nDecoder) {}
+
+    void Push(DecodedImage &&decoded)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvSpace.wait(lock, [this] { return m_nQueued < m_nMaxQueued; });
+        std::pair<int, int> key(decoded.image.cols, decoded.image.rows);
+        m_mBucket[key].push_back(std::move(decoded));
+        m_nQueued++;
+        m_cvReady.notify_all();
+    }
+
+    void DecoderDone()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_nDecoder--;
+        m_cvReady.notify_all();
+    }
+
+    /**
+    *  @brief Prefers an image of the given geometry; otherwise takes one of
+    *  the largest bucket, which switches the session to the geometry with the
+    *  most work. Returns false once all decoders are done and nothing is left.
+    */
+    bool Pop(int nWidth, int nHeight, DecodedImage &decoded)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvReady.wait(lock, [this] { return m_nQueued || !m_nDecoder; });
+        if (!m_nQueued)
+        {
+            return false;
+        }
+        auto itBucket = m_mBucket.find(std::make_pair(nWidth, nHeight));
+        if (itBucket == m_mBucket.end())
+        {
+            itBucket = std::max_element(m_mBucket.begin(), m_mBucket.end(),
+                [](const Bucket::value_type &a, const Bucket::value_type &b) { return a.second.size() < b.second.size(); });
+        }
+        decoded = std::move(itBucket->second.front());
+        itBucket->second.pop_front();
+        if (itBucket->second.empty())
+        {
+            m_mBucket.erase(itBucket);
+        }
+        m_nQueued--;
+        m_cvSpace.notify_one();
+        return true;
+    }
+
+private:
+    typedef std::map<std::pair<int, int>, std::deque<DecodedImage>> Bucket;
+    Bucket m_mBucket;
+    size_t m_nQueued = 0, m_nMaxQueued;
+    int m_nDecoder;
+    std::mutex m_mutex;
+    std::condition_variable m_cvReady, m_cvSpace;
+};
+
+}
+
+int RunBatchEncode(const std::vector<BatchJob> &vJob, const BatchOptions &options)
+{
+    ck(cuInit(0));
+    CUdevice cuDevice = 0;
+    ck(cuDeviceGet(&cuDevice, options.iGpu));
+    // Shared with the OpenCV CUDA modules, see EncodeDaemon.cpp
+    CUcontext cuContext = NULL;
+    ck(cuDevicePrimaryCtxRetain(&cuContext, cuDevice));
+
+    std::vector<BatchResult> vResult(vJob.size());
+    auto tStart = std::chrono::steady_clock::now();
+    {
+        EncoderSessionPool pool(cuContext, options.nSessions);
+        cv::Size minSize = pool.GetMinSize(options.strEncoderParams);
+        int nDecoder = (int)std::max(1u, std::min(std::thread::hardware_concurrency(), 8u));
+        // Jobs a decoder takes at once, one nvJPEG batch
+        const size_t nDecodeBatch = 4;
+        // Enough decoded images to keep every session busy while switching geometry
+        DecodedQueue queue(options.nSessions * 4, nDecoder);
+        std::atomic<size_t> iNextJob{0};
+        // Of a decoder thread that gave up, for the jobs nobody decoded
+        std::mutex decoderErrorMutex;
+        std::string strDecoderError;
+
+        std::vector<std::thread> vDecoder;
+        for (int i = 0; i < nDecoder; i++)
+        {
+            vDecoder.emplace_back([&]() {
+                std::vector<std::string> vPath, vError;
+                std::vector<cv::cuda::GpuMat> vImage;
+                try
+                {
+                    cv::cuda::setDevice(options.iGpu);
+                    // The decoders are the CPU threads of the fallback path
+                    ImageDecoder decoder((int)nDecodeBatch, 1);
+                    cv::cuda::Stream stream;
+                    for (size_t iFirst; (iFirst = iNextJob.fetch_add(nDecodeBatch)) < vJob.size(); )
+                    {
+                        size_t nBatch = std::min(nDecodeBatch, vJob.size() - iFirst);
+                        vPath.clear();
+                        for (size_t i = 0; i < nBatch; i++)
+                        {
+                            vPath.push_back(vJob[iFirst + i].strInput);
+                        }
+                        try
+                        {
+                            decoder.Decode(vPath, vImage, vError, stream);
+                        }
+                        catch (const std::exception &ex)
+                        {
+                            // E.g. out of device memory, fails the whole batch
+                            vImage.assign(nBatch, cv::cuda::GpuMat());
+                            vError.assign(nBatch, ex.what());
+                        }
+                        for (size_t i = 0; i < nBatch; i++)
+                        {
+                            size_t iJob = iFirst + i;
+                            try
+                            {
+                                if (vImage[i].empty())
+                                {
+                                    throw std::invalid_argument(vError[i]);
+                                }
+                                ValidateResolution(vImage[i].cols, vImage[i].rows);
+                                queue.Push(DecodedImage{iJob, vImage[i]});
+                            }
+                            catch (const std::exception &ex)
+                            {
+                                // Each job is owned by exactly one decoder until it is queued
+                                vResult[iJob].strError = ex.what();
+                            }
+                        }
+                    }
+                }
+                catch (const std::exception &ex)
+                {
+                    std::cout << "Decoder failed: " << ex.what();
+                    std::lock_guard<std::mutex> lock(decoderErrorMutex);
+                    strDecoderError = ex.what();
+                }
+                queue.DecoderDone();
+            });
+        }
+
+        std::vector<std::thread> vEncoder;
+        for (int i = 0; i < options.nSessions; i++)
+        {
+            vEncoder.emplace_back([&]() {
+                cv::cuda::setDevice(options.iGpu);
+                FrameNormalizer normalizer(options.eFit, options.nOutWidth, options.nOutHeight);
+                std::unique_ptr<EncoderSession> pSession;
+                cv::Size sessionSize;
+                // Size of the last image, preferred to save reconfiguring the session
+                int nWidth = 0, nHeight = 0;
+                bool bFresh = true;
+                DecodedImage decoded;
+                while (queue.Pop(nWidth, nHeight, decoded))
+                {
+                    BatchResult &result = vResult[decoded.iJob];
+                    try
+                    {
+                        auto tJob = std::chrono::steady_clock::now();
+                        nWidth = decoded.image.cols;
+                        nHeight = decoded.image.rows;
+                        cv::Size imageSessionSize = normalizer.GetSessionSize(decoded.image.size(), minSize);
+                        if (!pSession || imageSessionSize != sessionSize)
+                        {
+                            if (pSession)
+                            {
+                                pSession->MarkReusable();
+                                pSession.reset();
+                            }
+                            sessionSize = imageSessionSize;
+                            pSession = pool.Acquire({sessionSize.width, sessionSize.height, NV_ENC_BUFFER_FORMAT_ABGR, options.strEncoderParams});
+                            bFresh = true;
+                        }
+                        else if (!bFresh)
+                        {
+                            // Same geometry as the previous job, keep the session
+                            ResetEncoder(pSession->Get());
+                        }
+                        bFresh = false;
+
+                        StillFrameSource source(decoded.image, options.nFrame);
+                        std::unique_ptr<OutputSink> pSink = CreateOutputSink(options.strSinkType, vJob[decoded.iJob].strOutput.c_str());
+                        EncodeControl control;
+                        control.pNormalizer = &normalizer;
+                        control.minSize = minSize;
+                        result.nPacket = EncodeFrames(pSession->Get(), cuContext, source, *pSink, control);
+                        pSink->Close();
+                        result.nBytes = pSink->GetBytesWritten();
+                        result.dEncodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tJob).count();
+                        result.bEncoded = true;
+                    }
+                    catch (const std::exception &ex)
+                    {
+                        result.strError = ex.what();
+                        // The encoder may be mid-stream; the pool destroys it
+                        pSession.reset();
+                    }
+                }
+                if (pSession)
+                {
+                    pSession->MarkReusable();
+                }
+            });
+        }
+        for (std::thread &t : vDecoder)
+        {
+            t.join();
+        }
+        for (std::thread &t : vEncoder)
+        {
+            t.join();
+        }
+        for (BatchResult &result : vResult)
+        {
+            if (!result.bEncoded && result.strError.empty())
+            {
+                // Claimed by a decoder that failed before decoding it, or by none
+                result.strError = "Not decoded: " + (strDecoderError.empty() ? std::string("no decoder left\n") : strDecoderError);
+            }
+        }
+        std::cout << "Encoder sessions created: " << pool.GetCreatedCount() << ", reused: " << pool.GetReusedCount() << std::endl;
+    }
+    ck(cuDevicePrimaryCtxRelease(cuDevice));
+
+    std::unique_ptr<std::ofstream> pReport;
+    if (!options.strReportPath.empty())
+    {
+        pReport.reset(new std::ofstream(options.strReportPath));
+        if (!*pReport)
+        {
+            std::cout << "Unable to write report " << options.strReportPath << std::endl;
+            pReport.reset();
+        }
+        else
+        {
+            *pReport << "input,output,status,packets,bytes,encode_ms,error" << std::endl;
+        }
+    }
+    int nFailed = 0;
+    for (size_t i = 0; i < vJob.size(); i++)
+    {
+        const BatchResult &result = vResult[i];
+        std::string strError = result.strError;
+        strError.erase(strError.find_last_not_of("\r\n") + 1);
+        if (!strError.empty())
+        {
+            nFailed++;
+            std::cout << "Failed: " << vJob[i].strInput << ": " << strError << std::endl;
+        }
+        if (pReport)
+        {
+            std::replace(strError.begin(), strError.end(), '"', '\'');
+            *pReport << "\"" << vJob[i].strInput << "\",\"" << vJob[i].strOutput << "\"," << (strError.empty() ? "ok" : "failed")
+                << "," << result.nPacket << "," << result.nBytes << "," << result.dEncodeMs << ",\"" << strError << "\"" << std::endl;
+        }
+    }
+    std::cout << "Batch of " << vJob.size() << " jobs: " << vJob.size() - nFailed << " encoded, " << nFailed << " failed in "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() << " s" << std::endl;
+    return nFailed;
+}
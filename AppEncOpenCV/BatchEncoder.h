@@ -0,0 +1,60 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Encodes many images in one process. Images are decoded by a pool of
+*  threads, in batches and on the GPU for JPEG with nvJPEG (see
+*  ImageDecoder), and queued per geometry; every encoder worker owns one NVENC
+*  session and keeps taking images of its session's geometry, so a session
+*  is only recreated when that geometry has run out. Failed jobs are recorded
+*  and the batch goes on. With an output size all images share the sessions
+*  of that size, whatever their own size.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "GpuMatEncoder.h"
+
+struct BatchJob
+{
+    std::string strInput;
+    std::string strOutput;
+};
+
+struct BatchOptions
+{
+    std::string strEncoderParams;
+    std::string strSinkType = "file";
+    // Frames per image
+    int nFrame = nDefaultFrameCount;
+    int iGpu = 0;
+    // Output geometry, see FrameNormalizer
+    FitMode eFit = FIT_PAD;
+    int nOutWidth = 0, nOutHeight = 0;
+    // Concurrent encoder sessions
+    int nSessions = 3;
+    // CSV with one line per job, optional
+    std::string strReportPath;
+};
+
+/**
+*  @brief Reads jobs from a manifest with one "input output" pair per line.
+*  Input and output are separated by a tab, or by the last run of blanks if
+*  the line has no tab. Empty lines and lines starting with # are skipped.
+*/
+std::vector<BatchJob> ReadBatchManifest(const char *szManifestPath);
+
+/**
+*  @brief Encodes all jobs and returns the number of jobs that failed.
+*/
+int RunBatchEncode(const std::vector<BatchJob> &vJob, const BatchOptions &options);
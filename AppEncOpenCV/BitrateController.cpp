@@ -0,0 +1,149 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include "BitrateController.h"
+#include "GpuMatEncoder.h"
+
+int BitrateController::ParseBitrate(const std::string &str)
+{
+    char *szEnd = NULL;
+    double fBitrate = strtod(str.c_str(), &szEnd);
+    if (*szEnd == 'k' || *szEnd == 'K')
+    {
+        fBitrate *= 1000;
+        szEnd++;
+    }
+    else if (*szEnd == 'm' || *szEnd == 'M')
+    {
+        fBitrate *= 1000000;
+        szEnd++;
+    }
+    return *szEnd || fBitrate < 1 || fBitrate > 2e9 ? 0 : (int)fBitrate;
+}
+
+BitrateController::BitrateController(int nMinBitrate, int nMaxBitrate, double fLowDelay, double fHighDelay,
+    double fMeasureInterval, int nRaiseIntervals) : m_nMinBitrate(nMinBitrate), m_nMaxBitrate(nMaxBitrate),
+    m_fLowDelay(fLowDelay), m_fHighDelay(fHighDelay), m_fMeasureInterval(fMeasureInterval), m_nRaiseIntervals(nRaiseIntervals)
+{
+    if (nMinBitrate <= 0 || nMaxBitrate < nMinBitrate || fLowDelay < 0 || fHighDelay <= fLowDelay || fMeasureInterval <= 0
+        || nRaiseIntervals < 1)
+    {
+        throw std::invalid_argument("Invalid bitrate adaptation settings\n");
+    }
+}
+
+BitrateController BitrateController::Parse(const std::string &strBounds)
+{
+    size_t iColon = strBounds.find(':');
+    int nMin = iColon == std::string::npos ? 0 : ParseBitrate(strBounds.substr(0, iColon));
+    int nMax = iColon == std::string::npos ? 0 : ParseBitrate(strBounds.substr(iColon + 1));
+    if (!nMin || nMax < nMin)
+    {
+        std::ostringstream err;
+        err << "Invalid bitrate bounds \"" << strBounds << "\", expected min:max such as 1M:8M" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    return BitrateController(nMin, nMax);
+}
+
+void BitrateController::Start(NvEncoder *pEnc)
+{
+    NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+    initializeParams.encodeConfig = &encodeConfig;
+    pEnc->GetInitializeParams(&initializeParams);
+    if (encodeConfig.rcParams.rateControlMode == NV_ENC_PARAMS_RC_CONSTQP)
+    {
+        throw std::invalid_argument("Bitrate adaptation needs a rate control mode with a bitrate, not constqp\n");
+    }
+    m_nSessionBitrate = (int)encodeConfig.rcParams.averageBitRate;
+    m_nSessionMaxBitrate = (int)encodeConfig.rcParams.maxBitRate;
+
+    int nBitrate = m_nBitrate ? m_nBitrate : (m_nSessionBitrate ? m_nSessionBitrate : m_nMaxBitrate);
+    m_nBitrate = 0;
+    Change(pEnc, nBitrate);
+    m_bSample = false;
+    m_nClear = 0;
+}
+
+void BitrateController::Update(NvEncoder *pEnc, OutputSink &sink)
+{
+    auto tNow = std::chrono::steady_clock::now();
+    uint64_t nWritten = sink.GetBytesWritten();
+    uint64_t nQueued = std::min<uint64_t>(sink.GetQueuedBytes(), nWritten);
+    uint64_t nSent = nWritten - nQueued;
+    if (!m_bSample)
+    {
+        m_tSample = tNow;
+        m_nSentAtSample = nSent;
+        m_bSample = true;
+        return;
+    }
+    double fElapsed = std::chrono::duration<double>(tNow - m_tSample).count();
+    if (fElapsed < m_fMeasureInterval)
+    {
+        return;
+    }
+    double fSendRate = (nSent - m_nSentAtSample) * 8.0 / fElapsed;
+    double fDelay = nQueued * 8.0 / m_nBitrate;
+    m_tSample = tNow;
+    m_nSentAtSample = nSent;
+
+    // Between the two delays nothing changes, so the bitrate does not oscillate
+    if (fDelay > m_fHighDelay || (fDelay > m_fLowDelay && fSendRate < 0.9 * m_nBitrate))
+    {
+        m_nClear = 0;
+        Change(pEnc, (int)std::min(0.8 * m_nBitrate, 0.9 * fSendRate));
+    }
+    else if (fDelay > m_fLowDelay)
+    {
+        m_nClear = 0;
+    }
+    else if (++m_nClear >= m_nRaiseIntervals)
+    {
+        m_nClear = 0;
+        Change(pEnc, (int)(1.1 * m_nBitrate));
+    }
+}
+
+void BitrateController::Finish(NvEncoder *pEnc)
+{
+    if (m_nBitrate != m_nSessionBitrate)
+    {
+        SetBitrate(pEnc, m_nSessionBitrate, m_nSessionMaxBitrate);
+    }
+}
+
+void BitrateController::Change(NvEncoder *pEnc, int nBitrate)
+{
+    nBitrate = std::max(m_nMinBitrate, std::min(m_nMaxBitrate, nBitrate));
+    if (nBitrate == m_nBitrate)
+    {
+        return;
+    }
+    if (m_nBitrate)
+    {
+        (nBitrate < m_nBitrate ? m_nDecrease : m_nIncrease)++;
+    }
+    if (nBitrate != m_nSessionBitrate || m_nBitrate)
+    {
+        // VBR keeps the ratio of peak to average bitrate of the session
+        int nMaxBitrate = m_nSessionBitrate && m_nSessionMaxBitrate
+            ? (int)((int64_t)m_nSessionMaxBitrate * nBitrate / m_nSessionBitrate) : 0;
+        SetBitrate(pEnc, nBitrate, nMaxBitrate);
+    }
+    m_nBitrate = nBitrate;
+    m_nLowest = m_nLowest ? std::min(m_nLowest, nBitrate) : nBitrate;
+}
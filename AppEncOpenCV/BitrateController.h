@@ -0,0 +1,86 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include "NvEncoder/NvEncoder.h"
+#include "OutputSink.h"
+
+/**
+*  @brief Adapts the bitrate of a session to what its sink drains, instead of
+*  letting a slow network or writer queue up ever more of the stream.
+*
+*  Every fMeasureInterval seconds the bytes queued in the sink (see
+*  OutputSink::GetQueuedBytes()) are converted into the delay they mean at the
+*  current bitrate, and the send rate is taken from the bytes that left the
+*  sink. Above fHighDelay, or above fLowDelay while the sink drains less than
+*  the bitrate, the bitrate drops to 80% or to 90% of the send rate, whichever
+*  is lower. It rises by 10% only after nRaiseIntervals intervals in a row at
+*  or below fLowDelay; in between it is left alone. Changes are made with an
+*  encoder reconfigure without IDR and stay within the bounds.
+*/
+class BitrateController
+{
+public:
+    BitrateController(int nMinBitrate, int nMaxBitrate, double fLowDelay = 0.05, double fHighDelay = 0.25,
+        double fMeasureInterval = 0.5, int nRaiseIntervals = 4);
+
+    /**
+    *  @brief Parses "min:max" in bits per second, each with an optional k or M
+    *  suffix; throws std::invalid_argument otherwise.
+    */
+    static BitrateController Parse(const std::string &strBounds);
+    /**
+    *  @brief Bits per second from a number with an optional k or M suffix, 0
+    *  if str is not one.
+    */
+    static int ParseBitrate(const std::string &str);
+
+    /**
+    *  @brief Takes over pEnc for a stream. The first stream starts at the
+    *  bitrate of the session, within the bounds; later ones, e.g. on another
+    *  session after preemption, continue at the current bitrate.
+    */
+    void Start(NvEncoder *pEnc);
+    /**
+    *  @brief Measures sink after the packets of a frame have been written to
+    *  it and changes the bitrate of pEnc if needed.
+    */
+    void Update(NvEncoder *pEnc, OutputSink &sink);
+    /**
+    *  @brief Gives pEnc its own bitrate back, so pooled sessions keep the
+    *  parameters they were created with.
+    */
+    void Finish(NvEncoder *pEnc);
+
+    int GetBitrate() const { return m_nBitrate; }
+    int GetLowestBitrate() const { return m_nLowest; }
+    int GetDecreaseCount() const { return m_nDecrease; }
+    int GetIncreaseCount() const { return m_nIncrease; }
+
+private:
+    void Change(NvEncoder *pEnc, int nBitrate);
+
+    int m_nMinBitrate, m_nMaxBitrate;
+    double m_fLowDelay, m_fHighDelay, m_fMeasureInterval;
+    int m_nRaiseIntervals;
+
+    // Of the session taken over by Start()
+    int m_nSessionBitrate = 0, m_nSessionMaxBitrate = 0;
+    int m_nBitrate = 0, m_nLowest = 0;
+    std::chrono::steady_clock::time_point m_tSample;
+    uint64_t m_nSentAtSample = 0;
+    bool m_bSample = false;
+    int m_nClear = 0;
+    int m_nDecrease = 0, m_nIncrease = 0;
+};
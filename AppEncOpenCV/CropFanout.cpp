@@ -0,0 +1,189 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "CropFanout.h"
+
+#include <opencv2/cudawarping.hpp>
+
+CropWindow ParseCropWindow(const std::string &strCrop)
+{
+    CropWindow crop;
+    int nField = sscanf(strCrop.c_str(), "%dx%d+%d+%d:%dx%d", &crop.rect.width, &crop.rect.height, &crop.rect.x, &crop.rect.y,
+        &crop.outSize.width, &crop.outSize.height);
+    if (nField == 4)
+    {
+        crop.outSize = crop.rect.size();
+    }
+    if ((nField != 4 && nField != 6) || crop.rect.width <= 0 || crop.rect.height <= 0 || crop.rect.x < 0 || crop.rect.y < 0
+        || crop.outSize.width <= 0 || crop.outSize.height <= 0 || crop.outSize.width % 2 || crop.outSize.height % 2)
+    {
+        std::ostringstream err;
+        err << "Invalid crop " << strCrop << ", expected WxH+X+Y or WxH+X+Y:WxH with an even encode size" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    return crop;
+}
+
+CropFanout::CropFanout(FrameSource &source, const std::vector<CropWindow> &vCrop, CropTracker fnTracker)
+    : m_source(source), m_vCrop(vCrop), m_fnTracker(fnTracker), m_viNext(vCrop.size(), 0)
+{
+    if (source.IsRenderer())
+    {
+        throw std::invalid_argument("Crops need a source of frames, not a renderer\n");
+    }
+    for (size_t i = 0; i < vCrop.size(); i++)
+    {
+        m_vView.emplace_back(new View(this, (int)i));
+        m_vRect.push_back(vCrop[i].rect);
+    }
+}
+
+void CropFanout::Abort()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bAbort = true;
+    m_cv.notify_all();
+}
+
+bool CropFanout::RenderCrop(int iCrop, cv::cuda::GpuMat &dst, cv::cuda::Stream &stream)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int iFrame = m_viNext[iCrop];
+    // The first view done with the previous frame reads this one
+    while (m_nFrame <= iFrame)
+    {
+        if (m_bAbort || m_bEnd)
+        {
+            return false;
+        }
+        if (m_nPending || m_bReading)
+        {
+            m_cv.wait(lock);
+            continue;
+        }
+        m_bReading = true;
+        lock.unlock();
+        bool bFrame = false;
+        try
+        {
+            bFrame = m_source.GetNextFrame(m_frame);
+            if (bFrame && m_fnTracker)
+            {
+                m_fnTracker(iFrame, m_frame, m_vRect);
+            }
+        }
+        catch (...)
+        {
+            lock.lock();
+            m_bReading = false;
+            m_bAbort = true;
+            m_cv.notify_all();
+            throw;
+        }
+        lock.lock();
+        m_bReading = false;
+        if (bFrame)
+        {
+            // Kept inside the frame, shrunk to it if larger
+            for (cv::Rect &rect : m_vRect)
+            {
+                rect.width = std::min(rect.width, m_frame.cols);
+                rect.height = std::min(rect.height, m_frame.rows);
+                rect.x = std::min(std::max(rect.x, 0), m_frame.cols - rect.width);
+                rect.y = std::min(std::max(rect.y, 0), m_frame.rows - rect.height);
+            }
+            m_nFrame++;
+            m_nPending = (int)m_vView.size();
+        }
+        else
+        {
+            m_bEnd = true;
+        }
+        m_cv.notify_all();
+    }
+    cv::cuda::GpuMat roi = m_frame(m_vRect[iCrop]);
+    lock.unlock();
+
+    if (dst.size() != m_vCrop[iCrop].outSize)
+    {
+        std::ostringstream err;
+        err << "Crop " << iCrop << " rendered into a frame of " << dst.cols << "x" << dst.rows << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    if (roi.size() == dst.size())
+    {
+        // A pitched 2D copy out of the source frame, the only copy of the crop
+        roi.copyTo(dst, stream);
+    }
+    else
+    {
+        cv::cuda::resize(roi, dst, dst.size(), 0, 0, roi.cols > dst.cols ? cv::INTER_AREA : cv::INTER_LINEAR, stream);
+    }
+    // The source frame may be replaced once every view is done with it
+    stream.waitForCompletion();
+
+    lock.lock();
+    m_viNext[iCrop]++;
+    if (!--m_nPending)
+    {
+        m_cv.notify_all();
+    }
+    return true;
+}
+
+std::vector<int> EncodeCrops(FrameSource &source, const std::vector<CropWindow> &vCrop, NvEncoderInitParam encodeCLIOptions,
+    CUcontext cuContext, const std::vector<OutputSink *> &vSink, CropTracker fnTracker)
+{
+    if (vCrop.empty() || vSink.size() != vCrop.size())
+    {
+        throw std::invalid_argument("Crops need one output each\n");
+    }
+    CropFanout fanout(source, vCrop, fnTracker);
+    std::vector<int> vPacket(vCrop.size(), 0);
+    std::vector<std::exception_ptr> vError(vCrop.size());
+    std::vector<std::thread> vThread;
+    for (size_t i = 0; i < vCrop.size(); i++)
+    {
+        vThread.emplace_back([&, i]() {
+            try
+            {
+                NV_ENC_BUFFER_FORMAT eFormat = NV_ENC_BUFFER_FORMAT_ABGR;
+                std::unique_ptr<NvEncoderGpuMat> pEnc(new NvEncoderGpuMat(cuContext, vCrop[i].outSize.width, vCrop[i].outSize.height, eFormat));
+                InitializeEncoder(pEnc, encodeCLIOptions, eFormat);
+                vPacket[i] = EncodeFrames(pEnc.get(), cuContext, fanout.GetView((int)i), *vSink[i]);
+                pEnc->DestroyEncoder();
+            }
+            catch (...)
+            {
+                vError[i] = std::current_exception();
+                fanout.Abort();
+            }
+        });
+    }
+    for (std::thread &thread : vThread)
+    {
+        thread.join();
+    }
+    for (std::exception_ptr &pError : vError)
+    {
+        if (pError)
+        {
+            std::rethrow_exception(pError);
+        }
+    }
+    return vPacket;
+}
@@ -0,0 +1,111 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "GpuMatEncoder.h"
+
+/**
+*  @brief A crop of the source frames encoded as a stream of its own: rect in
+*  source coordinates and the encode size, the size of rect if empty. A rect
+*  of another size than the encode size is scaled.
+*/
+struct CropWindow
+{
+    cv::Rect rect;
+    cv::Size outSize;
+};
+
+/**
+*  @brief Parses "WxH+X+Y", optionally followed by ":WxH" for the encode size;
+*  throws std::invalid_argument otherwise.
+*/
+CropWindow ParseCropWindow(const std::string &strCrop);
+
+/**
+*  @brief Called once per source frame, before any crop of it is drawn, to
+*  move the crops (virtual camera tracking). vRect holds the current crop
+*  rectangles; they are clamped into the frame afterwards.
+*/
+typedef std::function<void(int iFrame, const cv::cuda::GpuMat &frame, std::vector<cv::Rect> &vRect)> CropTracker;
+
+/**
+*  @brief Shares the frames of one source between several encoder sessions,
+*  one per crop. Each session encodes GetView(i), a renderer that copies its
+*  crop, a GpuMat ROI of the source frame, straight into the session input
+*  buffer: the source is read and uploaded once, the crops are never copied
+*  but into the encoders. The next source frame is read once every view has
+*  drawn the current one.
+*/
+class CropFanout
+{
+public:
+    CropFanout(FrameSource &source, const std::vector<CropWindow> &vCrop, CropTracker fnTracker = CropTracker());
+
+    int GetCropCount() const { return (int)m_vCrop.size(); }
+    FrameSource &GetView(int iCrop) { return *m_vView[iCrop]; }
+    /**
+    *  @brief Ends every view, for a session that failed: the others would
+    *  otherwise wait for it forever.
+    */
+    void Abort();
+
+private:
+    class View : public FrameSource
+    {
+    public:
+        View(CropFanout *pFanout, int iCrop) : m_pFanout(pFanout), m_iCrop(iCrop) {}
+        bool GetNextFrame(cv::cuda::GpuMat &frame) override { return false; }
+        bool IsRenderer() const override { return true; }
+        bool RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) override
+        {
+            return m_pFanout->RenderCrop(m_iCrop, dst, stream);
+        }
+
+    private:
+        CropFanout *m_pFanout;
+        int m_iCrop;
+    };
+
+    bool RenderCrop(int iCrop, cv::cuda::GpuMat &dst, cv::cuda::Stream &stream);
+
+    FrameSource &m_source;
+    std::vector<CropWindow> m_vCrop;
+    CropTracker m_fnTracker;
+    std::vector<std::unique_ptr<View>> m_vView;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    cv::cuda::GpuMat m_frame;
+    std::vector<cv::Rect> m_vRect;
+    // Source frames read, and the next one of every view
+    int m_nFrame = 0;
+    std::vector<int> m_viNext;
+    // Views still to draw the current frame
+    int m_nPending = 0;
+    bool m_bReading = false, m_bEnd = false, m_bAbort = false;
+    std::exception_ptr m_pError;
+};
+
+/**
+*  @brief Encodes every crop of vCrop from the frames of source into vSink[i],
+*  on one ABGR session per crop running on a thread of its own. Returns the
+*  number of packets of every stream; throws the first error of any session.
+*/
+std::vector<int> EncodeCrops(FrameSource &source, const std::vector<CropWindow> &vCrop, NvEncoderInitParam encodeCLIOptions,
+    CUcontext cuContext, const std::vector<OutputSink *> &vSink, CropTracker fnTracker = CropTracker());
@@ -0,0 +1,74 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "DuplicateFrameFilter.h"
+
+#include <opencv2/cudaarithm.hpp>
+
+bool DuplicateFrameFilter::IsDuplicate(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream)
+{
+    if (frame.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Duplicate detection needs RGBA frames\n");
+    }
+    int64_t iFrame = m_nFrame++;
+    if (m_last.size() == frame.size())
+    {
+        // As bytes, the reductions work on one channel
+        cv::cuda::calcNormDiff(frame.reshape(1), m_last.reshape(1), m_diff, cv::NORM_INF, stream);
+        m_diff.download(m_hostDiff, stream);
+        stream.waitForCompletion();
+        if (cv::sum(m_hostDiff)[0] == 0)
+        {
+            return true;
+        }
+    }
+    frame.copyTo(m_last, stream);
+    m_viKept.push_back(iFrame);
+    return false;
+}
+
+const cv::cuda::GpuMat *DuplicateFrameFilter::KeepLast()
+{
+    if (m_viKept.empty() || m_viKept.back() == m_nFrame - 1)
+    {
+        return NULL;
+    }
+    // Equal to the last frame kept, so its copy is the frame
+    m_viKept.push_back(m_nFrame - 1);
+    return &m_last;
+}
+
+void DuplicateFrameFilter::WriteTimestamps(const std::string &strPath, double fFps) const
+{
+    std::ofstream fTimestamps(strPath);
+    if (!fTimestamps)
+    {
+        std::ostringstream err;
+        err << "Unable to open timestamp file " << strPath << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    fTimestamps << "# timestamp format v2" << std::endl << std::fixed << std::setprecision(3);
+    for (int64_t iFrame : m_viKept)
+    {
+        fTimestamps << iFrame * 1000.0 / fFps << std::endl;
+    }
+    if (!fTimestamps)
+    {
+        std::ostringstream err;
+        err << "Unable to write timestamp file " << strPath << std::endl;
+        throw std::runtime_error(err.str());
+    }
+}
@@ -0,0 +1,66 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief Finds frames identical to the last frame kept, so they are not
+*  encoded: the kept frame then simply lasts longer, which makes variable
+*  frame rate output with encoder load proportional to what changes (screen
+*  capture, slides, still cameras).
+*
+*  Frames are compared on the GPU with the copy of the last kept frame, as
+*  the largest absolute difference of any byte: exact, where a hash could
+*  collide, and only one number comes back to the host. Kept frames are
+*  copied for the next comparison.
+*/
+class DuplicateFrameFilter
+{
+public:
+    /**
+    *  @brief Returns true if frame (RGBA), the next source frame, equals the
+    *  last frame kept; otherwise keeps it. Waits for stream.
+    */
+    bool IsDuplicate(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream);
+    /**
+    *  @brief Called once the source is exhausted. If its last frame was
+    *  dropped, keeps it after all and returns the copy to encode, so that its
+    *  time marks the end of the stream and a trailing still is not cut;
+    *  returns NULL otherwise.
+    */
+    const cv::cuda::GpuMat *KeepLast();
+
+    long long GetFrameCount() const { return m_nFrame; }
+    long long GetDropCount() const { return m_nFrame - (long long)m_viKept.size(); }
+    /**
+    *  @brief Source frame index of every frame kept, in order.
+    */
+    const std::vector<int64_t> &GetKeptFrames() const { return m_viKept; }
+
+    /**
+    *  @brief Writes the presentation time of every kept frame at fFps, in
+    *  the timestamp format v2 of mkvmerge, to mux the elementary stream as
+    *  variable frame rate. Throws std::runtime_error if it cannot.
+    */
+    void WriteTimestamps(const std::string &strPath, double fFps) const;
+
+private:
+    cv::cuda::GpuMat m_last, m_diff;
+    cv::Mat m_hostDiff;
+    long long m_nFrame = 0;
+    std::vector<int64_t> m_viKept;
+};
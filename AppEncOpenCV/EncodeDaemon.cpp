@@ -0,0 +1,650 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include "EncodeDaemon.h"
+
+#ifndef _WIN32
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "../Utils/NvCodecUtils.h"
+#include "EncoderSessionPool.h"
+#include "JobScheduler.h"
+#include "PinnedMatAllocator.h"
+#include "PinnedUploadSource.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/highgui.hpp>
+
+struct DaemonJob
+{
+    std::string strInput;
+    std::string strShm;
+    int nWidth = 0, nHeight = 0;
+    int nFrame = nDefaultFrameCount;
+    JobRequest request;
+    bool bStats = false;
+    FitMode eFit = FIT_PAD;
+    int nOutWidth = 0, nOutHeight = 0;
+    int nTemporalLayers = 0, nMaxLayer = -1;
+    std::string strBitrateBounds;
+    std::string strParams;
+};
+
+/**
+*  @brief Streams packets to the client in the framing described in EncodeDaemon.h.
+*/
+class SocketSink : public OutputSink
+{
+public:
+    SocketSink(int fd) : m_fd(fd) {}
+
+    void Write(const uint8_t *pData, size_t nSize) override
+    {
+        uint32_t nLength = (uint32_t)nSize;
+        struct iovec aIov[2] = {{&nLength, sizeof(nLength)}, {const_cast<uint8_t*>(pData), nSize}};
+        Send(aIov, 2);
+        m_nBytesWritten += nSize;
+    }
+
+    /**
+    *  @brief Packets of temporal layers above nMaxLayer are not sent, so a
+    *  client on a slow link gets the base layer at a fraction of the frame
+    *  rate. All are sent if nMaxLayer is negative.
+    */
+    void SetMaxLayer(int nMaxLayer)
+    {
+        m_nMaxLayer = nMaxLayer;
+    }
+
+    void WritePacket(const uint8_t *pData, size_t nSize, int nTemporalId) override
+    {
+        if (m_nMaxLayer < 0 || nTemporalId <= m_nMaxLayer)
+        {
+            Write(pData, nSize);
+        }
+    }
+
+    /**
+    *  @brief Bytes the client has not read yet, which are charged to the send
+    *  buffer of a Unix domain socket until then.
+    */
+    size_t GetQueuedBytes() override
+    {
+        int nQueued = 0;
+        return ioctl(m_fd, TIOCOUTQ, &nQueued) ? 0 : (size_t)nQueued;
+    }
+
+    void Close() override
+    {
+        uint32_t nEnd = 0;
+        struct iovec iov = {&nEnd, sizeof(nEnd)};
+        Send(&iov, 1);
+    }
+
+    void SendError(const std::string &strError)
+    {
+        uint32_t aHeader[2] = {nDaemonError, (uint32_t)strError.size()};
+        struct iovec aIov[2] = {{aHeader, sizeof(aHeader)}, {const_cast<char*>(strError.data()), strError.size()}};
+        Send(aIov, 2);
+    }
+
+private:
+    void Send(struct iovec *pIov, int nIov)
+    {
+        while (nIov)
+        {
+            struct msghdr msg = {};
+            msg.msg_iov = pIov;
+            msg.msg_iovlen = nIov;
+            // MSG_NOSIGNAL: a client that went away must not kill the daemon
+            ssize_t nSent = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+            if (nSent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::ostringstream err;
+                err << "Client connection lost: " << strerror(errno) << std::endl;
+                throw std::runtime_error(err.str());
+            }
+            while (nIov && (size_t)nSent >= pIov->iov_len)
+            {
+                nSent -= pIov->iov_len;
+                pIov++;
+                nIov--;
+            }
+            if (nIov)
+            {
+                pIov->iov_base = static_cast<uint8_t*>(pIov->iov_base) + nSent;
+                pIov->iov_len -= nSent;
+            }
+        }
+    }
+
+    int m_fd;
+    int m_nMaxLayer = -1;
+};
+
+/**
+*  @brief Frames handed over by the client in a POSIX shared memory object.
+*/
+class ShmFrameSource : public FrameSource
+{
+public:
+    ShmFrameSource(const std::string &strName, int nWidth, int nHeight, int nFrame)
+        : m_nWidth(nWidth), m_nHeight(nHeight), m_nFrame(nFrame)
+    {
+        m_nMapSize = (size_t)nWidth * nHeight * 4 * nFrame;
+        int fd = shm_open(strName.c_str(), O_RDONLY, 0);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) || (size_t)st.st_size < m_nMapSize)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            std::ostringstream err;
+            err << "Shared memory object " << strName << " is missing or smaller than " << nFrame << " frames of "
+                << nWidth << "x" << nHeight << " RGBA" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        void *pMap = mmap(NULL, m_nMapSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (pMap == MAP_FAILED)
+        {
+            throw std::runtime_error("Unable to map shared memory frames");
+        }
+        m_pFrames = static_cast<uint8_t*>(pMap);
+        // Frames are staged through pinned memory and uploaded ahead of the encoder
+        m_pUpload.reset(new PinnedUploadSource(nWidth, nHeight, [this](cv::Mat &host) { return ReadFrame(host); }));
+    }
+
+    ~ShmFrameSource()
+    {
+        // Stops the reader before the mapping goes away
+        m_pUpload.reset();
+        munmap(m_pFrames, m_nMapSize);
+    }
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override
+    {
+        return m_pUpload->GetNextFrame(frame);
+    }
+
+private:
+    bool ReadFrame(cv::Mat &host)
+    {
+        if (m_iFrame >= m_nFrame)
+        {
+            return false;
+        }
+        cv::Mat shared(m_nHeight, m_nWidth, CV_8UC4, m_pFrames + (size_t)m_iFrame++ * m_nWidth * m_nHeight * 4);
+        shared.copyTo(host);
+        return true;
+    }
+
+    uint8_t *m_pFrames = NULL;
+    size_t m_nMapSize = 0;
+    int m_nWidth, m_nHeight, m_nFrame, m_iFrame = 0;
+    std::unique_ptr<PinnedUploadSource> m_pUpload;
+};
+
+static DaemonJob ParseDaemonJob(const std::vector<std::string> &vArg)
+{
+    DaemonJob job;
+    std::ostringstream oss;
+    for (size_t i = 0; i < vArg.size(); i++)
+    {
+        bool bHasValue = i + 1 < vArg.size();
+        if (vArg[i] == "-i" && bHasValue)
+        {
+            job.strInput = vArg[++i];
+        }
+        else if (vArg[i] == "-shm" && bHasValue)
+        {
+            job.strShm = vArg[++i];
+        }
+        else if (vArg[i] == "-s" && bHasValue && 2 == sscanf(vArg[i + 1].c_str(), "%dx%d", &job.nWidth, &job.nHeight))
+        {
+            i++;
+        }
+        else if (vArg[i] == "-frames" && bHasValue)
+        {
+            job.nFrame = atoi(vArg[++i].c_str());
+        }
+        else if (vArg[i] == "-gpu" && bHasValue)
+        {
+            job.request.iGpu = atoi(vArg[++i].c_str());
+        }
+        else if (vArg[i] == "-class" && bHasValue)
+        {
+            job.request.eClass = ParseJobClass(vArg[++i]);
+        }
+        else if (vArg[i] == "-tenant" && bHasValue)
+        {
+            job.request.strTenant = vArg[++i];
+        }
+        else if (vArg[i] == "-deadline" && bHasValue)
+        {
+            job.request.nDeadlineMs = atoi(vArg[++i].c_str());
+        }
+        else if (vArg[i] == "-fit" && bHasValue)
+        {
+            job.eFit = ParseFitMode(vArg[++i]);
+        }
+        else if (vArg[i] == "-outSize" && bHasValue && 2 == sscanf(vArg[i + 1].c_str(), "%dx%d", &job.nOutWidth, &job.nOutHeight))
+        {
+            i++;
+        }
+        else if (vArg[i] == "-temporalLayers" && bHasValue)
+        {
+            job.nTemporalLayers = atoi(vArg[++i].c_str());
+        }
+        else if (vArg[i] == "-maxLayer" && bHasValue)
+        {
+            job.nMaxLayer = atoi(vArg[++i].c_str());
+        }
+        else if (vArg[i] == "-abr" && bHasValue)
+        {
+            job.strBitrateBounds = vArg[++i];
+        }
+        else if (vArg[i] == "-stats")
+        {
+            job.bStats = true;
+        }
+        else if (vArg[i][0] == '-')
+        {
+            // Regard as encoder parameter
+            oss << vArg[i] << " ";
+            while (i + 1 < vArg.size() && vArg[i + 1][0] != '-')
+            {
+                oss << vArg[++i] << " ";
+            }
+        }
+        else
+        {
+            std::ostringstream err;
+            err << "Error parsing \"" << vArg[i] << "\"" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+    }
+    if (job.bStats)
+    {
+        return job;
+    }
+    if (job.strInput.empty() == job.strShm.empty() || job.nFrame <= 0 || job.request.nDeadlineMs < 0)
+    {
+        throw std::invalid_argument("A job needs either -i or -shm, a positive -frames and no negative -deadline\n");
+    }
+    job.strParams = oss.str();
+    return job;
+}
+
+class EncodeDaemon
+{
+public:
+    EncodeDaemon(int nMaxSessionsPerGpu)
+    {
+        int nGpu = 0;
+        ck(cuInit(0));
+        ck(cuDeviceGetCount(&nGpu));
+        for (int iGpu = 0; iGpu < nGpu; iGpu++)
+        {
+            CUdevice cuDevice = 0;
+            ck(cuDeviceGet(&cuDevice, iGpu));
+            // The primary context is the one the OpenCV CUDA modules use, so
+            // GpuMats and encoder sessions of a GPU share one context
+            CUcontext cuContext = NULL;
+            ck(cuDevicePrimaryCtxRetain(&cuContext, cuDevice));
+            m_vpPool.emplace_back(new EncoderSessionPool(cuContext, nMaxSessionsPerGpu));
+            char szDeviceName[80];
+            ck(cuDeviceGetName(szDeviceName, sizeof(szDeviceName), cuDevice));
+            std::cout << "GPU " << iGpu << ": " << szDeviceName << std::endl;
+        }
+        // One slot per session, so that a granted job never waits in the pool
+        m_pScheduler.reset(new JobScheduler(nGpu, nMaxSessionsPerGpu));
+    }
+
+    void Warm(int nWidth, int nHeight, const std::string &strParams)
+    {
+        for (size_t iGpu = 0; iGpu < m_vpPool.size(); iGpu++)
+        {
+            cv::cuda::setDevice((int)iGpu);
+            cv::Size sessionSize = FrameNormalizer().GetSessionSize(cv::Size(nWidth, nHeight),
+                m_vpPool[iGpu]->GetMinSize(strParams));
+            EncoderSessionKey key = {sessionSize.width, sessionSize.height, NV_ENC_BUFFER_FORMAT_ABGR, strParams, 0};
+            m_vpPool[iGpu]->Warm(key);
+        }
+    }
+
+    void Serve(int fdListen)
+    {
+        for (;;)
+        {
+            int fd = accept(fdListen, NULL, NULL);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                std::ostringstream err;
+                err << "accept() failed: " << strerror(errno) << std::endl;
+                throw std::runtime_error(err.str());
+            }
+            std::thread(&EncodeDaemon::HandleConnection, this, fd).detach();
+        }
+    }
+
+private:
+    void HandleConnection(int fd)
+    {
+        int iJob = ++m_nJob;
+        SocketSink sink(fd);
+        try
+        {
+            auto tStart = std::chrono::steady_clock::now();
+            DaemonJob job = ParseDaemonJob(ReceiveArguments(fd));
+            if (job.bStats)
+            {
+                std::string strStats = m_pScheduler->GetStats();
+                sink.Write(reinterpret_cast<const uint8_t*>(strStats.data()), strStats.size());
+                sink.Close();
+                close(fd);
+                return;
+            }
+            sink.SetMaxLayer(job.nMaxLayer);
+
+            // Decoded before queueing, only the upload needs the GPU
+            cv::Mat srcImgHost;
+            int nWidth = job.nWidth, nHeight = job.nHeight;
+            if (!job.strInput.empty())
+            {
+                srcImgHost = ReadImagePinned(job.strInput);
+                if (srcImgHost.empty())
+                {
+                    throw std::invalid_argument("Unable to read image " + job.strInput + "\n");
+                }
+                nWidth = srcImgHost.cols;
+                nHeight = srcImgHost.rows;
+            }
+            ValidateResolution(nWidth, nHeight);
+
+            std::unique_ptr<JobTicket> pTicket = m_pScheduler->Submit(job.request);
+            cv::cuda::setDevice(pTicket->GetGpu());
+
+            std::unique_ptr<FrameSource> pSource;
+            if (!job.strInput.empty())
+            {
+                cv::cuda::GpuMat srcImgDevice;
+                srcImgDevice.upload(srcImgHost);
+                cv::cuda::cvtColor(srcImgDevice, srcImgDevice, cv::ColorConversionCodes::COLOR_BGR2RGBA);
+                pSource.reset(new StillFrameSource(srcImgDevice, job.nFrame));
+            }
+            else
+            {
+                pSource.reset(new ShmFrameSource(job.strShm, nWidth, nHeight, job.nFrame));
+            }
+
+            EncoderSessionPool &pool = *m_vpPool[pTicket->GetGpu()];
+            // Frames of any size are padded or scaled on the GPU, and jobs with
+            // the same output size share sessions whatever their input size
+            FrameNormalizer normalizer(job.eFit, job.nOutWidth, job.nOutHeight);
+            cv::Size sessionSize = normalizer.GetSessionSize(cv::Size(nWidth, nHeight), pool.GetMinSize(job.strParams));
+            EncoderSessionKey key = {sessionSize.width, sessionSize.height, NV_ENC_BUFFER_FORMAT_ABGR, job.strParams,
+                job.nTemporalLayers};
+            std::unique_ptr<EncoderSession> pSession = pool.Acquire(key);
+            auto tReady = std::chrono::steady_clock::now();
+            JobTicket &ticket = *pTicket;
+            EncodeControl control;
+            control.pNormalizer = &normalizer;
+            control.minSize = pool.GetMinSize(job.strParams);
+            control.fnYield = [this, &ticket]() { return m_pScheduler->ShouldYield(ticket); };
+            // Across preemptions, a resumed stream goes on at the adapted bitrate
+            std::unique_ptr<BitrateController> pBitrate;
+            if (!job.strBitrateBounds.empty())
+            {
+                pBitrate.reset(new BitrateController(BitrateController::Parse(job.strBitrateBounds)));
+                control.pBitrate = pBitrate.get();
+            }
+            int nPacket = 0, nPreempted = 0;
+            for (;;)
+            {
+                bool bYielded = false;
+                nPacket += EncodeFrames(pSession->Get(), pool.GetContext(), *pSource, sink, control, &bYielded);
+                pSession->MarkReusable();
+                pSession.reset();
+                if (!bYielded)
+                {
+                    break;
+                }
+                // The stream is continued with an IDR once a slot is free again
+                nPreempted++;
+                m_pScheduler->Yield(ticket);
+                pSession = pool.Acquire(key);
+            }
+            int iGpu = pTicket->GetGpu();
+            double dWaitMs = pTicket->GetWaitMs();
+            pTicket.reset();
+            sink.Close();
+
+            std::cout << "Job " << iJob << " (" << GetJobClassName(job.request.eClass) << "): " << nPacket << " frames, "
+                << sink.GetBytesWritten() << " bytes, GPU " << iGpu << ", queued " << dWaitMs
+                << " ms, setup " << std::chrono::duration<double, std::milli>(tReady - tStart).count()
+                << " ms, total " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count()
+                << " ms, preempted " << nPreempted << " times" << std::endl;
+            if (pBitrate)
+            {
+                std::cout << "Job " << iJob << " bitrate: " << pBitrate->GetDecreaseCount() << " decreases, "
+                    << pBitrate->GetIncreaseCount() << " increases, lowest " << pBitrate->GetLowestBitrate()
+                    << ", final " << pBitrate->GetBitrate() << " bit/s" << std::endl;
+            }
+        }
+        catch (const std::exception &ex)
+        {
+            std::cout << "Job " << iJob << " failed: " << ex.what();
+            try
+            {
+                sink.SendError(ex.what());
+            }
+            catch (const std::exception &)
+            {
+            }
+        }
+        close(fd);
+    }
+
+    static std::vector<std::string> ReceiveArguments(int fd)
+    {
+        std::vector<std::string> vArg;
+        std::string strArg;
+        char aBuf[4096];
+        size_t nTotal = 0;
+        for (;;)
+        {
+            ssize_t nRead = recv(fd, aBuf, sizeof(aBuf), 0);
+            if (nRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (nRead <= 0)
+            {
+                throw std::runtime_error("Connection closed before the job was complete\n");
+            }
+            nTotal += nRead;
+            if (nTotal > (1 << 20))
+            {
+                throw std::invalid_argument("Job request too large\n");
+            }
+            for (ssize_t i = 0; i < nRead; i++)
+            {
+                if (aBuf[i])
+                {
+                    strArg += aBuf[i];
+                    continue;
+                }
+                if (strArg.empty())
+                {
+                    // The client sends nothing after the terminating empty argument
+                    return vArg;
+                }
+                vArg.push_back(strArg);
+                strArg.clear();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<EncoderSessionPool>> m_vpPool;
+    std::unique_ptr<JobScheduler> m_pScheduler;
+    std::atomic<int> m_nJob{0};
+};
+
+int RunEncodeDaemon(const char *szSocketPath, int nMaxSessionsPerGpu, int nWarmWidth, int nWarmHeight,
+    const std::string &strWarmParams)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(szSocketPath) >= sizeof(addr.sun_path))
+    {
+        throw std::invalid_argument("Socket path too long\n");
+    }
+    strcpy(addr.sun_path, szSocketPath);
+    // Only the socket of an earlier daemon is replaced, never a file given by mistake
+    struct stat st;
+    if (!lstat(szSocketPath, &st) && !S_ISSOCK(st.st_mode))
+    {
+        std::ostringstream err;
+        err << szSocketPath << " exists and is not a socket" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+
+    EncodeDaemon daemon(nMaxSessionsPerGpu);
+    if (nWarmWidth > 0 && nWarmHeight > 0)
+    {
+        daemon.Warm(nWarmWidth, nWarmHeight, strWarmParams);
+    }
+
+    int fdListen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!lstat(szSocketPath, &st) && S_ISSOCK(st.st_mode))
+    {
+        unlink(szSocketPath);
+    }
+    if (fdListen < 0 || bind(fdListen, (struct sockaddr*)&addr, sizeof(addr)) || listen(fdListen, SOMAXCONN))
+    {
+        std::ostringstream err;
+        err << "Unable to listen on " << szSocketPath << ": " << strerror(errno) << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    std::cout << "Listening on " << szSocketPath << std::endl;
+    daemon.Serve(fdListen);
+    return 0;
+}
+
+static void ReceiveAll(int fd, void *pData, size_t nSize)
+{
+    uint8_t *p = static_cast<uint8_t*>(pData);
+    while (nSize)
+    {
+        ssize_t nRead = recv(fd, p, nSize, 0);
+        if (nRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (nRead <= 0)
+        {
+            throw std::runtime_error("Connection to the encode daemon lost\n");
+        }
+        p += nRead;
+        nSize -= nRead;
+    }
+}
+
+void RunEncodeClient(const char *szSocketPath, const std::vector<std::string> &vArg, OutputSink &sink, double fMaxReadBitrate)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, szSocketPath, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        std::ostringstream err;
+        err << "Unable to connect to the encode daemon at " << szSocketPath << ": " << strerror(errno) << std::endl;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error(err.str());
+    }
+    try
+    {
+        std::string strRequest;
+        for (const std::string &strArg : vArg)
+        {
+            strRequest.append(strArg.c_str(), strArg.size() + 1);
+        }
+        strRequest.push_back('\0');
+        WriteAll(fd, reinterpret_cast<const uint8_t*>(strRequest.data()), strRequest.size());
+
+        std::vector<uint8_t> vPacket;
+        auto tStart = std::chrono::steady_clock::now();
+        uint64_t nRead = 0;
+        for (;;)
+        {
+            uint32_t nSize = 0;
+            ReceiveAll(fd, &nSize, sizeof(nSize));
+            if (nSize == 0)
+            {
+                break;
+            }
+            if (nSize == nDaemonError)
+            {
+                ReceiveAll(fd, &nSize, sizeof(nSize));
+                std::string strError(nSize, '\0');
+                ReceiveAll(fd, &strError[0], nSize);
+                throw std::runtime_error("Encode daemon: " + strError);
+            }
+            vPacket.resize(nSize);
+            ReceiveAll(fd, vPacket.data(), nSize);
+            sink.Write(vPacket.data(), nSize);
+            nRead += nSize;
+            if (fMaxReadBitrate > 0)
+            {
+                // The unread rest backs up in the socket, as behind a slow link
+                std::this_thread::sleep_until(tStart + std::chrono::duration<double>(nRead * 8.0 / fMaxReadBitrate));
+            }
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+#endif
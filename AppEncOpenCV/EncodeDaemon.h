@@ -0,0 +1,64 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Resident encoder process. cuInit(), context creation and encoder creation
+*  are paid once by the daemon instead of once per clip: CUDA primary contexts
+*  of all GPUs are retained at startup and finished encoder sessions are kept
+*  warm in an EncoderSessionPool per GPU.
+*
+*  Protocol on the Unix domain socket: the client sends a job as a list of
+*  NUL terminated arguments followed by an empty argument, using the options of
+*  the command line tool:
+*      -i <image path> | -shm <name> -s <W>x<H>     input
+*      -frames <n>                                  number of frames
+*      -gpu <n>                                     GPU ordinal (default: any)
+*      -class interactive|normal|batch              scheduling, see JobScheduler.h
+*      -tenant <name> -deadline <ms>
+*      -temporalLayers <n> -maxLayer <n>            hierarchical P, only layers up to maxLayer sent
+*      -abr <min>:<max>                             adapt the bitrate to how fast the client reads
+*      -stats                                       queue statistics instead of a job
+*      any other option                             encoder parameter
+*  -shm names a POSIX shared memory object holding n frames of W x H RGBA
+*  pixels back to back. The daemon answers with the bitstream as a sequence of
+*  packets, each a 32 bit length (host byte order) followed by the data. A
+*  length of 0 ends a successful job; nDaemonError is followed by a 32 bit
+*  length and an error message.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "OutputSink.h"
+
+static const uint32_t nDaemonError = 0xFFFFFFFF;
+
+#ifndef _WIN32
+
+/**
+*  @brief Serves encode jobs on szSocketPath until the process is terminated.
+*  If nWarmWidth x nWarmHeight is set, one session with the encoder parameters
+*  strWarmParams is created on every GPU before the first job is accepted.
+*/
+int RunEncodeDaemon(const char *szSocketPath, int nMaxSessionsPerGpu, int nWarmWidth, int nWarmHeight,
+    const std::string &strWarmParams);
+
+/**
+*  @brief Sends the job described by vArg to the daemon at szSocketPath and
+*  writes the returned bitstream to sink. With fMaxReadBitrate, the bitstream
+*  is read no faster than that many bits per second, to simulate a slow link.
+*/
+void RunEncodeClient(const char *szSocketPath, const std::vector<std::string> &vArg, OutputSink &sink,
+    double fMaxReadBitrate = 0);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <iostream>
+#include "EncoderSessionPool.h"
+
+EncoderSession::~EncoderSession()
+{
+    m_pPool->Release(m_key, std::move(m_pEnc), m_bReusable);
+}
+
+EncoderSessionPool::EncoderSessionPool(CUcontext cuContext, int nMaxSessions) : m_cuContext(cuContext), m_nMaxSessions(nMaxSessions)
+{
+    if (nMaxSessions < 1)
+    {
+        throw std::invalid_argument("EncoderSessionPool needs room for at least one session");
+    }
+    m_h264MinSize = GetEncoderMinSize(cuContext, NV_ENC_CODEC_H264_GUID);
+    m_hevcMinSize = GetEncoderMinSize(cuContext, NV_ENC_CODEC_HEVC_GUID);
+}
+
+EncoderSessionPool::~EncoderSessionPool()
+{
+    for (IdleSession &session : m_lIdle)
+    {
+        session.pEnc->DestroyEncoder();
+    }
+}
+
+std::unique_ptr<NvEncoderGpuMat> EncoderSessionPool::Create(const EncoderSessionKey &key)
+{
+    std::unique_ptr<NvEncoderGpuMat> pEnc(new NvEncoderGpuMat(m_cuContext, key.nWidth, key.nHeight, key.eFormat));
+    InitializeEncoder(pEnc, NvEncoderInitParam(key.strParams.c_str()), key.eFormat, false, 0, key.nTemporalLayers);
+    return pEnc;
+}
+
+std::unique_ptr<EncoderSession> EncoderSessionPool::Acquire(const EncoderSessionKey &key)
+{
+    std::unique_ptr<NvEncoderGpuMat> pEvicted;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            for (auto it = m_lIdle.begin(); it != m_lIdle.end(); ++it)
+            {
+                if (it->key == key)
+                {
+                    std::unique_ptr<NvEncoderGpuMat> pEnc = std::move(it->pEnc);
+                    m_lIdle.erase(it);
+                    m_nReused++;
+                    return std::unique_ptr<EncoderSession>(new EncoderSession(this, key, std::move(pEnc), true));
+                }
+            }
+            if (m_nSessions < m_nMaxSessions)
+            {
+                break;
+            }
+            if (!m_lIdle.empty())
+            {
+                // Destroyed outside of the lock below; the slot is taken over
+                pEvicted = std::move(m_lIdle.back().pEnc);
+                m_lIdle.pop_back();
+                m_nSessions--;
+                break;
+            }
+            m_cvReleased.wait(lock);
+        }
+        m_nSessions++;
+        m_nCreated++;
+    }
+    if (pEvicted)
+    {
+        pEvicted->DestroyEncoder();
+        pEvicted.reset();
+    }
+    try
+    {
+        return std::unique_ptr<EncoderSession>(new EncoderSession(this, key, Create(key), false));
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_nSessions--;
+        m_cvReleased.notify_one();
+        throw;
+    }
+}
+
+void EncoderSessionPool::Warm(const EncoderSessionKey &key)
+{
+    Acquire(key)->MarkReusable();
+}
+
+void EncoderSessionPool::Release(const EncoderSessionKey &key, std::unique_ptr<NvEncoderGpuMat> pEnc, bool bReusable)
+{
+    if (bReusable)
+    {
+        try
+        {
+            ResetEncoder(pEnc.get());
+        }
+        catch (const std::exception &ex)
+        {
+            std::cout << "Encoder reset failed, dropping session: " << ex.what() << std::endl;
+            bReusable = false;
+        }
+    }
+    if (!bReusable)
+    {
+        try
+        {
+            pEnc->DestroyEncoder();
+        }
+        catch (const std::exception &ex)
+        {
+            std::cout << ex.what() << std::endl;
+        }
+        pEnc.reset();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (pEnc)
+    {
+        m_lIdle.push_front(IdleSession{key, std::move(pEnc)});
+    }
+    else
+    {
+        m_nSessions--;
+    }
+    m_cvReleased.notify_one();
+}
+
+cv::Size EncoderSessionPool::GetMinSize(const std::string &strParams) const
+{
+    return NvEncoderInitParam(strParams.c_str()).IsCodecHEVC() ? m_hevcMinSize : m_h264MinSize;
+}
+
+int EncoderSessionPool::GetCreatedCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nCreated;
+}
+
+int EncoderSessionPool::GetReusedCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nReused;
+}
@@ -0,0 +1,120 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "GpuMatEncoder.h"
+
+/**
+*  @brief Everything that has to match for an encoder session to be reused.
+*  strParams is the encoder parameter string as accepted by NvEncoderInitParam;
+*  nTemporalLayers those of InitializeEncoder().
+*/
+struct EncoderSessionKey
+{
+    int nWidth;
+    int nHeight;
+    NV_ENC_BUFFER_FORMAT eFormat;
+    std::string strParams;
+    int nTemporalLayers;
+
+    bool operator==(const EncoderSessionKey &other) const
+    {
+        return nWidth == other.nWidth && nHeight == other.nHeight && eFormat == other.eFormat && strParams == other.strParams
+            && nTemporalLayers == other.nTemporalLayers;
+    }
+};
+
+class EncoderSessionPool;
+
+/**
+*  @brief An encoder session borrowed from an EncoderSessionPool. The session
+*  goes back to the pool when the lease is destroyed; it is kept warm only if
+*  MarkReusable() was called after the stream was finished with EndEncode(),
+*  otherwise (e.g. after an exception) it is destroyed.
+*/
+class EncoderSession
+{
+public:
+    EncoderSession(EncoderSessionPool *pPool, const EncoderSessionKey &key, std::unique_ptr<NvEncoderGpuMat> pEnc, bool bReused)
+        : m_pPool(pPool), m_key(key), m_pEnc(std::move(pEnc)), m_bReused(bReused) {}
+    ~EncoderSession();
+
+    NvEncoderGpuMat *Get() const { return m_pEnc.get(); }
+    const EncoderSessionKey &GetKey() const { return m_key; }
+    bool IsReused() const { return m_bReused; }
+    void MarkReusable() { m_bReusable = true; }
+
+private:
+    EncoderSessionPool *m_pPool;
+    EncoderSessionKey m_key;
+    std::unique_ptr<NvEncoderGpuMat> m_pEnc;
+    bool m_bReused = false, m_bReusable = false;
+};
+
+/**
+*  @brief Keeps finished encoder sessions of one CUDA context warm so that jobs
+*  with the same geometry and parameters skip encoder creation. At most
+*  nMaxSessions sessions exist at a time (NVENC limits concurrent sessions per
+*  GPU on many boards); Acquire() first reuses an idle session with the same
+*  key, then creates a new one, then evicts the least recently used idle
+*  session of another key and finally waits for a session to be released.
+*  The smallest encode sizes are queried on a session of their own when the
+*  pool is created, while it has none, so the query never exceeds the limit.
+*/
+class EncoderSessionPool
+{
+public:
+    EncoderSessionPool(CUcontext cuContext, int nMaxSessions);
+    ~EncoderSessionPool();
+
+    std::unique_ptr<EncoderSession> Acquire(const EncoderSessionKey &key);
+    /**
+    *  @brief Creates an idle session for key ahead of the first job.
+    */
+    void Warm(const EncoderSessionKey &key);
+
+    CUcontext GetContext() const { return m_cuContext; }
+    /**
+    *  @brief Smallest encode size of the codec of strParams on the GPU of
+    *  the pool, queried when the pool was created.
+    */
+    cv::Size GetMinSize(const std::string &strParams) const;
+    int GetCreatedCount();
+    int GetReusedCount();
+
+private:
+    friend class EncoderSession;
+    struct IdleSession
+    {
+        EncoderSessionKey key;
+        std::unique_ptr<NvEncoderGpuMat> pEnc;
+    };
+
+    std::unique_ptr<NvEncoderGpuMat> Create(const EncoderSessionKey &key);
+    void Release(const EncoderSessionKey &key, std::unique_ptr<NvEncoderGpuMat> pEnc, bool bReusable);
+
+    CUcontext m_cuContext;
+    int m_nMaxSessions;
+    cv::Size m_h264MinSize, m_hevcMinSize;
+    // Sessions that exist, idle or leased
+    int m_nSessions = 0;
+    int m_nCreated = 0, m_nReused = 0;
+    // Most recently released first
+    std::list<IdleSession> m_lIdle;
+    std::mutex m_mutex;
+    std::condition_variable m_cvReleased;
+};
@@ -0,0 +1,123 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "FrameNormalizer.h"
+
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudawarping.hpp>
+
+FitMode ParseFitMode(const std::string &strFit)
+{
+    if (strFit == "pad")
+    {
+        return FIT_PAD;
+    }
+    if (strFit == "letterbox")
+    {
+        return FIT_LETTERBOX;
+    }
+    if (strFit == "scale")
+    {
+        return FIT_SCALE;
+    }
+    std::ostringstream err;
+    err << "Unknown fit mode " << strFit << ", expected pad, letterbox or scale" << std::endl;
+    throw std::invalid_argument(err.str());
+}
+
+// 4:2:0 chroma subsampling needs even dimensions
+static int RoundUpToEven(int n)
+{
+    return (n + 1) & ~1;
+}
+
+FrameNormalizer::FrameNormalizer(FitMode eFit, int nOutWidth, int nOutHeight) : m_eFit(eFit)
+{
+    if (nOutWidth < 0 || nOutHeight < 0 || (nOutWidth == 0) != (nOutHeight == 0))
+    {
+        throw std::invalid_argument("Output size must be given as positive WxH\n");
+    }
+    m_outSize = cv::Size(RoundUpToEven(nOutWidth), RoundUpToEven(nOutHeight));
+}
+
+cv::Size FrameNormalizer::GetSessionSize(cv::Size frameSize, cv::Size minSize) const
+{
+    cv::Size sessionSize = m_outSize.width ? m_outSize : cv::Size(RoundUpToEven(frameSize.width), RoundUpToEven(frameSize.height));
+    return cv::Size(std::max(sessionSize.width, RoundUpToEven(minSize.width)),
+        std::max(sessionSize.height, RoundUpToEven(minSize.height)));
+}
+
+cv::Size FrameNormalizer::GetEncodeSize(cv::Size frameSize, cv::Size minSize, cv::Size sessionSize) const
+{
+    if (m_eFit != FIT_PAD && m_outSize.width)
+    {
+        return sessionSize;
+    }
+    cv::Size encodeSize(std::max(RoundUpToEven(frameSize.width), minSize.width),
+        std::max(RoundUpToEven(frameSize.height), minSize.height));
+    if (encodeSize.width > sessionSize.width || encodeSize.height > sessionSize.height)
+    {
+        return sessionSize;
+    }
+    return encodeSize;
+}
+
+void FrameNormalizer::Write(const cv::cuda::GpuMat &src, cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) const
+{
+    // dst wraps the encoder input buffer, so every operation below has a
+    // destination of exactly the right size and writes in place
+    cv::Size srcSize = src.size(), dstSize = dst.size();
+    if (srcSize == dstSize)
+    {
+        src.copyTo(dst, stream);
+        return;
+    }
+    bool bFits = srcSize.width <= dstSize.width && srcSize.height <= dstSize.height;
+    if (m_eFit == FIT_PAD && bFits)
+    {
+        cv::cuda::copyMakeBorder(src, dst, 0, dstSize.height - srcSize.height, 0, dstSize.width - srcSize.width,
+            cv::BORDER_REPLICATE, cv::Scalar(), stream);
+        return;
+    }
+    if (m_eFit == FIT_SCALE)
+    {
+        cv::cuda::resize(src, dst, dstSize, 0, 0, cv::INTER_LINEAR, stream);
+        return;
+    }
+
+    // Letterbox
+    double dScale = std::min((double)dstSize.width / srcSize.width, (double)dstSize.height / srcSize.height);
+    cv::Size fitSize(std::max(1, std::min(dstSize.width, (int)(srcSize.width * dScale + 0.5))),
+        std::max(1, std::min(dstSize.height, (int)(srcSize.height * dScale + 0.5))));
+    cv::Rect roi((dstSize.width - fitSize.width) / 2, (dstSize.height - fitSize.height) / 2, fitSize.width, fitSize.height);
+    const cv::Scalar black(0, 0, 0, 255);
+    if (roi.y > 0)
+    {
+        dst(cv::Rect(0, 0, dstSize.width, roi.y)).setTo(black, stream);
+    }
+    if (roi.y + roi.height < dstSize.height)
+    {
+        dst(cv::Rect(0, roi.y + roi.height, dstSize.width, dstSize.height - roi.y - roi.height)).setTo(black, stream);
+    }
+    if (roi.x > 0)
+    {
+        dst(cv::Rect(0, roi.y, roi.x, roi.height)).setTo(black, stream);
+    }
+    if (roi.x + roi.width < dstSize.width)
+    {
+        dst(cv::Rect(roi.x + roi.width, roi.y, dstSize.width - roi.x - roi.width, roi.height)).setTo(black, stream);
+    }
+    cv::cuda::GpuMat dstRoi = dst(roi);
+    cv::cuda::resize(src, dstRoi, fitSize, 0, 0, srcSize.width > fitSize.width ? cv::INTER_AREA : cv::INTER_LINEAR, stream);
+}
@@ -0,0 +1,70 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+enum FitMode
+{
+    // Frame at the top left, edges replicated into the padding
+    FIT_PAD,
+    // Scaled to fit, aspect ratio kept, centered between black bars
+    FIT_LETTERBOX,
+    // Stretched to the output size
+    FIT_SCALE
+};
+
+/**
+*  @brief Parses "pad", "letterbox" or "scale"; throws std::invalid_argument otherwise.
+*/
+FitMode ParseFitMode(const std::string &strFit);
+
+/**
+*  @brief Brings frames of any size into the geometry of an encoder session,
+*  on the GPU and directly in the encoder input buffer.
+*
+*  Without an output size, every frame is encoded at its own size, padded to
+*  even dimensions and to the encoder minimum; the stream headers carry that
+*  size and the decoder shows the frame, not the NVENC alignment padding.
+*  With an output size, the session is created once for that size: pad mode
+*  still encodes each frame at its own size (within the session maximum, by
+*  reconfiguring the session), letterbox and scale always encode the output
+*  size. In both cases frames of different sizes share one session.
+*/
+class FrameNormalizer
+{
+public:
+    FrameNormalizer(FitMode eFit = FIT_PAD, int nOutWidth = 0, int nOutHeight = 0);
+
+    /**
+    *  @brief Size to create the encoder session with for frames of frameSize;
+    *  at least minSize, the smallest size the encoder accepts (see
+    *  GetEncoderMinSize()). Smaller frames are padded into it.
+    */
+    cv::Size GetSessionSize(cv::Size frameSize, cv::Size minSize) const;
+    /**
+    *  @brief Encode size for a frame of frameSize on a session of sessionSize.
+    *  minSize is the smallest size the encoder accepts.
+    */
+    cv::Size GetEncodeSize(cv::Size frameSize, cv::Size minSize, cv::Size sessionSize) const;
+    /**
+    *  @brief Writes src into dst, the encoder input buffer at the encode size.
+    *  A frame larger than dst is letterboxed in pad mode.
+    */
+    void Write(const cv::cuda::GpuMat &src, cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) const;
+
+private:
+    FitMode m_eFit;
+    cv::Size m_outSize;
+};
@@ -0,0 +1,223 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include "FrameOverlay.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cudaimgproc.hpp>
+
+static const char cFirstGlyph = ' ', cLastGlyph = '~';
+// Opacity of the box behind the glyphs, which keeps text readable on any frame
+static const double fBoxAlpha = 0.4;
+
+FrameOverlay::FrameOverlay(int nGlyphHeight, cv::Scalar color) : m_nGlyphHeight(nGlyphHeight), m_color(color)
+{
+}
+
+int FrameOverlay::AddText(cv::Point pos, const std::string &strText)
+{
+    TextItem item;
+    item.pos = pos;
+    item.strText = strText;
+    m_vText.push_back(item);
+    return (int)m_vText.size() - 1;
+}
+
+void FrameOverlay::SetText(int iItem, const std::string &strText)
+{
+    m_vText.at(iItem).strText = strText;
+}
+
+int FrameOverlay::AddTimecode(cv::Point pos, double fFps)
+{
+    if (!(fFps > 0))
+    {
+        throw std::invalid_argument("Timecode frame rate must be positive\n");
+    }
+    int iItem = AddText(pos, "");
+    m_vText[iItem].fFps = fFps;
+    return iItem;
+}
+
+void FrameOverlay::SetLogo(const cv::Mat &logo, cv::Point pos)
+{
+    if (logo.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Logo must be RGBA\n");
+    }
+    m_logo.upload(logo);
+    m_logoPos = pos;
+}
+
+cv::Mat FrameOverlay::ReadLogo(const std::string &strPath)
+{
+    cv::Mat image = cv::imread(strPath, cv::IMREAD_UNCHANGED), logo;
+    if (image.empty() || image.depth() != CV_8U)
+    {
+        std::ostringstream err;
+        err << "Unable to read logo " << strPath << " as an 8 bit image" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    int nCode = image.channels() == 4 ? cv::COLOR_BGRA2RGBA : image.channels() == 3 ? cv::COLOR_BGR2RGBA : cv::COLOR_GRAY2RGBA;
+    cv::cvtColor(image, logo, nCode);
+    return logo;
+}
+
+void FrameOverlay::BuildAtlas(int nGlyphHeight)
+{
+    int nFont = cv::FONT_HERSHEY_DUPLEX;
+    int nThickness = std::max(1, nGlyphHeight / 16);
+    double fScale = cv::getFontScaleFromHeight(nFont, nGlyphHeight * 2 / 3, nThickness);
+    int nGlyph = cLastGlyph - cFirstGlyph + 1;
+    int nWidth = 0;
+    for (char c = cFirstGlyph; c <= cLastGlyph; c++)
+    {
+        int nBaseline = 0;
+        nWidth = std::max(nWidth, cv::getTextSize(std::string(1, c), nFont, fScale, nThickness, &nBaseline).width);
+    }
+    // Monospaced, so a changed character never moves the others
+    m_cellSize = cv::Size(nWidth + 2 * nThickness, nGlyphHeight);
+    cv::Mat mask(m_cellSize.height, m_cellSize.width * nGlyph, CV_8UC1, cv::Scalar::all(0));
+    for (char c = cFirstGlyph; c <= cLastGlyph; c++)
+    {
+        cv::putText(mask, std::string(1, c), cv::Point((c - cFirstGlyph) * m_cellSize.width + nThickness, nGlyphHeight * 5 / 6),
+            nFont, fScale, cv::Scalar::all(255), nThickness, cv::LINE_AA);
+    }
+
+    // The glyph over a translucent black box, straight alpha
+    cv::Mat atlas(mask.rows, mask.cols, CV_8UC4);
+    for (int y = 0; y < mask.rows; y++)
+    {
+        const uchar *pMask = mask.ptr<uchar>(y);
+        uchar *pAtlas = atlas.ptr<uchar>(y);
+        for (int x = 0; x < mask.cols; x++)
+        {
+            double fGlyph = pMask[x] / 255.0;
+            double fAlpha = fGlyph + fBoxAlpha * (1 - fGlyph);
+            for (int i = 0; i < 3; i++)
+            {
+                pAtlas[4 * x + i] = cv::saturate_cast<uchar>(m_color[i] * fGlyph / fAlpha);
+            }
+            pAtlas[4 * x + 3] = cv::saturate_cast<uchar>(255 * fAlpha);
+        }
+    }
+    m_atlas.upload(atlas);
+}
+
+void FrameOverlay::UpdateLayer(TextItem &item, cv::cuda::Stream &stream)
+{
+    cv::Size layerSize(m_cellSize.width * (int)item.strText.size(), m_cellSize.height);
+    if (item.layer.size() != layerSize)
+    {
+        item.layer.create(layerSize, CV_8UC4);
+        // No character matches, every cell is copied
+        item.strDrawn.assign(item.strText.size(), '\0');
+    }
+    for (size_t i = 0; i < item.strText.size(); i++)
+    {
+        char c = item.strText[i];
+        if (c == item.strDrawn[i])
+        {
+            continue;
+        }
+        int iGlyph = (c < cFirstGlyph || c > cLastGlyph ? '?' : c) - cFirstGlyph;
+        cv::cuda::GpuMat cell = item.layer(cv::Rect((int)i * m_cellSize.width, 0, m_cellSize.width, m_cellSize.height));
+        m_atlas(cv::Rect(iGlyph * m_cellSize.width, 0, m_cellSize.width, m_cellSize.height)).copyTo(cell, stream);
+        m_nGlyphCopy++;
+    }
+    item.strDrawn = item.strText;
+}
+
+void FrameOverlay::Blend(const cv::cuda::GpuMat &layer, cv::Point pos, cv::cuda::GpuMat &frame, cv::cuda::Stream &stream,
+    CoveredSet *pCovered)
+{
+    cv::Point tl(pos.x >= 0 ? pos.x : frame.cols + pos.x - layer.cols, pos.y >= 0 ? pos.y : frame.rows + pos.y - layer.rows);
+    cv::Rect rect = cv::Rect(tl, layer.size()) & cv::Rect(cv::Point(0, 0), frame.size());
+    if (rect.area() <= 0)
+    {
+        return;
+    }
+    cv::cuda::GpuMat frameRoi = frame(rect);
+    if (pCovered)
+    {
+        if (pCovered->nCovered == pCovered->vCovered.size())
+        {
+            pCovered->vCovered.push_back(Covered());
+        }
+        Covered &covered = pCovered->vCovered[pCovered->nCovered++];
+        covered.rect = rect;
+        frameRoi.copyTo(covered.pixels, stream);
+    }
+    cv::cuda::alphaComp(layer(rect - tl), frameRoi, m_blend, cv::cuda::ALPHA_OVER, stream);
+    m_blend.copyTo(frameRoi, stream);
+}
+
+void FrameOverlay::Restore(cv::cuda::GpuMat &frame, cv::cuda::Stream &stream)
+{
+    auto it = m_mCovered.find(frame.data);
+    if (it == m_mCovered.end())
+    {
+        return;
+    }
+    CoveredSet &set = it->second;
+    // Last covered first, where overlays overlap
+    while (set.nCovered)
+    {
+        Covered &covered = set.vCovered[--set.nCovered];
+        cv::cuda::GpuMat frameRoi = frame(covered.rect);
+        covered.pixels.copyTo(frameRoi, stream);
+    }
+}
+
+void FrameOverlay::Apply(cv::cuda::GpuMat &frame, int iFrame, cv::cuda::Stream &stream, bool bRestorable)
+{
+    if (frame.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Overlays need RGBA frames\n");
+    }
+    if (m_atlas.empty() && !m_vText.empty())
+    {
+        BuildAtlas(m_nGlyphHeight > 0 ? m_nGlyphHeight : std::max(frame.rows / 24, 12));
+    }
+    CoveredSet *pCovered = NULL;
+    if (bRestorable)
+    {
+        pCovered = &m_mCovered[frame.data];
+        pCovered->nCovered = 0;
+    }
+    for (TextItem &item : m_vText)
+    {
+        if (item.fFps > 0)
+        {
+            int nFps = std::max((int)std::lround(item.fFps), 1);
+            int nSecond = iFrame / nFps;
+            char szTimecode[32];
+            snprintf(szTimecode, sizeof(szTimecode), "%02d:%02d:%02d:%02d", nSecond / 3600, nSecond / 60 % 60, nSecond % 60, iFrame % nFps);
+            item.strText = szTimecode;
+        }
+        if (item.strText.empty())
+        {
+            continue;
+        }
+        UpdateLayer(item, stream);
+        Blend(item.layer, item.pos, frame, stream, pCovered);
+    }
+    if (!m_logo.empty())
+    {
+        Blend(m_logo, m_logoPos, frame, stream, pCovered);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief Burns text, timecodes and a logo into frames on the GPU, in the
+*  encoder input buffer after the frame has been written into it, so frames
+*  never go to the host to be stamped.
+*
+*  The printable ASCII characters are rendered once with cv::putText() into a
+*  glyph atlas that stays on the device. Every text item has a layer of its
+*  own, built from atlas cells; per frame only the cells of characters that
+*  changed are copied (the last digit of a timecode, mostly), then the layer
+*  and the logo are alpha blended onto the frame with cv::cuda::alphaComp().
+*
+*  Positions are the top left corner in frame pixels; negative coordinates
+*  count from the right or bottom edge to the right or bottom of the item.
+*/
+class FrameOverlay
+{
+public:
+    /**
+    *  @brief nGlyphHeight 0 scales the text to the height of the first frame.
+    */
+    FrameOverlay(int nGlyphHeight = 0, cv::Scalar color = cv::Scalar(255, 255, 255, 255));
+
+    /**
+    *  @brief Adds a text item and returns its index for SetText().
+    */
+    int AddText(cv::Point pos, const std::string &strText);
+    void SetText(int iItem, const std::string &strText);
+    /**
+    *  @brief Adds an HH:MM:SS:FF timecode of the frame index at fFps.
+    */
+    int AddTimecode(cv::Point pos, double fFps);
+    /**
+    *  @brief Sets the logo, an RGBA image uploaded once.
+    */
+    void SetLogo(const cv::Mat &logo, cv::Point pos);
+    /**
+    *  @brief Reads an image file with its alpha channel, if any, as RGBA.
+    */
+    static cv::Mat ReadLogo(const std::string &strPath);
+
+    /**
+    *  @brief Draws the overlay onto frame (RGBA), the iFrame-th of the
+    *  stream, on stream. With bRestorable, the pixels it covers are kept for
+    *  Restore().
+    */
+    void Apply(cv::cuda::GpuMat &frame, int iFrame, cv::cuda::Stream &stream, bool bRestorable = false);
+    /**
+    *  @brief Puts back the pixels the last restorable Apply() to the buffer
+    *  of frame covered. Renderers that only redraw what changed since they
+    *  last drew into a buffer need it before drawing, or overlays would pile
+    *  up in the parts they skip.
+    */
+    void Restore(cv::cuda::GpuMat &frame, cv::cuda::Stream &stream);
+
+    /**
+    *  @brief Atlas cells copied into text layers so far.
+    */
+    long long GetGlyphCopyCount() const { return m_nGlyphCopy; }
+
+private:
+    struct TextItem
+    {
+        cv::Point pos;
+        std::string strText;
+        // A timecode if not 0
+        double fFps = 0;
+        // The text the layer holds
+        std::string strDrawn;
+        cv::cuda::GpuMat layer;
+    };
+    struct Covered
+    {
+        cv::Rect rect;
+        cv::cuda::GpuMat pixels;
+    };
+    // Kept allocated from frame to frame, nCovered are in use
+    struct CoveredSet
+    {
+        std::vector<Covered> vCovered;
+        size_t nCovered = 0;
+    };
+
+    void BuildAtlas(int nGlyphHeight);
+    void UpdateLayer(TextItem &item, cv::cuda::Stream &stream);
+    void Blend(const cv::cuda::GpuMat &layer, cv::Point pos, cv::cuda::GpuMat &frame, cv::cuda::Stream &stream,
+        CoveredSet *pCovered);
+
+    int m_nGlyphHeight;
+    cv::Scalar m_color;
+    // One cell per character from ' ' to '~'
+    cv::cuda::GpuMat m_atlas;
+    cv::Size m_cellSize;
+
+    std::vector<TextItem> m_vText;
+    cv::cuda::GpuMat m_logo;
+    cv::Point m_logoPos;
+    cv::cuda::GpuMat m_blend;
+    // What restorable overlays covered, by input buffer
+    std::map<const void *, CoveredSet> m_mCovered;
+    long long m_nGlyphCopy = 0;
+};
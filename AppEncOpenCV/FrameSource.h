@@ -0,0 +1,80 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief Supplies the frames that EncodeFrames() submits to the encoder.
+*  Frames are RGBA (CV_8UC4) cv::cuda::GpuMat of the encode size, matching
+*  NV_ENC_BUFFER_FORMAT_ABGR; a frame only has to stay valid until the next
+*  call of GetNextFrame().
+*/
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    /**
+    *  @brief Returns false once the source is exhausted.
+    */
+    virtual bool GetNextFrame(cv::cuda::GpuMat &frame) = 0;
+
+    /**
+    *  @brief Sources that compose their frames on the GPU return true and
+    *  implement RenderNextFrame() instead of GetNextFrame().
+    */
+    virtual bool IsRenderer() const { return false; }
+    /**
+    *  @brief Draws the next frame into dst, an encoder input buffer of the
+    *  encode size (RGBA), on stream. Returns false once the source is exhausted.
+    */
+    virtual bool RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) { return false; }
+
+    /**
+    *  @brief Sources that know which parts of their frames change return true
+    *  and implement GetChangedRegion(); the encoder then spends fewer bits on
+    *  the parts that did not change.
+    */
+    virtual bool HasChangedRegions() const { return false; }
+    /**
+    *  @brief Rectangles of the frame last returned or rendered that differ
+    *  from the frame before it, in frame coordinates; none if it is the same.
+    */
+    virtual void GetChangedRegion(std::vector<cv::Rect> &vRect) const { vRect.clear(); }
+};
+
+/**
+*  @brief Repeats one image nFrame times; what the sample has always encoded.
+*/
+class StillFrameSource : public FrameSource
+{
+public:
+    StillFrameSource(cv::cuda::GpuMat frame, int nFrame) : m_frame(frame), m_nFrame(nFrame) {}
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override
+    {
+        if (m_iFrame >= m_nFrame)
+        {
+            return false;
+        }
+        m_iFrame++;
+        frame = m_frame;
+        return true;
+    }
+
+private:
+    cv::cuda::GpuMat m_frame;
+    int m_nFrame = 0, m_iFrame = 0;
+};
@@ -0,0 +1,425 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include "../Utils/NvCodecUtils.h"
+#include "GpuMatEncoder.h"
+#include "LayerFanoutSink.h"
+
+// Also resets rate control and references; nWidth 0 selects the session maximum
+static void ReconfigureEncoder(NvEncoder *pEnc, int nWidth, int nHeight)
+{
+    NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+    reconfigureParams.reInitEncodeParams.encodeConfig = &encodeConfig;
+    pEnc->GetInitializeParams(&reconfigureParams.reInitEncodeParams);
+    NV_ENC_INITIALIZE_PARAMS &initializeParams = reconfigureParams.reInitEncodeParams;
+    if (nWidth <= 0)
+    {
+        nWidth = initializeParams.maxEncodeWidth;
+        nHeight = initializeParams.maxEncodeHeight;
+    }
+    if ((uint32_t)nWidth > initializeParams.maxEncodeWidth || (uint32_t)nHeight > initializeParams.maxEncodeHeight)
+    {
+        std::ostringstream err;
+        err << "Encode size " << nWidth << "x" << nHeight << " exceeds the session maximum of "
+            << initializeParams.maxEncodeWidth << "x" << initializeParams.maxEncodeHeight << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    initializeParams.encodeWidth = initializeParams.darWidth = nWidth;
+    initializeParams.encodeHeight = initializeParams.darHeight = nHeight;
+    reconfigureParams.resetEncoder = 1;
+    reconfigureParams.forceIDR = 1;
+    if (!pEnc->Reconfigure(&reconfigureParams))
+    {
+        NVENC_THROW_ERROR("Failed to reconfigure encoder", NV_ENC_ERR_GENERIC);
+    }
+}
+
+static cv::Size QueryEncoderMinSize(NvEncoder *pEnc, const GUID &codecGuid)
+{
+    return cv::Size(std::max(2, pEnc->GetCapabilityValue(codecGuid, NV_ENC_CAPS_WIDTH_MIN)),
+        std::max(2, pEnc->GetCapabilityValue(codecGuid, NV_ENC_CAPS_HEIGHT_MIN)));
+}
+
+cv::Size GetEncoderMinSize(CUcontext cuContext, const GUID &codecGuid)
+{
+    // Capabilities are answered by an open session, no encoder is created
+    NvEncoderGpuMat enc(cuContext, 256, 256, NV_ENC_BUFFER_FORMAT_ABGR);
+    return QueryEncoderMinSize(&enc, codecGuid);
+}
+
+void ResetEncoder(NvEncoder *pEnc)
+{
+    ReconfigureEncoder(pEnc, 0, 0);
+}
+
+void SetEncodeSize(NvEncoder *pEnc, int nWidth, int nHeight)
+{
+    ReconfigureEncoder(pEnc, nWidth, nHeight);
+}
+
+void SetBitrate(NvEncoder *pEnc, int nAverageBitrate, int nMaxBitrate)
+{
+    NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+    reconfigureParams.reInitEncodeParams.encodeConfig = &encodeConfig;
+    pEnc->GetInitializeParams(&reconfigureParams.reInitEncodeParams);
+    encodeConfig.rcParams.averageBitRate = nAverageBitrate;
+    encodeConfig.rcParams.maxBitRate = nMaxBitrate;
+    if (!pEnc->Reconfigure(&reconfigureParams))
+    {
+        NVENC_THROW_ERROR("Failed to reconfigure encoder bitrate", NV_ENC_ERR_GENERIC);
+    }
+}
+
+// 0 for sessions without temporal layers
+static int GetTemporalLayerCount(const NV_ENC_INITIALIZE_PARAMS &initializeParams)
+{
+    const NV_ENC_CONFIG &encodeConfig = *initializeParams.encodeConfig;
+    if (initializeParams.encodeGUID == NV_ENC_CODEC_H264_GUID && encodeConfig.encodeCodecConfig.h264Config.enableTemporalSVC)
+    {
+        return (int)encodeConfig.encodeCodecConfig.h264Config.numTemporalLayers;
+    }
+    if (initializeParams.encodeGUID == NV_ENC_CODEC_HEVC_GUID && encodeConfig.encodeCodecConfig.hevcConfig.numTemporalLayers > 1)
+    {
+        return (int)encodeConfig.encodeCodecConfig.hevcConfig.numTemporalLayers;
+    }
+    return 0;
+}
+
+// Packets of layered sessions go to sink tagged with their temporal layer
+static void WritePackets(const std::vector<std::vector<uint8_t>> &vPacket, const NV_ENC_INITIALIZE_PARAMS &initializeParams,
+    OutputSink &sink)
+{
+    bool bLayered = GetTemporalLayerCount(initializeParams) > 0;
+    bool bHevc = initializeParams.encodeGUID == NV_ENC_CODEC_HEVC_GUID;
+    for (const std::vector<uint8_t> &packet : vPacket)
+    {
+        if (bLayered)
+        {
+            sink.WritePacket(packet.data(), packet.size(), GetTemporalId(packet.data(), packet.size(), bHevc));
+        }
+        else
+        {
+            sink.Write(packet.data(), packet.size());
+        }
+    }
+}
+
+/**
+*  @brief Fills the next encoder input buffer with the next frame of source,
+*  through control.pDenoiser and control.pNormalizer if there are, stamps
+*  control.pOverlay on it and returns its handle, or -1 once source is
+*  exhausted. Frames control.pDuplicate drops are skipped, except the last
+*  one of source; iSourceFrame counts every frame of source. bSceneCut is set if control.pSceneCut finds
+*  a cut before the frame. A change of the encode size drains the encoder
+*  into sink first and counts the packets in nPacket.
+*/
+static int FillInputFrame(NvEncoderGpuMat *pEnc, FrameSource &source, cv::cuda::GpuMat &frame, const EncodeControl &control,
+    int &iSourceFrame, cv::Size minSize, cv::cuda::Stream &stream, OutputSink &sink, int &nPacket, bool &bSceneCut)
+{
+    const FrameNormalizer *pNormalizer = control.pNormalizer;
+    FrameOverlay *pOverlay = control.pOverlay;
+    bSceneCut = false;
+    if (source.IsRenderer())
+    {
+        int iHandle = pEnc->AcquireInput();
+        cv::cuda::GpuMat input = pEnc->GetInputGpuMat(iHandle);
+        if (pOverlay)
+        {
+            // The renderer may keep what it drew into this buffer last time
+            pOverlay->Restore(input, stream);
+        }
+        do
+        {
+            if (!source.RenderNextFrame(input, stream))
+            {
+                const cv::cuda::GpuMat *pLast = control.pDuplicate ? control.pDuplicate->KeepLast() : NULL;
+                if (!pLast)
+                {
+                    pEnc->CancelInput(iHandle);
+                    return -1;
+                }
+                pLast->copyTo(input, stream);
+                break;
+            }
+            iSourceFrame++;
+        } while (control.pDuplicate && control.pDuplicate->IsDuplicate(input, stream));
+        if (control.pSceneCut)
+        {
+            bSceneCut = control.pSceneCut->Detect(input, stream);
+        }
+        if (control.pLtr)
+        {
+            control.pLtr->Measure(input, stream);
+        }
+        if (pOverlay)
+        {
+            pOverlay->Apply(input, iSourceFrame - 1, stream, true);
+        }
+        // NVENC does not order its reads after work on CUDA streams
+        stream.waitForCompletion();
+        return iHandle;
+    }
+
+    do
+    {
+        if (!source.GetNextFrame(frame))
+        {
+            const cv::cuda::GpuMat *pLast = control.pDuplicate ? control.pDuplicate->KeepLast() : NULL;
+            if (!pLast)
+            {
+                return -1;
+            }
+            frame = *pLast;
+            break;
+        }
+        if (frame.type() != CV_8UC4)
+        {
+            throw std::invalid_argument("Frames must be RGBA\n");
+        }
+        iSourceFrame++;
+    } while (control.pDuplicate && control.pDuplicate->IsDuplicate(frame, stream));
+    // Into a buffer of the denoiser, frame may be the one the source reuses
+    const cv::cuda::GpuMat &src = control.pDenoiser ? control.pDenoiser->Filter(frame, stream) : frame;
+    if (pNormalizer)
+    {
+        NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+        NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+        initializeParams.encodeConfig = &encodeConfig;
+        pEnc->GetInitializeParams(&initializeParams);
+        cv::Size encodeSize = pNormalizer->GetEncodeSize(frame.size(), minSize,
+            cv::Size(initializeParams.maxEncodeWidth, initializeParams.maxEncodeHeight));
+        if (encodeSize.width != pEnc->GetEncodeWidth() || encodeSize.height != pEnc->GetEncodeHeight())
+        {
+            // Reconfiguring with a reset needs the pending frames flushed
+            std::vector<std::vector<uint8_t>> vPacket;
+            pEnc->EndEncode(vPacket);
+            WritePackets(vPacket, initializeParams, sink);
+            nPacket += (int)vPacket.size();
+            SetEncodeSize(pEnc, encodeSize.width, encodeSize.height);
+        }
+    }
+    else if (frame.cols != pEnc->GetEncodeWidth() || frame.rows != pEnc->GetEncodeHeight())
+    {
+        std::ostringstream err;
+        err << "Frame of " << frame.cols << "x" << frame.rows << " does not match the encoder ("
+            << pEnc->GetEncodeWidth() << "x" << pEnc->GetEncodeHeight() << " RGBA)" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    int iHandle = pEnc->AcquireInput();
+    cv::cuda::GpuMat input = pEnc->GetInputGpuMat(iHandle);
+    if (pNormalizer)
+    {
+        pNormalizer->Write(src, input, stream);
+    }
+    else
+    {
+        src.copyTo(input, stream);
+    }
+    if (control.pSceneCut)
+    {
+        // On the source frame, the bars of the normalizer never change
+        bSceneCut = control.pSceneCut->Detect(src, stream);
+    }
+    if (control.pLtr)
+    {
+        control.pLtr->Measure(src, stream);
+    }
+    if (pOverlay)
+    {
+        pOverlay->Apply(input, iSourceFrame - 1, stream);
+    }
+    stream.waitForCompletion();
+    return iHandle;
+}
+
+/**
+*  @brief Fills vQpDelta, one value per macroblock (H.264) or CTB (HEVC) in
+*  raster order, with nUnchangedQpDelta except under the rectangles of
+*  vChanged, and points picParams at it.
+*/
+static void SetChangedRegionQp(NvEncoderGpuMat *pEnc, const NV_ENC_INITIALIZE_PARAMS &initializeParams,
+    const std::vector<cv::Rect> &vChanged, int nUnchangedQpDelta, std::vector<int8_t> &vQpDelta, NV_ENC_PIC_PARAMS &picParams)
+{
+    int nBlock = 16;
+    if (initializeParams.encodeGUID == NV_ENC_CODEC_HEVC_GUID)
+    {
+        NV_ENC_HEVC_CUSIZE eCuSize = initializeParams.encodeConfig->encodeCodecConfig.hevcConfig.maxCUSize;
+        nBlock = eCuSize == NV_ENC_HEVC_CUSIZE_64x64 ? 64 : eCuSize == NV_ENC_HEVC_CUSIZE_16x16 ? 16 : 32;
+    }
+    int nBlockX = (pEnc->GetEncodeWidth() + nBlock - 1) / nBlock, nBlockY = (pEnc->GetEncodeHeight() + nBlock - 1) / nBlock;
+    vQpDelta.assign((size_t)nBlockX * nBlockY, (int8_t)nUnchangedQpDelta);
+    for (const cv::Rect &rect : vChanged)
+    {
+        int x0 = std::max(rect.x / nBlock, 0), x1 = std::min((rect.x + rect.width - 1) / nBlock, nBlockX - 1);
+        int y0 = std::max(rect.y / nBlock, 0), y1 = std::min((rect.y + rect.height - 1) / nBlock, nBlockY - 1);
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x++)
+            {
+                vQpDelta[(size_t)y * nBlockX + x] = 0;
+            }
+        }
+    }
+    picParams.qpDeltaMap = vQpDelta.data();
+    picParams.qpDeltaMapSize = (uint32_t)vQpDelta.size();
+}
+
+static int EncodeFramesInContext(NvEncoderGpuMat *pEnc, FrameSource &source, OutputSink &sink,
+    const EncodeControl &control, bool *pbYielded)
+{
+    NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+    initializeParams.encodeConfig = &encodeConfig;
+    pEnc->GetInitializeParams(&initializeParams);
+    int nGop = nDefaultYieldInterval;
+    if (encodeConfig.gopLength != NV_ENC_INFINITE_GOPLENGTH && encodeConfig.gopLength > 0)
+    {
+        nGop = (int)encodeConfig.gopLength;
+    }
+    cv::Size minSize = control.minSize;
+    if (control.pNormalizer && minSize.empty())
+    {
+        minSize = QueryEncoderMinSize(pEnc, initializeParams.encodeGUID);
+    }
+    if (pbYielded)
+    {
+        *pbYielded = false;
+    }
+    bool bChangedRegionQp = encodeConfig.rcParams.qpMapMode == NV_ENC_QP_MAP_DELTA && source.HasChangedRegions();
+    bool bHevc = initializeParams.encodeGUID == NV_ENC_CODEC_HEVC_GUID;
+    bool bLtr = control.pLtr && (bHevc ? encodeConfig.encodeCodecConfig.hevcConfig.enableLTR
+        : initializeParams.encodeGUID == NV_ENC_CODEC_H264_GUID && encodeConfig.encodeCodecConfig.h264Config.enableLTR);
+    if (control.pBitrate)
+    {
+        control.pBitrate->Start(pEnc);
+    }
+    std::vector<cv::Rect> vChanged;
+    std::vector<int8_t> vQpDelta;
+
+    int nFrame = 0, nSubmitted = 0, iSourceFrame = 0;
+    cv::cuda::GpuMat frame;
+    cv::cuda::Stream stream;
+    // For receiving encoded packets
+    std::vector<std::vector<uint8_t>> vPacket;
+    for (bool bEnd = false; !bEnd; )
+    {
+        bool bYield = control.fnYield && nSubmitted && nSubmitted % nGop == 0 && control.fnYield();
+        if (bYield && pbYielded)
+        {
+            *pbYielded = true;
+        }
+        bool bSceneCut = false;
+        int iHandle = bYield ? -1 : FillInputFrame(pEnc, source, frame, control, iSourceFrame, minSize, stream, sink, nFrame,
+            bSceneCut);
+        if (iHandle >= 0)
+        {
+            NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
+            if (bChangedRegionQp)
+            {
+                source.GetChangedRegion(vChanged);
+                SetChangedRegionQp(pEnc, initializeParams, vChanged, control.nUnchangedQpDelta, vQpDelta, picParams);
+            }
+            if (bSceneCut)
+            {
+                // An IDR restarts the GOP; an intra frame keeps its cadence
+                picParams.encodePicFlags |= control.bSceneCutIntra ? NV_ENC_PIC_FLAG_FORCEINTRA
+                    : NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+            }
+            if (bLtr)
+            {
+                // A stream starts with an IDR; encode size changes are seen by Measure()
+                control.pLtr->SetPicParams(nSubmitted == 0 || (bSceneCut && !control.bSceneCutIntra), bHevc, picParams);
+            }
+            pEnc->SubmitInput(iHandle, vPacket, bChangedRegionQp || bSceneCut || bLtr ? &picParams : nullptr);
+            nSubmitted++;
+        }
+        else
+        {
+            pEnc->EndEncode(vPacket);
+            bEnd = true;
+        }
+        nFrame += (int)vPacket.size();
+        WritePackets(vPacket, initializeParams, sink);
+        if (control.pBitrate && !bEnd)
+        {
+            control.pBitrate->Update(pEnc, sink);
+        }
+    }
+    if (control.pBitrate)
+    {
+        control.pBitrate->Finish(pEnc);
+    }
+    return nFrame;
+}
+
+int EncodeFrames(NvEncoderGpuMat *pEnc, CUcontext cuContext, FrameSource &source, OutputSink &sink,
+    const EncodeControl &control, bool *pbYielded)
+{
+    // The OpenCV work on the frames has to run in the context of the encoder
+    // input buffers, whatever the calling thread has current
+    ck(cuCtxPushCurrent(cuContext));
+    int nFrame = 0;
+    try
+    {
+        nFrame = EncodeFramesInContext(pEnc, source, sink, control, pbYielded);
+    }
+    catch (...)
+    {
+        cuCtxPopCurrent(NULL);
+        throw;
+    }
+    ck(cuCtxPopCurrent(NULL));
+    return nFrame;
+}
+
+void EncodeFrameSource(int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions, CUcontext cuContext, FrameSource &source,
+    OutputSink &sink, const EncodeControl &control)
+{
+    NV_ENC_BUFFER_FORMAT eFormat = NV_ENC_BUFFER_FORMAT_ABGR;
+    EncodeControl sessionControl = control;
+    if (control.pNormalizer)
+    {
+        sessionControl.minSize = GetEncoderMinSize(cuContext, encodeCLIOptions.GetEncodeGUID());
+        cv::Size sessionSize = control.pNormalizer->GetSessionSize(cv::Size(nWidth, nHeight), sessionControl.minSize);
+        nWidth = sessionSize.width;
+        nHeight = sessionSize.height;
+    }
+
+    std::unique_ptr<NvEncoderGpuMat> pEnc(new NvEncoderGpuMat(cuContext, nWidth, nHeight, eFormat));
+
+    InitializeEncoder(pEnc, encodeCLIOptions, eFormat, source.HasChangedRegions(), control.pLtr ? 2 : 0, control.nTemporalLayers);
+
+    int nPacket = EncodeFrames(pEnc.get(), cuContext, source, sink, sessionControl);
+
+    pEnc->DestroyEncoder();
+
+    std::cout << "Total frames encoded: " << nPacket << std::endl;
+}
+
+void EncodeGpuMat(int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions, CUcontext cuContext, cv::cuda::GpuMat srcIn,
+    OutputSink &sink, int nFrame, const FrameNormalizer *pNormalizer)
+{
+    StillFrameSource source(srcIn, nFrame);
+    if (pNormalizer)
+    {
+        nWidth = srcIn.cols;
+        nHeight = srcIn.rows;
+    }
+    EncodeControl control;
+    control.pNormalizer = pNormalizer;
+    EncodeFrameSource(nWidth, nHeight, encodeCLIOptions, cuContext, source, sink, control);
+}
@@ -0,0 +1,221 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <cuda.h>
+#include "NvEncoder/NvEncoderCuda.h"
+#include "NvEncoderGpuMat.h"
+#include "../Utils/NvEncoderCLIOptions.h"
+#include "FrameNormalizer.h"
+#include "FrameOverlay.h"
+#include "SceneCutDetector.h"
+#include "TemporalDenoiser.h"
+#include "DuplicateFrameFilter.h"
+#include "LtrController.h"
+#include "BitrateController.h"
+#include "FrameSource.h"
+#include "OutputSink.h"
+
+// 15 seconds at 25 fps
+static const int nDefaultFrameCount = 15 * 25;
+static const int nDefaultYieldInterval = 60;
+
+/**
+*  @brief Creates the encoder with the options of encodeCLIOptions. With
+*  bQpDeltaMap, frames can carry a QP delta map (see EncodeControl). With
+*  nLtrFrames, up to that many long-term references are enabled where the
+*  GPU has them; the GOP then has no B frames, and its keyframes but the
+*  first are intra frames instead of IDR, which would flush the references.
+*  With nTemporalLayers, the GOP is hierarchical P with up to that many
+*  temporal layers; EncodeFrames() then tags every packet with its layer
+*  (see OutputSink::WritePacket()).
+*/
+template<class EncoderClass>
+void InitializeEncoder(EncoderClass &pEnc, NvEncoderInitParam encodeCLIOptions, NV_ENC_BUFFER_FORMAT eFormat, bool bQpDeltaMap = false,
+    int nLtrFrames = 0, int nTemporalLayers = 0)
+{
+    NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
+
+    initializeParams.encodeConfig = &encodeConfig;
+    pEnc->CreateDefaultEncoderParams(&initializeParams, encodeCLIOptions.GetEncodeGUID(), encodeCLIOptions.GetPresetGUID(), encodeCLIOptions.GetTuningInfo());
+    encodeCLIOptions.SetInitParams(&initializeParams, eFormat);
+    if (bQpDeltaMap)
+    {
+        encodeConfig.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+    }
+    if (nLtrFrames > 0)
+    {
+        nLtrFrames = std::min(nLtrFrames, pEnc->GetCapabilityValue(initializeParams.encodeGUID, NV_ENC_CAPS_NUM_MAX_LTR_FRAMES));
+    }
+    if (nLtrFrames > 0 && initializeParams.encodeGUID == NV_ENC_CODEC_H264_GUID)
+    {
+        encodeConfig.frameIntervalP = 1;
+        encodeConfig.encodeCodecConfig.h264Config.enableLTR = 1;
+        encodeConfig.encodeCodecConfig.h264Config.ltrNumFrames = nLtrFrames;
+        encodeConfig.encodeCodecConfig.h264Config.idrPeriod = NV_ENC_INFINITE_GOPLENGTH;
+    }
+    else if (nLtrFrames > 0 && initializeParams.encodeGUID == NV_ENC_CODEC_HEVC_GUID)
+    {
+        encodeConfig.frameIntervalP = 1;
+        encodeConfig.encodeCodecConfig.hevcConfig.enableLTR = 1;
+        encodeConfig.encodeCodecConfig.hevcConfig.ltrNumFrames = nLtrFrames;
+        encodeConfig.encodeCodecConfig.hevcConfig.idrPeriod = NV_ENC_INFINITE_GOPLENGTH;
+    }
+    if (nTemporalLayers > 1)
+    {
+        nTemporalLayers = std::min(nTemporalLayers,
+            pEnc->GetCapabilityValue(initializeParams.encodeGUID, NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS));
+    }
+    if (nTemporalLayers > 1 && initializeParams.encodeGUID == NV_ENC_CODEC_H264_GUID
+        && pEnc->GetCapabilityValue(initializeParams.encodeGUID, NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC))
+    {
+        // The layer of every slice is in its SVC prefix NAL unit
+        encodeConfig.frameIntervalP = 1;
+        encodeConfig.encodeCodecConfig.h264Config.enableTemporalSVC = 1;
+        encodeConfig.encodeCodecConfig.h264Config.h264Extension.svcTemporalConfig.numTemporalLayers = nTemporalLayers;
+        encodeConfig.encodeCodecConfig.h264Config.maxTemporalLayers = nTemporalLayers;
+        encodeConfig.encodeCodecConfig.h264Config.numTemporalLayers = nTemporalLayers;
+    }
+    else if (nTemporalLayers > 1 && initializeParams.encodeGUID == NV_ENC_CODEC_HEVC_GUID)
+    {
+        encodeConfig.frameIntervalP = 1;
+        encodeConfig.encodeCodecConfig.hevcConfig.maxTemporalLayersMinus1 = nTemporalLayers - 1;
+        encodeConfig.encodeCodecConfig.hevcConfig.numTemporalLayers = nTemporalLayers;
+    }
+
+    pEnc->CreateEncoder(&initializeParams);
+}
+
+/**
+*  @brief Smallest encode size of codecGuid on the GPU of cuContext, for
+*  FrameNormalizer::GetSessionSize() and EncodeControl::minSize. The query
+*  opens a session of its own, so it is made once, before the sessions that
+*  use the result; EncoderSessionPool does so when it is created.
+*/
+cv::Size GetEncoderMinSize(CUcontext cuContext, const GUID &codecGuid);
+
+/**
+*  @brief Prepares an encoder that has finished a stream with EndEncode() for
+*  the next one: rate control and reference state are reset, the encode size
+*  goes back to the size the session was created with and the next frame is
+*  coded as IDR, so the session can be reused instead of recreated.
+*/
+void ResetEncoder(NvEncoder *pEnc);
+
+/**
+*  @brief Changes the encode size within the maximum the session was created
+*  with; the next frame is coded as IDR with new stream headers.
+*/
+void SetEncodeSize(NvEncoder *pEnc, int nWidth, int nHeight);
+
+/**
+*  @brief Changes the average and peak bitrate of the rate control, 0 for the
+*  preset default, without an IDR: the stream goes on at the new rate.
+*/
+void SetBitrate(NvEncoder *pEnc, int nAverageBitrate, int nMaxBitrate);
+
+/**
+*  @brief Optional behaviour of EncodeFrames().
+*/
+struct EncodeControl
+{
+    /**
+    *  @brief Writes frames of any size into the encoder input buffer. Without
+    *  one, frames must have the encode size.
+    */
+    const FrameNormalizer *pNormalizer = NULL;
+    /**
+    *  @brief Asked before the first frame of every GOP but the first (every
+    *  nDefaultYieldInterval frames with an infinite GOP); if it returns true,
+    *  the stream is ended there. The next frames of the source can then be
+    *  encoded as a new stream, after ResetEncoder(), on any session.
+    */
+    std::function<bool()> fnYield;
+    /**
+    *  @brief QP offset of the blocks a source reports as unchanged (see
+    *  FrameSource::HasChangedRegions()), on sessions created with a QP delta
+    *  map. Static blocks then cost close to nothing and the bits go to the
+    *  changed ones.
+    */
+    int nUnchangedQpDelta = 6;
+    /**
+    *  @brief Burnt into every frame in the encoder input buffer, after the
+    *  frame has been written there.
+    */
+    FrameOverlay *pOverlay = NULL;
+    /**
+    *  @brief Looks at every frame before it is submitted; the frames it finds
+    *  a scene cut at are coded as IDR, or as intra frames that keep the GOP
+    *  cadence with bSceneCutIntra.
+    */
+    SceneCutDetector *pSceneCut = NULL;
+    bool bSceneCutIntra = false;
+    /**
+    *  @brief Filters the frames of sources that are not renderers before they
+    *  are written into the encoder input buffer.
+    */
+    TemporalDenoiser *pDenoiser = NULL;
+    /**
+    *  @brief Frames it finds identical to the last one encoded are not
+    *  encoded; it keeps the source frame index of the others for variable
+    *  frame rate timestamps.
+    */
+    DuplicateFrameFilter *pDuplicate = NULL;
+    /**
+    *  @brief Chooses the long-term references of every frame, on sessions
+    *  created with them (see InitializeEncoder()).
+    */
+    LtrController *pLtr = NULL;
+    /**
+    *  @brief Temporal layers of the session EncodeFrameSource() creates, none
+    *  if below 2. Sessions passed to EncodeFrames() have theirs already.
+    */
+    int nTemporalLayers = 0;
+    /**
+    *  @brief Adapts the bitrate to what sink drains, measured after the
+    *  packets of every frame have been written.
+    */
+    BitrateController *pBitrate = NULL;
+    /**
+    *  @brief Smallest encode size pNormalizer may choose (see
+    *  GetEncoderMinSize()); queried on the session if empty.
+    */
+    cv::Size minSize;
+};
+
+/**
+*  @brief Encodes every frame of source and drains the encoder with
+*  EndEncode(). Returns the number of packets written to sink; *pbYielded is
+*  set if control.fnYield ended the stream early. Renderer sources and
+*  normalized frames are written straight into the encoder input buffers.
+*/
+int EncodeFrames(NvEncoderGpuMat *pEnc, CUcontext cuContext, FrameSource &source, OutputSink &sink,
+    const EncodeControl &control = EncodeControl(), bool *pbYielded = NULL);
+
+/**
+*  @brief Creates an ABGR encoder of nWidth x nHeight, the size of the frames
+*  of source, and encodes source to the end. With control.pNormalizer, the
+*  session size is its GetSessionSize() of the frame size instead.
+*/
+void EncodeFrameSource(int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions, CUcontext cuContext, FrameSource &source,
+    OutputSink &sink, const EncodeControl &control = EncodeControl());
+
+/**
+*  @brief Creates an ABGR encoder of nWidth x nHeight and encodes nFrame
+*  copies of srcIn, an RGBA GpuMat. With pNormalizer, the session size is
+*  pNormalizer->GetSessionSize() of the size of srcIn instead.
+*/
+void EncodeGpuMat(int nWidth, int nHeight, NvEncoderInitParam encodeCLIOptions, CUcontext cuContext, cv::cuda::GpuMat srcIn,
+    OutputSink &sink, int nFrame = nDefaultFrameCount, const FrameNormalizer *pNormalizer = NULL);
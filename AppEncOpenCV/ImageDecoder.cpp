@@ -0,0 +1,360 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string.h>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "ImageDecoder.h"
+#include "PinnedMatAllocator.h"
+
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+static bool ReadFile(const std::string &strPath, std::vector<uchar> &vData)
+{
+    std::ifstream fpIn(strPath, std::ios::in | std::ios::binary);
+    if (!fpIn)
+    {
+        return false;
+    }
+    fpIn.seekg(0, std::ios::end);
+    std::streamoff nSize = fpIn.tellg();
+    if (nSize <= 0)
+    {
+        return false;
+    }
+    fpIn.seekg(0, std::ios::beg);
+    vData.resize((size_t)nSize);
+    return (bool)fpIn.read(reinterpret_cast<char*>(vData.data()), nSize);
+}
+
+static bool IsJpeg(const std::vector<uchar> &vData)
+{
+    // SOI marker
+    return vData.size() > 2 && vData[0] == 0xFF && vData[1] == 0xD8;
+}
+
+// EXIF orientation (1 to 8) of a JPEG, 1 if it has none
+static int GetExifOrientation(const std::vector<uchar> &vData)
+{
+    for (size_t i = 2; i + 4 <= vData.size() && vData[i] == 0xFF; )
+    {
+        int nMarker = vData[i + 1];
+        size_t nLength = (size_t)vData[i + 2] << 8 | vData[i + 3];
+        // The metadata segments come before the start of scan
+        if (nMarker == 0xDA || nLength < 2 || i + 2 + nLength > vData.size())
+        {
+            break;
+        }
+        if (nMarker == 0xE1 && nLength >= 2 + 6 + 8 && !memcmp(&vData[i + 4], "Exif\0\0", 6))
+        {
+            // TIFF header and IFD0, offsets are relative to the header
+            const uchar *pTiff = &vData[i + 4 + 6];
+            size_t nTiff = nLength - 2 - 6;
+            bool bLittleEndian = pTiff[0] == 'I';
+            auto Read16 = [&](size_t iOffset) -> uint32_t {
+                return bLittleEndian ? pTiff[iOffset] | pTiff[iOffset + 1] << 8 : pTiff[iOffset] << 8 | pTiff[iOffset + 1];
+            };
+            size_t iIfd = bLittleEndian ? Read16(4) | Read16(6) << 16 : Read16(4) << 16 | Read16(6);
+            if (iIfd + 2 > nTiff)
+            {
+                return 1;
+            }
+            uint32_t nEntry = Read16(iIfd);
+            for (uint32_t k = 0; k < nEntry && iIfd + 2 + 12 * (k + 1) <= nTiff; k++)
+            {
+                size_t iEntry = iIfd + 2 + 12 * k;
+                if (Read16(iEntry) == 0x0112)
+                {
+                    // A SHORT, left aligned in the value field
+                    uint32_t nOrientation = Read16(iEntry + 8);
+                    return nOrientation >= 1 && nOrientation <= 8 ? (int)nOrientation : 1;
+                }
+            }
+            return 1;
+        }
+        i += 2 + nLength;
+    }
+    return 1;
+}
+
+// Turns frame as stored into frame as meant to be shown
+static void ApplyExifOrientation(cv::cuda::GpuMat &frame, int nOrientation, cv::cuda::Stream &stream)
+{
+    // Flip after the transpose for 5 to 8: none, around the y axis, both axes, around the x axis
+    static const int anFlipCode[9] = {0, 0, 1, -1, 0, 0, 1, -1, 0};
+    if (nOrientation <= 1)
+    {
+        return;
+    }
+    cv::cuda::GpuMat src = frame, dst;
+    if (nOrientation >= 5)
+    {
+        cv::cuda::transpose(src, dst, stream);
+        if (nOrientation == 5)
+        {
+            frame = dst;
+            return;
+        }
+        src = dst;
+        dst = cv::cuda::GpuMat();
+    }
+    cv::cuda::flip(src, dst, anFlipCode[nOrientation], stream);
+    frame = dst;
+}
+
+ImageDecoder::ImageDecoder(int nMaxBatch, int nThread)
+    : m_nMaxBatch(std::max(nMaxBatch, 1))
+    , m_nThread(nThread > 0 ? nThread : (int)std::max(1u, std::min(std::thread::hardware_concurrency(), 8u)))
+{
+#ifdef HAVE_NVJPEG
+    // Without a usable nvJPEG everything goes through the CPU path
+    if (nvjpegCreateSimple(&m_hJpeg) != NVJPEG_STATUS_SUCCESS)
+    {
+        m_hJpeg = NULL;
+    }
+    else if (nvjpegJpegStateCreate(m_hJpeg, &m_hState) != NVJPEG_STATUS_SUCCESS)
+    {
+        nvjpegDestroy(m_hJpeg);
+        m_hJpeg = NULL;
+    }
+#endif
+}
+
+ImageDecoder::~ImageDecoder()
+{
+#ifdef HAVE_NVJPEG
+    if (m_hJpeg)
+    {
+        nvjpegJpegStateDestroy(m_hState);
+        nvjpegDestroy(m_hJpeg);
+    }
+#endif
+}
+
+bool ImageDecoder::IsGpuDecoder() const
+{
+#ifdef HAVE_NVJPEG
+    return m_hJpeg != NULL;
+#else
+    return false;
+#endif
+}
+
+void ImageDecoder::Decode(const std::vector<std::string> &vPath, std::vector<cv::cuda::GpuMat> &vFrame,
+    std::vector<std::string> &vError, cv::cuda::Stream &stream)
+{
+    vFrame.assign(vPath.size(), cv::cuda::GpuMat());
+    vError.assign(vPath.size(), std::string());
+    if (m_vData.size() < vPath.size())
+    {
+        m_vData.resize(vPath.size());
+    }
+
+    std::vector<size_t> vCpu;
+    std::vector<int> vOrientation(vPath.size(), 1);
+#ifdef HAVE_NVJPEG
+    std::vector<size_t> vGpu;
+    std::vector<cv::Size> vSize(vPath.size());
+#endif
+    for (size_t i = 0; i < vPath.size(); i++)
+    {
+        if (!ReadFile(vPath[i], m_vData[i]))
+        {
+            vError[i] = "Unable to read image " + vPath[i] + "\n";
+            continue;
+        }
+        if (IsJpeg(m_vData[i]))
+        {
+            vOrientation[i] = GetExifOrientation(m_vData[i]);
+        }
+#ifdef HAVE_NVJPEG
+        int nComponent = 0, anWidth[NVJPEG_MAX_COMPONENT] = {}, anHeight[NVJPEG_MAX_COMPONENT] = {};
+        nvjpegChromaSubsampling_t eSubsampling;
+        if (m_hJpeg && IsJpeg(m_vData[i])
+            && nvjpegGetImageInfo(m_hJpeg, m_vData[i].data(), m_vData[i].size(), &nComponent, &eSubsampling, anWidth, anHeight) == NVJPEG_STATUS_SUCCESS)
+        {
+            vSize[i] = cv::Size(anWidth[0], anHeight[0]);
+            vGpu.push_back(i);
+            continue;
+        }
+#endif
+        vCpu.push_back(i);
+    }
+
+#ifdef HAVE_NVJPEG
+    std::vector<const unsigned char*> vpData;
+    std::vector<size_t> vnData;
+    std::vector<nvjpegImage_t> vImage;
+    for (size_t iFirst = 0; iFirst < vGpu.size(); iFirst += m_nMaxBatch)
+    {
+        int nBatch = (int)std::min(vGpu.size() - iFirst, (size_t)m_nMaxBatch);
+        if (nBatch != m_nBatchInit)
+        {
+            if (nvjpegDecodeBatchedInitialize(m_hJpeg, m_hState, nBatch, 1, NVJPEG_OUTPUT_RGBI) != NVJPEG_STATUS_SUCCESS)
+            {
+                m_nBatchInit = 0;
+                vCpu.insert(vCpu.end(), vGpu.begin() + iFirst, vGpu.begin() + iFirst + nBatch);
+                continue;
+            }
+            m_nBatchInit = nBatch;
+        }
+        m_vRgb.resize(std::max((int)m_vRgb.size(), nBatch));
+        vpData.resize(nBatch);
+        vnData.resize(nBatch);
+        vImage.assign(nBatch, nvjpegImage_t());
+        for (int k = 0; k < nBatch; k++)
+        {
+            size_t i = vGpu[iFirst + k];
+            vpData[k] = m_vData[i].data();
+            vnData[k] = m_vData[i].size();
+            m_vRgb[k].create(vSize[i], CV_8UC3);
+            vImage[k].channel[0] = m_vRgb[k].data;
+            vImage[k].pitch[0] = m_vRgb[k].step;
+        }
+        if (nvjpegDecodeBatched(m_hJpeg, m_hState, vpData.data(), vnData.data(), vImage.data(),
+            cv::cuda::StreamAccessor::getStream(stream)) != NVJPEG_STATUS_SUCCESS)
+        {
+            // E.g. a progressive JPEG the hardware cannot take, retry the batch on the CPU
+            vCpu.insert(vCpu.end(), vGpu.begin() + iFirst, vGpu.begin() + iFirst + nBatch);
+            continue;
+        }
+        for (int k = 0; k < nBatch; k++)
+        {
+            // Queued behind the decode; the next batch overwrites m_vRgb only after it
+            cv::cuda::cvtColor(m_vRgb[k], vFrame[vGpu[iFirst + k]], cv::ColorConversionCodes::COLOR_RGB2RGBA, 0, stream);
+        }
+    }
+#endif
+
+    DecodeOnCpu(m_vData, vCpu, vFrame, vError, vOrientation, stream);
+    for (size_t i = 0; i < vFrame.size(); i++)
+    {
+        if (!vFrame[i].empty())
+        {
+            ApplyExifOrientation(vFrame[i], vOrientation[i], stream);
+        }
+    }
+    stream.waitForCompletion();
+    m_vHost.clear();
+}
+
+void ImageDecoder::DecodeOnCpu(const std::vector<std::vector<uchar>> &vData, const std::vector<size_t> &vIndex,
+    std::vector<cv::cuda::GpuMat> &vFrame, std::vector<std::string> &vError, std::vector<int> &vOrientation,
+    cv::cuda::Stream &stream)
+{
+    if (vIndex.empty())
+    {
+        return;
+    }
+    m_vHost.assign(vFrame.size(), cv::Mat());
+    std::atomic<size_t> iNext{0};
+    auto DecodeWorker = [&]() {
+#ifdef HAVE_TURBOJPEG
+        tjhandle hTurbo = tjInitDecompress();
+#endif
+        for (size_t iItem; (iItem = iNext++) < vIndex.size(); )
+        {
+            size_t i = vIndex[iItem];
+            cv::Mat &host = m_vHost[i];
+            try
+            {
+#ifdef HAVE_TURBOJPEG
+                int nWidth = 0, nHeight = 0, eSubsampling = 0, eColorspace = 0;
+                if (hTurbo && IsJpeg(vData[i])
+                    && !tjDecompressHeader3(hTurbo, vData[i].data(), (unsigned long)vData[i].size(), &nWidth, &nHeight, &eSubsampling, &eColorspace))
+                {
+                    host.allocator = PinnedMatAllocator::GetInstance();
+                    host.create(nHeight, nWidth, CV_8UC4);
+                    if (!tjDecompress2(hTurbo, vData[i].data(), (unsigned long)vData[i].size(), host.data,
+                        nWidth, (int)host.step, nHeight, TJPF_RGBA, 0))
+                    {
+                        continue;
+                    }
+                    host.release();
+                }
+#endif
+                // BGR, converted on the GPU after the upload; already oriented
+                host = DecodeImagePinned(vData[i]);
+                vOrientation[i] = 1;
+                if (host.empty())
+                {
+                    vError[i] = "Unable to decode image\n";
+                }
+            }
+            catch (const std::exception &ex)
+            {
+                host.release();
+                vError[i] = ex.what();
+            }
+        }
+#ifdef HAVE_TURBOJPEG
+        if (hTurbo)
+        {
+            tjDestroy(hTurbo);
+        }
+#endif
+    };
+
+    int nWorker = (int)std::min(vIndex.size(), (size_t)m_nThread);
+    std::vector<std::thread> vWorker;
+    for (int i = 1; i < nWorker; i++)
+    {
+        vWorker.emplace_back(DecodeWorker);
+    }
+    DecodeWorker();
+    for (std::thread &worker : vWorker)
+    {
+        worker.join();
+    }
+
+    // Asynchronous uploads from pinned memory; Decode() waits for them
+    std::vector<cv::cuda::GpuMat> vBgr(vFrame.size());
+    for (size_t i : vIndex)
+    {
+        cv::Mat &host = m_vHost[i];
+        if (host.empty())
+        {
+            continue;
+        }
+        if (host.channels() == 4)
+        {
+            vFrame[i].upload(host, stream);
+        }
+        else
+        {
+            vBgr[i].upload(host, stream);
+            cv::cuda::cvtColor(vBgr[i], vFrame[i], cv::ColorConversionCodes::COLOR_BGR2RGBA, 0, stream);
+        }
+    }
+    stream.waitForCompletion();
+}
+
+cv::cuda::GpuMat ImageDecoder::Decode(const std::string &strPath, cv::cuda::Stream &stream)
+{
+    std::vector<cv::cuda::GpuMat> vFrame;
+    std::vector<std::string> vError;
+    Decode(std::vector<std::string>(1, strPath), vFrame, vError, stream);
+    if (vFrame[0].empty())
+    {
+        throw std::invalid_argument(vError[0].empty() ? "Unable to decode image " + strPath + "\n" : vError[0]);
+    }
+    return vFrame[0];
+}
@@ -0,0 +1,84 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+#ifdef HAVE_NVJPEG
+#include <nvjpeg.h>
+#endif
+
+/**
+*  @brief Decodes image files into RGBA (CV_8UC4) GpuMats, the frame format
+*  of FrameSource.
+*
+*  With nvJPEG (HAVE_NVJPEG), JPEG files are decoded in batches of up to
+*  nMaxBatch on the GPU, straight into device memory. Other images, JPEGs
+*  nvJPEG rejects and, without nvJPEG, all images are decoded by nThread CPU
+*  threads into pinned memory and uploaded: JPEGs with libjpeg-turbo
+*  (HAVE_TURBOJPEG) directly to RGBA, anything else with cv::imdecode().
+*  Every path applies the EXIF orientation like cv::imread() does, the JPEG
+*  decoders by a transpose and flip on the GPU.
+*
+*  An ImageDecoder is used by one thread at a time, on the device whose
+*  frames it produces.
+*/
+class ImageDecoder
+{
+public:
+    /**
+    *  @brief nThread 0 uses one CPU thread per core, up to 8.
+    */
+    ImageDecoder(int nMaxBatch = 8, int nThread = 0);
+    ~ImageDecoder();
+
+    /**
+    *  @brief Decodes vPath[i] into vFrame[i]. A file that cannot be read or
+    *  decoded leaves vFrame[i] empty and its reason in vError[i]. Returns
+    *  with the frames ready on stream.
+    */
+    void Decode(const std::vector<std::string> &vPath, std::vector<cv::cuda::GpuMat> &vFrame,
+        std::vector<std::string> &vError, cv::cuda::Stream &stream);
+
+    /**
+    *  @brief Decode() of a single file; throws if it cannot be decoded.
+    */
+    cv::cuda::GpuMat Decode(const std::string &strPath, cv::cuda::Stream &stream = cv::cuda::Stream::Null());
+
+    /**
+    *  @brief Returns true if JPEG files are decoded on the GPU.
+    */
+    bool IsGpuDecoder() const;
+
+private:
+    // Sets vOrientation[i] to 1 for the images cv::imdecode() has oriented
+    void DecodeOnCpu(const std::vector<std::vector<uchar>> &vData, const std::vector<size_t> &vIndex,
+        std::vector<cv::cuda::GpuMat> &vFrame, std::vector<std::string> &vError, std::vector<int> &vOrientation,
+        cv::cuda::Stream &stream);
+
+    int m_nMaxBatch, m_nThread;
+    // Compressed files of the current call, kept to reuse their storage
+    std::vector<std::vector<uchar>> m_vData;
+    // Pinned RGBA images of the CPU path, alive until their upload completes
+    std::vector<cv::Mat> m_vHost;
+#ifdef HAVE_NVJPEG
+    nvjpegHandle_t m_hJpeg = NULL;
+    nvjpegJpegState_t m_hState = NULL;
+    // Batch size nvjpegDecodeBatchedInitialize() was called with
+    int m_nBatchInit = 0;
+    // Interleaved RGB output of nvJPEG, converted to RGBA
+    std::vector<cv::cuda::GpuMat> m_vRgb;
+#endif
+};
@@ -0,0 +1,389 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include "IoUringSink.h"
+
+#ifdef HAVE_LIBURING
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+IoUringWriter::IoUringWriter(unsigned nQueueDepth, unsigned nBuffers, size_t nBufferSize, unsigned nMaxSpilled)
+    : m_nBuffers(nBuffers), m_nBufferSize(nBufferSize), m_nMaxSpilled(nMaxSpilled)
+{
+    int e = io_uring_queue_init(nQueueDepth, &m_ring, 0);
+    if (e < 0)
+    {
+        std::ostringstream err;
+        err << "io_uring_queue_init() failed: " << strerror(-e) << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    void *pPool = mmap(NULL, nBuffers * nBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pPool == MAP_FAILED)
+    {
+        io_uring_queue_exit(&m_ring);
+        throw std::bad_alloc();
+    }
+    m_pPool = static_cast<uint8_t*>(pPool);
+    std::vector<struct iovec> vIov(nBuffers);
+    for (unsigned i = 0; i < nBuffers; i++)
+    {
+        vIov[i].iov_base = m_pPool + i * nBufferSize;
+        vIov[i].iov_len = nBufferSize;
+        m_viFreeBuffer.push_back(nBuffers - 1 - i);
+    }
+    // Registered buffers are pinned once instead of on every write; without
+    // them (RLIMIT_MEMLOCK too low) the pool still works with plain writes
+    e = io_uring_register_buffers(&m_ring, vIov.data(), nBuffers);
+    if (e < 0)
+    {
+        std::cout << "io_uring_register_buffers() failed: " << strerror(-e) << ", using unregistered buffers" << std::endl;
+        m_bRegistered = false;
+    }
+    m_thread = std::thread(&IoUringWriter::Run, this);
+}
+
+IoUringWriter::~IoUringWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cvWork.notify_one();
+    m_thread.join();
+    io_uring_queue_exit(&m_ring);
+    munmap(m_pPool, m_nBuffers * m_nBufferSize);
+}
+
+bool IoUringWriter::IsAvailable()
+{
+    // Asked for every sink that is created, the answer does not change
+    static const bool bAvailable = []
+    {
+        struct io_uring ring;
+        if (io_uring_queue_init(2, &ring, 0) < 0)
+        {
+            return false;
+        }
+        io_uring_queue_exit(&ring);
+        return true;
+    }();
+    return bAvailable;
+}
+
+std::shared_ptr<IoUringWriter> IoUringWriter::GetShared()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<IoUringWriter> pShared;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<IoUringWriter> pWriter = pShared.lock();
+    if (!pWriter)
+    {
+        pWriter = std::make_shared<IoUringWriter>();
+        pShared = pWriter;
+    }
+    return pWriter;
+}
+
+IoUringWriter::Buffer IoUringWriter::AcquireBuffer()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_viFreeBuffer.empty() && m_nSpilled >= m_nMaxSpilled)
+        {
+            if (!m_stats.nBufferWaits)
+            {
+                std::cout << "io_uring writes fall behind by " << m_nBuffers + m_nSpilled
+                    << " buffers, writing streams wait for them" << std::endl;
+            }
+            m_stats.nBufferWaits++;
+            m_cvBufferFree.wait(lock, [this] { return !m_viFreeBuffer.empty() || m_nSpilled < m_nMaxSpilled; });
+        }
+        if (!m_viFreeBuffer.empty())
+        {
+            int i = m_viFreeBuffer.back();
+            m_viFreeBuffer.pop_back();
+            return Buffer{m_pPool + i * m_nBufferSize, m_nBufferSize, i};
+        }
+        m_stats.nSpilledBuffers++;
+        m_nSpilled++;
+    }
+    uint8_t *pData = static_cast<uint8_t*>(malloc(m_nBufferSize));
+    if (!pData)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_nSpilled--;
+        throw std::bad_alloc();
+    }
+    return Buffer{pData, m_nBufferSize, -1};
+}
+
+void IoUringWriter::ReleaseBuffer(const Buffer &buffer)
+{
+    if (buffer.iIndex < 0)
+    {
+        free(buffer.pData);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (buffer.iIndex < 0)
+        {
+            m_nSpilled--;
+        }
+        else
+        {
+            m_viFreeBuffer.push_back(buffer.iIndex);
+        }
+    }
+    m_cvBufferFree.notify_one();
+}
+
+void IoUringWriter::Submit(Stream *pStream, Buffer buffer, size_t nLength, uint64_t nOffset)
+{
+    Request *pRequest = new Request{pStream, buffer, nLength, 0, nOffset};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pStream->nInflight++;
+        m_vpPending.push_back(pRequest);
+    }
+    m_cvWork.notify_one();
+}
+
+void IoUringWriter::Drain(Stream *pStream)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvDone.wait(lock, [pStream] { return pStream->nInflight == 0; });
+}
+
+IoUringWriter::Stats IoUringWriter::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void IoUringWriter::Complete(Request *pRequest, int error)
+{
+    ReleaseBuffer(pRequest->buffer);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (error && !pRequest->pStream->error)
+        {
+            pRequest->pStream->error = error;
+        }
+        pRequest->pStream->nInflight--;
+        m_stats.nBytes += pRequest->nDone;
+        m_stats.nWrites++;
+    }
+    m_cvDone.notify_all();
+    delete pRequest;
+    m_nInflight--;
+}
+
+void IoUringWriter::Reap(bool bWait)
+{
+    struct io_uring_cqe *cqe = NULL;
+    if (bWait)
+    {
+        // Wake up periodically so that newly queued requests are not held
+        // back by a slow completion
+        struct __kernel_timespec ts = {0, 1000000};
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.nWaitCalls++;
+        }
+        if (io_uring_wait_cqe_timeout(&m_ring, &cqe, &ts) < 0)
+        {
+            return;
+        }
+    }
+    std::vector<Request*> vpRetry;
+    while (cqe || io_uring_peek_cqe(&m_ring, &cqe) == 0)
+    {
+        Request *pRequest = static_cast<Request*>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(&m_ring, cqe);
+        cqe = NULL;
+        if (res == -EAGAIN || res == -EINTR)
+        {
+            vpRetry.push_back(pRequest);
+            m_nInflight--;
+        }
+        else if (res < 0)
+        {
+            Complete(pRequest, -res);
+        }
+        else if (res == 0)
+        {
+            Complete(pRequest, EIO);
+        }
+        else if (pRequest->nDone + res < pRequest->nLength)
+        {
+            // Short write, queue the remainder
+            pRequest->nDone += res;
+            vpRetry.push_back(pRequest);
+            m_nInflight--;
+        }
+        else
+        {
+            pRequest->nDone += res;
+            Complete(pRequest, 0);
+        }
+    }
+    if (!vpRetry.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_vpPending.insert(m_vpPending.begin(), vpRetry.begin(), vpRetry.end());
+    }
+}
+
+void IoUringWriter::Run()
+{
+    std::vector<Request*> vpRequest;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_nInflight == 0)
+            {
+                m_cvWork.wait(lock, [this] { return m_bStop || !m_vpPending.empty(); });
+                if (m_vpPending.empty())
+                {
+                    break;
+                }
+            }
+            vpRequest.swap(m_vpPending);
+        }
+
+        // Everything queued by all streams since the last round goes out with
+        // a single io_uring_enter()
+        int nQueued = 0;
+        for (Request *pRequest : vpRequest)
+        {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+            while (!sqe)
+            {
+                // Submission queue full
+                io_uring_submit(&m_ring);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stats.nSubmitCalls++;
+                }
+                Reap(true);
+                sqe = io_uring_get_sqe(&m_ring);
+            }
+            const uint8_t *pData = pRequest->buffer.pData + pRequest->nDone;
+            unsigned nBytes = (unsigned)(pRequest->nLength - pRequest->nDone);
+            if (m_bRegistered && pRequest->buffer.iIndex >= 0)
+            {
+                io_uring_prep_write_fixed(sqe, pRequest->pStream->fd, pData, nBytes,
+                    pRequest->nOffset + pRequest->nDone, pRequest->buffer.iIndex);
+            }
+            else
+            {
+                io_uring_prep_write(sqe, pRequest->pStream->fd, pData, nBytes, pRequest->nOffset + pRequest->nDone);
+            }
+            io_uring_sqe_set_data(sqe, pRequest);
+            m_nInflight++;
+            nQueued++;
+        }
+        vpRequest.clear();
+        if (nQueued)
+        {
+            io_uring_submit(&m_ring);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.nSubmitCalls++;
+        }
+        Reap(nQueued == 0);
+    }
+}
+
+IoUringSink::IoUringSink(std::shared_ptr<IoUringWriter> pWriter, const char *szFilePath) : m_pWriter(pWriter)
+{
+    m_stream.fd = open(szFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_stream.fd < 0)
+    {
+        std::ostringstream err;
+        err << "Unable to open output file: " << szFilePath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+}
+
+IoUringSink::~IoUringSink()
+{
+    try
+    {
+        Close();
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << ex.what();
+    }
+}
+
+void IoUringSink::Write(const uint8_t *pData, size_t nSize)
+{
+    m_nBytesWritten += nSize;
+    while (nSize)
+    {
+        if (!m_buffer.pData)
+        {
+            m_buffer = m_pWriter->AcquireBuffer();
+        }
+        size_t nChunk = std::min(nSize, m_buffer.nSize - m_nBuffered);
+        memcpy(m_buffer.pData + m_nBuffered, pData, nChunk);
+        m_nBuffered += nChunk;
+        pData += nChunk;
+        nSize -= nChunk;
+        if (m_nBuffered == m_buffer.nSize)
+        {
+            Flush();
+        }
+    }
+}
+
+void IoUringSink::Flush()
+{
+    if (!m_nBuffered)
+    {
+        return;
+    }
+    m_pWriter->Submit(&m_stream, m_buffer, m_nBuffered, m_nOffset);
+    m_nOffset += m_nBuffered;
+    m_nBuffered = 0;
+    m_buffer = IoUringWriter::Buffer{};
+}
+
+void IoUringSink::Close()
+{
+    if (m_stream.fd < 0)
+    {
+        return;
+    }
+    Flush();
+    m_pWriter->Drain(&m_stream);
+    close(m_stream.fd);
+    m_stream.fd = -1;
+    if (m_stream.error)
+    {
+        std::ostringstream err;
+        err << "io_uring write failed: " << strerror(m_stream.error) << std::endl;
+        throw std::runtime_error(err.str());
+    }
+}
+
+#endif
@@ -0,0 +1,142 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <atomic>
+#include <thread>
+#include "OutputSink.h"
+
+/**
+*  @brief One io_uring instance shared by every IoUringSink of the process.
+*  Sinks fill buffers taken from a pool that is registered with the ring and
+*  hand them over with Submit(); a dedicated thread collects the requests of
+*  all streams, submits them in one io_uring_submit() call and reaps the
+*  completions. Encoder threads therefore do not wait for the disk. When the
+*  pool is exhausted a heap buffer is used instead so that Write() still
+*  does not block; those show up as nSpilledBuffers in the statistics. At
+*  most nMaxSpilled heap buffers exist at a time, beyond that AcquireBuffer()
+*  waits for a write to complete (nBufferWaits), so a disk that cannot keep
+*  up slows the encoders down instead of growing the heap without bound.
+*/
+class IoUringWriter
+{
+public:
+    struct Buffer
+    {
+        uint8_t *pData;
+        size_t nSize;
+        // Index of the registered buffer, -1 for a spilled heap buffer
+        int iIndex;
+    };
+
+    struct Stream
+    {
+        int fd = -1;
+        // Number of writes of this stream not yet completed
+        int nInflight = 0;
+        int error = 0;
+    };
+
+    struct Stats
+    {
+        uint64_t nBytes;
+        uint64_t nWrites;
+        uint64_t nSubmitCalls;
+        uint64_t nWaitCalls;
+        uint64_t nSpilledBuffers;
+        uint64_t nBufferWaits;
+    };
+
+    IoUringWriter(unsigned nQueueDepth = 256, unsigned nBuffers = 64, size_t nBufferSize = 1 << 20, unsigned nMaxSpilled = 64);
+    ~IoUringWriter();
+
+    /**
+    *  @brief Returns false if the kernel does not provide io_uring (or it is
+    *  disabled, e.g. by seccomp in containers). Probed once per process.
+    */
+    static bool IsAvailable();
+
+    /**
+    *  @brief Returns the writer shared by all "uring" sinks, creating it on first use.
+    */
+    static std::shared_ptr<IoUringWriter> GetShared();
+
+    Buffer AcquireBuffer();
+    void Submit(Stream *pStream, Buffer buffer, size_t nLength, uint64_t nOffset);
+    /**
+    *  @brief Blocks until every write of pStream has completed.
+    */
+    void Drain(Stream *pStream);
+    Stats GetStats();
+
+private:
+    struct Request
+    {
+        Stream *pStream;
+        Buffer buffer;
+        size_t nLength;
+        size_t nDone;
+        uint64_t nOffset;
+    };
+
+    void Run();
+    void Reap(bool bWait);
+    void Complete(Request *pRequest, int error);
+    void ReleaseBuffer(const Buffer &buffer);
+
+    struct io_uring m_ring;
+    uint8_t *m_pPool = NULL;
+    unsigned m_nBuffers = 0;
+    size_t m_nBufferSize = 0;
+    unsigned m_nMaxSpilled = 0;
+    // Heap buffers that exist now
+    unsigned m_nSpilled = 0;
+    bool m_bRegistered = true;
+    std::vector<int> m_viFreeBuffer;
+    std::vector<Request*> m_vpPending;
+    bool m_bStop = false;
+    // Touched by the I/O thread only
+    int m_nInflight = 0;
+    Stats m_stats = {};
+    std::mutex m_mutex;
+    std::condition_variable m_cvWork, m_cvDone, m_cvBufferFree;
+    std::thread m_thread;
+};
+
+/**
+*  @brief Output sink that writes through the shared IoUringWriter. Packets are
+*  copied into a registered buffer; full buffers are queued with their file
+*  offset and written asynchronously. Close() waits for the outstanding writes
+*  and reports the first error of the stream.
+*/
+class IoUringSink : public OutputSink
+{
+public:
+    IoUringSink(std::shared_ptr<IoUringWriter> pWriter, const char *szFilePath);
+    ~IoUringSink();
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Flush() override;
+    void Close() override;
+
+private:
+    std::shared_ptr<IoUringWriter> m_pWriter;
+    IoUringWriter::Stream m_stream;
+    IoUringWriter::Buffer m_buffer = {};
+    size_t m_nBuffered = 0;
+    uint64_t m_nOffset = 0;
+};
+
+#endif
@@ -0,0 +1,264 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "JobScheduler.h"
+
+static const char *aszJobClassName[JOB_CLASS_COUNT] = {"interactive", "normal", "batch"};
+
+JobClass ParseJobClass(const std::string &strClass)
+{
+    for (int i = 0; i < JOB_CLASS_COUNT; i++)
+    {
+        if (strClass == aszJobClassName[i])
+        {
+            return (JobClass)i;
+        }
+    }
+    std::ostringstream err;
+    err << "Unknown job class " << strClass << ", expected interactive, normal or batch" << std::endl;
+    throw std::invalid_argument(err.str());
+}
+
+const char *GetJobClassName(JobClass eClass)
+{
+    return aszJobClassName[eClass];
+}
+
+JobTicket::~JobTicket()
+{
+    m_pScheduler->Release(this);
+}
+
+JobScheduler::JobScheduler(int nGpu, int nSlotsPerGpu) : m_vnFreeSlots(nGpu, nSlotsPerGpu), m_vnYielding(nGpu, 0)
+{
+    if (nGpu < 1 || nSlotsPerGpu < 1)
+    {
+        throw std::invalid_argument("JobScheduler needs at least one GPU and one slot per GPU");
+    }
+}
+
+std::unique_ptr<JobTicket> JobScheduler::Submit(const JobRequest &request)
+{
+    if (request.iGpu < -1 || request.iGpu >= (int)m_vnFreeSlots.size())
+    {
+        throw std::invalid_argument("GPU ordinal out of range\n");
+    }
+    std::unique_ptr<JobTicket> pTicket(new JobTicket(this));
+    pTicket->m_request = request;
+    pTicket->m_tSubmit = std::chrono::steady_clock::now();
+    pTicket->m_tDeadline = pTicket->m_tSubmit + std::chrono::milliseconds(request.nDeadlineMs);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    pTicket->m_nSeq = m_nSeq++;
+    // A tenant that was idle starts level with the tenants that are queued
+    // instead of cashing in the share it did not use
+    bool bQueued = false;
+    double dMinUsage = -1;
+    for (JobTicket *pWaiting : m_lWaiting)
+    {
+        double dUsage = m_mTenantUsage[pWaiting->m_request.strTenant];
+        dMinUsage = dMinUsage < 0 ? dUsage : std::min(dMinUsage, dUsage);
+        bQueued = bQueued || pWaiting->m_request.strTenant == request.strTenant;
+    }
+    double &dUsage = m_mTenantUsage[request.strTenant];
+    if (!bQueued && dUsage < dMinUsage)
+    {
+        dUsage = dMinUsage;
+    }
+
+    Enqueue(pTicket.get(), lock);
+
+    ClassStats &stats = m_aStats[request.eClass];
+    pTicket->m_dWaitMs = std::chrono::duration<double, std::milli>(pTicket->m_tGranted - pTicket->m_tSubmit).count();
+    stats.nStarted++;
+    stats.dTotalWaitMs += pTicket->m_dWaitMs;
+    stats.dMaxWaitMs = std::max(stats.dMaxWaitMs, pTicket->m_dWaitMs);
+    return pTicket;
+}
+
+void JobScheduler::Enqueue(JobTicket *pTicket, std::unique_lock<std::mutex> &lock)
+{
+    m_lWaiting.push_back(pTicket);
+    Dispatch();
+    m_cvGranted.wait(lock, [pTicket] { return pTicket->m_iGpu >= 0; });
+}
+
+bool JobScheduler::IsBefore(const JobTicket *pA, const JobTicket *pB)
+{
+    const JobRequest &a = pA->m_request, &b = pB->m_request;
+    if (a.eClass != b.eClass)
+    {
+        return a.eClass < b.eClass;
+    }
+    if ((a.nDeadlineMs > 0) != (b.nDeadlineMs > 0))
+    {
+        return a.nDeadlineMs > 0;
+    }
+    if (a.nDeadlineMs > 0 && pA->m_tDeadline != pB->m_tDeadline)
+    {
+        return pA->m_tDeadline < pB->m_tDeadline;
+    }
+    double dUsageA = m_mTenantUsage[a.strTenant], dUsageB = m_mTenantUsage[b.strTenant];
+    if (dUsageA != dUsageB)
+    {
+        return dUsageA < dUsageB;
+    }
+    return pA->m_nSeq < pB->m_nSeq;
+}
+
+void JobScheduler::Dispatch()
+{
+    bool bGranted = false;
+    for (;;)
+    {
+        // Best waiting job that fits into a free slot; a job pinned to a busy
+        // GPU does not hold back jobs that can run elsewhere
+        auto itBest = m_lWaiting.end();
+        for (auto it = m_lWaiting.begin(); it != m_lWaiting.end(); ++it)
+        {
+            int iGpu = (*it)->m_request.iGpu;
+            bool bFits = iGpu >= 0 ? m_vnFreeSlots[iGpu] > 0
+                : *std::max_element(m_vnFreeSlots.begin(), m_vnFreeSlots.end()) > 0;
+            if (bFits && (itBest == m_lWaiting.end() || IsBefore(*it, *itBest)))
+            {
+                itBest = it;
+            }
+        }
+        if (itBest == m_lWaiting.end())
+        {
+            break;
+        }
+        JobTicket *pTicket = *itBest;
+        m_lWaiting.erase(itBest);
+        int iGpu = pTicket->m_request.iGpu;
+        if (iGpu < 0)
+        {
+            iGpu = (int)(std::max_element(m_vnFreeSlots.begin(), m_vnFreeSlots.end()) - m_vnFreeSlots.begin());
+        }
+        m_vnFreeSlots[iGpu]--;
+        pTicket->m_iGpu = iGpu;
+        pTicket->m_tGranted = std::chrono::steady_clock::now();
+        bGranted = true;
+    }
+    if (bGranted)
+    {
+        m_cvGranted.notify_all();
+    }
+}
+
+bool JobScheduler::ShouldYield(JobTicket &ticket)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (ticket.m_bYielding)
+    {
+        return true;
+    }
+    // A job that may run on any GPU needs one slot, not one on every GPU
+    int nHigherPinned = 0, nHigherAny = 0;
+    for (JobTicket *pWaiting : m_lWaiting)
+    {
+        if (pWaiting->m_request.eClass < ticket.m_request.eClass)
+        {
+            if (pWaiting->m_request.iGpu == ticket.m_iGpu)
+            {
+                nHigherPinned++;
+            }
+            else if (pWaiting->m_request.iGpu < 0)
+            {
+                nHigherAny++;
+            }
+        }
+    }
+    if (nHigherPinned > m_vnYielding[ticket.m_iGpu])
+    {
+        m_vnYielding[ticket.m_iGpu]++;
+        ticket.m_bYielding = true;
+    }
+    else if (nHigherAny > m_nYieldingForAny)
+    {
+        m_nYieldingForAny++;
+        ticket.m_bYielding = ticket.m_bYieldingForAny = true;
+    }
+    if (ticket.m_bYielding)
+    {
+        m_aStats[ticket.m_request.eClass].nPreempted++;
+    }
+    return ticket.m_bYielding;
+}
+
+void JobScheduler::Yield(JobTicket &ticket)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int iGpu = ticket.m_iGpu;
+    ReleaseSlot(&ticket);
+    // Resume on the same GPU, the job's frames and encoder state live there;
+    // the original sequence number keeps it ahead of later jobs of its class
+    JobRequest request = ticket.m_request;
+    ticket.m_request.iGpu = iGpu;
+    Enqueue(&ticket, lock);
+    ticket.m_request = request;
+}
+
+void JobScheduler::ReleaseSlot(JobTicket *pTicket)
+{
+    m_mTenantUsage[pTicket->m_request.strTenant] +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - pTicket->m_tGranted).count();
+    if (pTicket->m_bYieldingForAny)
+    {
+        m_nYieldingForAny--;
+    }
+    else if (pTicket->m_bYielding)
+    {
+        m_vnYielding[pTicket->m_iGpu]--;
+    }
+    pTicket->m_bYielding = pTicket->m_bYieldingForAny = false;
+    m_vnFreeSlots[pTicket->m_iGpu]++;
+    pTicket->m_iGpu = -1;
+    Dispatch();
+}
+
+void JobScheduler::Release(JobTicket *pTicket)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (pTicket->m_request.nDeadlineMs > 0 && std::chrono::steady_clock::now() > pTicket->m_tDeadline)
+    {
+        m_aStats[pTicket->m_request.eClass].nDeadlineMissed++;
+    }
+    ReleaseSlot(pTicket);
+}
+
+std::string JobScheduler::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int anQueued[JOB_CLASS_COUNT] = {};
+    for (JobTicket *pWaiting : m_lWaiting)
+    {
+        anQueued[pWaiting->m_request.eClass]++;
+    }
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1);
+    for (int i = 0; i < JOB_CLASS_COUNT; i++)
+    {
+        const ClassStats &stats = m_aStats[i];
+        oss << std::left << std::setw(12) << aszJobClassName[i] << std::right
+            << " queued " << anQueued[i]
+            << " started " << stats.nStarted
+            << " wait avg " << (stats.nStarted ? stats.dTotalWaitMs / stats.nStarted : 0.0) << " ms"
+            << " max " << stats.dMaxWaitMs << " ms"
+            << " preempted " << stats.nPreempted
+            << " deadline missed " << stats.nDeadlineMissed << std::endl;
+    }
+    return oss.str();
+}
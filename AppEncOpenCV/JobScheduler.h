@@ -0,0 +1,148 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Decides which encode job gets the next NVENC session. Every GPU has a
+*  fixed number of session slots; a job holds one slot while it encodes.
+*  When a slot frees up, the waiting job that runs next is picked by
+*      1. priority class (interactive before normal before batch),
+*      2. deadline, earliest first; jobs with a deadline go before jobs
+*         without one of the same class,
+*      3. fair share: the tenant that has used the fewest slot seconds,
+*      4. submission order.
+*  A running job of a lower class polls ShouldYield() at GOP boundaries and
+*  hands its slot to a waiting job of a higher class, so an interactive job
+*  waits for at most one GOP of a batch job (plus the encoder drain) when all
+*  slots are busy. The preempted job resumes on the same GPU with an IDR.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <string>
+#include <vector>
+
+enum JobClass
+{
+    JOB_CLASS_INTERACTIVE,
+    JOB_CLASS_NORMAL,
+    JOB_CLASS_BATCH,
+    JOB_CLASS_COUNT
+};
+
+/**
+*  @brief Parses "interactive", "normal" or "batch"; throws std::invalid_argument otherwise.
+*/
+JobClass ParseJobClass(const std::string &strClass);
+const char *GetJobClassName(JobClass eClass);
+
+struct JobRequest
+{
+    JobClass eClass = JOB_CLASS_NORMAL;
+    std::string strTenant;
+    // -1 for any GPU
+    int iGpu = -1;
+    // Relative to submission, 0 for none
+    int nDeadlineMs = 0;
+};
+
+class JobScheduler;
+
+/**
+*  @brief A granted session slot. The slot is released when the ticket is destroyed.
+*/
+class JobTicket
+{
+public:
+    ~JobTicket();
+
+    int GetGpu() const { return m_iGpu; }
+    /**
+    *  @brief Time the job spent in the queue before it was first granted a slot.
+    */
+    double GetWaitMs() const { return m_dWaitMs; }
+
+private:
+    friend class JobScheduler;
+    JobTicket(JobScheduler *pScheduler) : m_pScheduler(pScheduler) {}
+
+    JobScheduler *m_pScheduler;
+    JobRequest m_request;
+    uint64_t m_nSeq = 0;
+    int m_iGpu = -1;
+    bool m_bYielding = false;
+    // Yielding for a waiting job that may run on any GPU
+    bool m_bYieldingForAny = false;
+    double m_dWaitMs = 0;
+    std::chrono::steady_clock::time_point m_tSubmit, m_tDeadline, m_tGranted;
+};
+
+class JobScheduler
+{
+public:
+    JobScheduler(int nGpu, int nSlotsPerGpu);
+
+    /**
+    *  @brief Blocks until the job is granted a slot.
+    */
+    std::unique_ptr<JobTicket> Submit(const JobRequest &request);
+    /**
+    *  @brief True if a job of a higher class waits for a slot on the GPU of
+    *  ticket. The caller is then expected to finish the current GOP and call
+    *  Yield(); the decision is counted, so one waiting job preempts one
+    *  running job.
+    */
+    bool ShouldYield(JobTicket &ticket);
+    /**
+    *  @brief Gives the slot away and blocks until the job gets a slot on the
+    *  same GPU again.
+    */
+    void Yield(JobTicket &ticket);
+
+    /**
+    *  @brief Queue wait time, preemption and deadline statistics per class, one line per class.
+    */
+    std::string GetStats();
+
+private:
+    friend class JobTicket;
+    struct ClassStats
+    {
+        int nStarted = 0;
+        int nPreempted = 0;
+        int nDeadlineMissed = 0;
+        double dTotalWaitMs = 0, dMaxWaitMs = 0;
+    };
+
+    void Enqueue(JobTicket *pTicket, std::unique_lock<std::mutex> &lock);
+    void Dispatch();
+    bool IsBefore(const JobTicket *pA, const JobTicket *pB);
+    void ReleaseSlot(JobTicket *pTicket);
+    void Release(JobTicket *pTicket);
+
+    std::vector<int> m_vnFreeSlots;
+    // Jobs that decided to yield on each GPU for jobs pinned to it, and on
+    // any GPU for jobs that are not, but have not released their slot yet
+    std::vector<int> m_vnYielding;
+    int m_nYieldingForAny = 0;
+    std::list<JobTicket*> m_lWaiting;
+    // Slot seconds used per tenant
+    std::map<std::string, double> m_mTenantUsage;
+    ClassStats m_aStats[JOB_CLASS_COUNT];
+    uint64_t m_nSeq = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cvGranted;
+};
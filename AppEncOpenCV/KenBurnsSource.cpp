@@ -0,0 +1,462 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "KenBurnsSource.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cudawarping.hpp>
+
+KenBurnsView ParseKenBurnsView(const std::string &strView)
+{
+    KenBurnsView view;
+    char c;
+    if (3 != sscanf(strView.c_str(), "%lf,%lf,%lf%c", &view.x, &view.y, &view.fWidth, &c) || !(view.fWidth > 0))
+    {
+        std::ostringstream err;
+        err << "Invalid view " << strView << ", expected x,y,width as fractions of the image" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    return view;
+}
+
+#ifndef _WIN32
+/**
+*  @brief Binary PPM (P6) or PGM (P5) with 8 bit samples, memory mapped; a
+*  region is converted straight from the mapping, the page cache does the rest.
+*/
+class MappedPnmReader : public TileReader
+{
+public:
+    MappedPnmReader(const std::string &strPath)
+    {
+        int fd = open(strPath.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            std::ostringstream err;
+            err << "Unable to open " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        m_nMapped = (size_t)st.st_size;
+        void *p = m_nMapped ? mmap(NULL, m_nMapped, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            std::ostringstream err;
+            err << "Unable to map " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        m_pData = (const uchar *)p;
+
+        // Magic, width, height and maxval, separated by blanks and comments
+        int anField[4] = {}, iField = 0;
+        size_t i = 2;
+        if (m_nMapped > 2 && m_pData[0] == 'P' && (m_pData[1] == '5' || m_pData[1] == '6'))
+        {
+            m_nChannel = m_pData[1] == '6' ? 3 : 1;
+            for (iField = 1; iField < 4 && i < m_nMapped; )
+            {
+                if (m_pData[i] == '#')
+                {
+                    while (i < m_nMapped && m_pData[i] != '\n')
+                    {
+                        i++;
+                    }
+                }
+                else if (isdigit(m_pData[i]))
+                {
+                    for (; i < m_nMapped && isdigit(m_pData[i]); i++)
+                    {
+                        anField[iField] = anField[iField] * 10 + (m_pData[i] - '0');
+                    }
+                    iField++;
+                    continue;
+                }
+                i++;
+            }
+        }
+        // A single blank ends the header
+        m_nOffset = i + 1;
+        m_size = cv::Size(anField[1], anField[2]);
+        if (iField != 4 || anField[3] != 255 || m_size.area() <= 0
+            || m_nOffset + (size_t)m_size.area() * m_nChannel > m_nMapped)
+        {
+            munmap((void *)m_pData, m_nMapped);
+            std::ostringstream err;
+            err << strPath << " is not a binary PPM or PGM file with 8 bit samples" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+    }
+    ~MappedPnmReader()
+    {
+        munmap((void *)m_pData, m_nMapped);
+    }
+
+    cv::Size GetSize() const override { return m_size; }
+
+    void Read(cv::Rect rect, cv::Mat &rgba) override
+    {
+        size_t nPitch = (size_t)m_size.width * m_nChannel;
+        cv::Mat src(rect.height, rect.width, m_nChannel == 3 ? CV_8UC3 : CV_8UC1,
+            (void *)(m_pData + m_nOffset + rect.y * nPitch + rect.x * m_nChannel), nPitch);
+        cv::cvtColor(src, rgba, m_nChannel == 3 ? cv::COLOR_RGB2RGBA : cv::COLOR_GRAY2RGBA);
+    }
+
+private:
+    const uchar *m_pData = NULL;
+    size_t m_nMapped = 0, m_nOffset = 0;
+    int m_nChannel = 3;
+    cv::Size m_size;
+};
+#endif
+
+#ifdef HAVE_LIBTIFF
+/**
+*  @brief TIFF read by tile, or by strip for stripped files, through the RGBA
+*  interface of libtiff, so any photometric interpretation and compression
+*  libtiff knows works. libtiff maps the file for reading.
+*/
+class TiffReader : public TileReader
+{
+public:
+    TiffReader(const std::string &strPath)
+    {
+        m_pTiff = TIFFOpen(strPath.c_str(), "r");
+        if (!m_pTiff)
+        {
+            std::ostringstream err;
+            err << "Unable to open " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        uint32 nWidth = 0, nHeight = 0;
+        TIFFGetField(m_pTiff, TIFFTAG_IMAGEWIDTH, &nWidth);
+        TIFFGetField(m_pTiff, TIFFTAG_IMAGELENGTH, &nHeight);
+        m_size = cv::Size((int)nWidth, (int)nHeight);
+        uint32 nBlockWidth = nWidth, nBlockHeight = 0;
+        m_bTiled = TIFFIsTiled(m_pTiff) != 0;
+        if (m_bTiled)
+        {
+            TIFFGetField(m_pTiff, TIFFTAG_TILEWIDTH, &nBlockWidth);
+            TIFFGetField(m_pTiff, TIFFTAG_TILELENGTH, &nBlockHeight);
+        }
+        else
+        {
+            TIFFGetFieldDefaulted(m_pTiff, TIFFTAG_ROWSPERSTRIP, &nBlockHeight);
+            nBlockHeight = std::min(nBlockHeight, nHeight);
+        }
+        m_blockSize = cv::Size((int)nBlockWidth, (int)nBlockHeight);
+        if (m_size.area() <= 0 || m_blockSize.area() <= 0)
+        {
+            TIFFClose(m_pTiff);
+            std::ostringstream err;
+            err << "Invalid TIFF file " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        m_vRaster.resize((size_t)m_blockSize.area());
+    }
+    ~TiffReader()
+    {
+        TIFFClose(m_pTiff);
+    }
+
+    cv::Size GetSize() const override { return m_size; }
+
+    void Read(cv::Rect rect, cv::Mat &rgba) override
+    {
+        int bx0 = rect.x / m_blockSize.width, bx1 = (rect.x + rect.width - 1) / m_blockSize.width;
+        int by0 = rect.y / m_blockSize.height, by1 = (rect.y + rect.height - 1) / m_blockSize.height;
+        for (int by = by0; by <= by1; by++)
+        {
+            for (int bx = bx0; bx <= bx1; bx++)
+            {
+                cv::Rect block(bx * m_blockSize.width, by * m_blockSize.height, m_blockSize.width, m_blockSize.height);
+                block &= cv::Rect(cv::Point(0, 0), m_size);
+                int nRow = ReadBlock(block);
+                // The raster is bottom up: the rows of a tile fill it from the
+                // last row, those of a strip from row nRow - 1
+                cv::Rect overlap = block & rect;
+                for (int y = overlap.y; y < overlap.y + overlap.height; y++)
+                {
+                    const uint32 *pRow = &m_vRaster[(size_t)(nRow - 1 - (y - block.y)) * m_blockSize.width];
+                    memcpy(rgba.ptr<uint32>(y - rect.y) + (overlap.x - rect.x), pRow + (overlap.x - block.x),
+                        overlap.width * sizeof(uint32));
+                }
+            }
+        }
+    }
+
+private:
+    // Reads the tile or strip at block into m_vRaster unless it is already
+    // there; returns the number of raster rows its rows count back from
+    int ReadBlock(cv::Rect block)
+    {
+        int nRow = m_bTiled ? m_blockSize.height : block.height;
+        if (block.tl() == m_cached)
+        {
+            return nRow;
+        }
+        m_cached = cv::Point(-1, -1);
+        int ok = m_bTiled ? TIFFReadRGBATile(m_pTiff, block.x, block.y, m_vRaster.data())
+            : TIFFReadRGBAStrip(m_pTiff, block.y, m_vRaster.data());
+        if (!ok)
+        {
+            std::ostringstream err;
+            err << "Unable to read the TIFF " << (m_bTiled ? "tile" : "strip") << " at " << block.x << "," << block.y << std::endl;
+            throw std::runtime_error(err.str());
+        }
+        m_cached = block.tl();
+        return nRow;
+    }
+
+    TIFF *m_pTiff = NULL;
+    cv::Size m_size, m_blockSize;
+    bool m_bTiled = false;
+    // ABGR packed, R in the low byte: RGBA bytes in memory on little endian hosts
+    std::vector<uint32> m_vRaster;
+    cv::Point m_cached = cv::Point(-1, -1);
+};
+#endif
+
+/**
+*  @brief Any format cv::imread() knows, decoded into host memory once.
+*/
+class DecodedImageReader : public TileReader
+{
+public:
+    DecodedImageReader(const std::string &strPath)
+    {
+        m_image = cv::imread(strPath, cv::IMREAD_COLOR);
+        if (m_image.empty())
+        {
+            std::ostringstream err;
+            err << "Unable to read image " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+    }
+
+    cv::Size GetSize() const override { return m_image.size(); }
+
+    void Read(cv::Rect rect, cv::Mat &rgba) override
+    {
+        cv::cvtColor(m_image(rect), rgba, cv::COLOR_BGR2RGBA);
+    }
+
+private:
+    cv::Mat m_image;
+};
+
+std::unique_ptr<TileReader> OpenTileReader(const std::string &strPath)
+{
+    std::string strExtension;
+    size_t iDot = strPath.find_last_of('.');
+    if (iDot != std::string::npos)
+    {
+        strExtension = strPath.substr(iDot + 1);
+        std::transform(strExtension.begin(), strExtension.end(), strExtension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    }
+#ifndef _WIN32
+    if (strExtension == "ppm" || strExtension == "pgm" || strExtension == "pnm")
+    {
+        return std::unique_ptr<TileReader>(new MappedPnmReader(strPath));
+    }
+#endif
+#ifdef HAVE_LIBTIFF
+    if (strExtension == "tif" || strExtension == "tiff")
+    {
+        return std::unique_ptr<TileReader>(new TiffReader(strPath));
+    }
+#endif
+    return std::unique_ptr<TileReader>(new DecodedImageReader(strPath));
+}
+
+static int64_t GetTileKey(int iLevel, int tx, int ty)
+{
+    return ((int64_t)iLevel << 48) | ((int64_t)ty << 24) | tx;
+}
+
+KenBurnsSource::KenBurnsSource(const std::string &strPath, cv::Size outSize, int nFrame, KenBurnsView from, KenBurnsView to,
+    size_t nCacheBytes, int nTileSize)
+    : m_pReader(OpenTileReader(strPath)), m_outSize(outSize), m_nFrame(nFrame), m_from(from), m_to(to),
+    m_nTileSize(nTileSize), m_nCacheBytes(nCacheBytes)
+{
+    if (outSize.width <= 0 || outSize.height <= 0 || nFrame <= 0 || nTileSize <= 0)
+    {
+        throw std::invalid_argument("Invalid Ken Burns output size, frame count or tile size\n");
+    }
+    if (!(from.fWidth > 0 && to.fWidth > 0))
+    {
+        throw std::invalid_argument("Ken Burns views must have a positive width\n");
+    }
+    m_imageSize = m_pReader->GetSize();
+    if (m_imageSize.width >= (1 << 24) * nTileSize || m_imageSize.height >= (1 << 24) * nTileSize)
+    {
+        throw std::invalid_argument("Image too large for the tile cache\n");
+    }
+    m_vLevelSize.push_back(m_imageSize);
+    while (m_vLevelSize.back().width > nTileSize || m_vLevelSize.back().height > nTileSize)
+    {
+        cv::Size size = m_vLevelSize.back();
+        m_vLevelSize.push_back(cv::Size((size.width + 1) / 2, (size.height + 1) / 2));
+    }
+    m_host = cv::cuda::HostMem(nTileSize, nTileSize, CV_8UC4);
+    m_vCompose.resize(m_vLevelSize.size());
+}
+
+cv::Rect KenBurnsSource::GetTileRect(int iLevel, int tx, int ty) const
+{
+    return cv::Rect(tx * m_nTileSize, ty * m_nTileSize, m_nTileSize, m_nTileSize)
+        & cv::Rect(cv::Point(0, 0), m_vLevelSize[iLevel]);
+}
+
+cv::cuda::GpuMat KenBurnsSource::GetTile(int iLevel, int tx, int ty, cv::cuda::Stream &stream)
+{
+    int64_t nKey = GetTileKey(iLevel, tx, ty);
+    auto it = m_mTile.find(nKey);
+    if (it != m_mTile.end())
+    {
+        m_lTile.splice(m_lTile.begin(), m_lTile, it->second);
+        m_nHit++;
+        return it->second->second;
+    }
+
+    cv::Rect rect = GetTileRect(iLevel, tx, ty);
+    cv::cuda::GpuMat tile(rect.size(), CV_8UC4);
+    if (!iLevel)
+    {
+        cv::Mat host = m_host.createMatHeader()(cv::Rect(cv::Point(0, 0), rect.size()));
+        m_pReader->Read(rect, host);
+        tile.upload(host, stream);
+        // m_host is reused by the next tile
+        stream.waitForCompletion();
+        m_nRead++;
+    }
+    else
+    {
+        // The up to four tiles of the level above covering this one
+        cv::Rect finer = cv::Rect(rect.x * 2, rect.y * 2, rect.width * 2, rect.height * 2)
+            & cv::Rect(cv::Point(0, 0), m_vLevelSize[iLevel - 1]);
+        cv::cuda::GpuMat &compose = m_vCompose[iLevel];
+        compose.create(2 * m_nTileSize, 2 * m_nTileSize, CV_8UC4);
+        for (int j = 0; j < 2; j++)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                cv::Rect child = GetTileRect(iLevel - 1, 2 * tx + i, 2 * ty + j);
+                if (child.area() <= 0)
+                {
+                    continue;
+                }
+                cv::cuda::GpuMat roi = compose(cv::Rect(i * m_nTileSize, j * m_nTileSize, child.width, child.height));
+                GetTile(iLevel - 1, 2 * tx + i, 2 * ty + j, stream).copyTo(roi, stream);
+            }
+        }
+        cv::cuda::resize(compose(cv::Rect(cv::Point(0, 0), finer.size())), tile, rect.size(), 0, 0, cv::INTER_AREA, stream);
+        m_nBuild++;
+    }
+
+    m_lTile.emplace_front(nKey, tile);
+    m_mTile[nKey] = m_lTile.begin();
+    m_nCachedBytes += tile.step * tile.rows;
+    // Tiles in use stay alive through their GpuMat references
+    while (m_nCachedBytes > m_nCacheBytes && m_lTile.size() > 1)
+    {
+        cv::cuda::GpuMat &last = m_lTile.back().second;
+        m_nCachedBytes -= last.step * last.rows;
+        m_mTile.erase(m_lTile.back().first);
+        m_lTile.pop_back();
+    }
+    return tile;
+}
+
+bool KenBurnsSource::RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream)
+{
+    if (m_iFrame >= m_nFrame)
+    {
+        return false;
+    }
+    if (dst.size() != m_outSize)
+    {
+        std::ostringstream err;
+        err << "Ken Burns output of " << m_outSize.width << "x" << m_outSize.height << " rendered into a frame of "
+            << dst.cols << "x" << dst.rows << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+
+    // Smoothstep from rest to rest
+    double t = m_nFrame > 1 ? (double)m_iFrame / (m_nFrame - 1) : 0;
+    t = t * t * (3 - 2 * t);
+    double fWidth = m_from.fWidth * std::pow(m_to.fWidth / m_from.fWidth, t);
+    double w = fWidth * m_imageSize.width, h = w * m_outSize.height / m_outSize.width;
+    double x = (m_from.x + (m_to.x - m_from.x) * t) * m_imageSize.width - w / 2;
+    double y = (m_from.y + (m_to.y - m_from.y) * t) * m_imageSize.height - h / 2;
+
+    // The finest level at most twice the output resolution
+    double fScale = w / m_outSize.width;
+    int iLevel = std::min(std::max((int)std::floor(std::log2(fScale)), 0), (int)m_vLevelSize.size() - 1);
+    double fLevel = (double)(1 << iLevel);
+    x /= fLevel;
+    y /= fLevel;
+    fScale /= fLevel;
+
+    // Tiles under the view, clipped to the image
+    cv::Size levelSize = m_vLevelSize[iLevel];
+    int nTileX = (levelSize.width + m_nTileSize - 1) / m_nTileSize, nTileY = (levelSize.height + m_nTileSize - 1) / m_nTileSize;
+    int tx0 = std::max((int)std::floor(x / m_nTileSize), 0), tx1 = std::min((int)std::floor((x + w / fLevel) / m_nTileSize), nTileX - 1);
+    int ty0 = std::max((int)std::floor(y / m_nTileSize), 0), ty1 = std::min((int)std::floor((y + h / fLevel) / m_nTileSize), nTileY - 1);
+    if (tx0 > tx1 || ty0 > ty1)
+    {
+        dst.setTo(cv::Scalar::all(0), stream);
+    }
+    else
+    {
+        cv::Rect mosaicRect = (cv::Rect(tx0 * m_nTileSize, ty0 * m_nTileSize, (tx1 - tx0 + 1) * m_nTileSize, (ty1 - ty0 + 1) * m_nTileSize))
+            & cv::Rect(cv::Point(0, 0), levelSize);
+        m_mosaic.create(mosaicRect.size(), CV_8UC4);
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                cv::Rect rect = GetTileRect(iLevel, tx, ty);
+                cv::cuda::GpuMat roi = m_mosaic(rect - mosaicRect.tl());
+                GetTile(iLevel, tx, ty, stream).copyTo(roi, stream);
+            }
+        }
+        // Maps output pixel centers into the mosaic; outside it is black
+        double ox = x - mosaicRect.x, oy = y - mosaicRect.y;
+        cv::Mat m = (cv::Mat_<double>(2, 3) << fScale, 0, ox + 0.5 * fScale - 0.5, 0, fScale, oy + 0.5 * fScale - 0.5);
+        cv::cuda::warpAffine(m_mosaic, dst, m, m_outSize, cv::INTER_LINEAR | cv::WARP_INVERSE_MAP,
+            cv::BORDER_CONSTANT, cv::Scalar::all(0), stream);
+    }
+    m_iFrame++;
+    return true;
+}
@@ -0,0 +1,121 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "FrameSource.h"
+
+/**
+*  @brief Camera position over an image: the center, as fractions of the
+*  image width and height, and the width of the view as a fraction of the
+*  image width. The view height follows from the output aspect ratio.
+*/
+struct KenBurnsView
+{
+    double x = 0.5, y = 0.5;
+    double fWidth = 1;
+};
+
+/**
+*  @brief Parses "x,y,width"; throws std::invalid_argument otherwise.
+*/
+KenBurnsView ParseKenBurnsView(const std::string &strView);
+
+/**
+*  @brief Reads regions of a large image, at full resolution, as RGBA.
+*/
+class TileReader
+{
+public:
+    virtual ~TileReader() {}
+    virtual cv::Size GetSize() const = 0;
+    /**
+    *  @brief Writes the pixels of rect into rgba, allocated by the caller
+    *  with the size of rect (CV_8UC4).
+    */
+    virtual void Read(cv::Rect rect, cv::Mat &rgba) = 0;
+};
+
+/**
+*  @brief Opens strPath for reading by tiles. Binary PPM/PGM files are memory
+*  mapped, TIFF files (with libtiff, HAVE_LIBTIFF) read by TIFF tile or strip;
+*  only these keep host memory bounded. Other formats are decoded into host
+*  memory once, with the pixel limit of cv::imread().
+*/
+std::unique_ptr<TileReader> OpenTileReader(const std::string &strPath);
+
+/**
+*  @brief Renders a pan/zoom camera path from view `from` to view `to` over a
+*  large image into nFrame frames of outSize, the Ken Burns effect.
+*
+*  The image is never loaded whole. It is cut into square tiles of nTileSize
+*  at full resolution and at every power of two below, and each frame is drawn
+*  with cv::cuda::warpAffine() from the tiles of the level whose resolution is
+*  closest above the output one. Tiles are read from disk or built from the
+*  four tiles of the level above when a frame first needs them, and kept in a
+*  least recently used GPU cache of nCacheBytes, so GPU memory is bounded by
+*  the cache and the tiles of one frame whatever the image size. The first
+*  frames of a zoomed out view read the whole image once.
+*
+*  The camera moves with ease in and ease out; the view width changes
+*  geometrically, so the zoom speed looks constant. Parts of a view outside
+*  the image are black.
+*/
+class KenBurnsSource : public FrameSource
+{
+public:
+    KenBurnsSource(const std::string &strPath, cv::Size outSize, int nFrame, KenBurnsView from, KenBurnsView to,
+        size_t nCacheBytes = 256 << 20, int nTileSize = 512);
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override { return false; }
+    bool IsRenderer() const override { return true; }
+    bool RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) override;
+
+    cv::Size GetImageSize() const { return m_imageSize; }
+    /**
+    *  @brief Tiles read from disk, built from finer tiles, and found in the cache.
+    */
+    int GetReadCount() const { return m_nRead; }
+    int GetBuildCount() const { return m_nBuild; }
+    int GetHitCount() const { return m_nHit; }
+
+private:
+    // Tile tx, ty of level iLevel, from the cache or made
+    cv::cuda::GpuMat GetTile(int iLevel, int tx, int ty, cv::cuda::Stream &stream);
+    cv::Rect GetTileRect(int iLevel, int tx, int ty) const;
+
+    std::unique_ptr<TileReader> m_pReader;
+    cv::Size m_imageSize, m_outSize;
+    int m_nFrame, m_iFrame = 0;
+    KenBurnsView m_from, m_to;
+    int m_nTileSize;
+    // Size of every level, halved from the full resolution down to one tile
+    std::vector<cv::Size> m_vLevelSize;
+
+    // Most recently used first, with an index by level and position
+    std::list<std::pair<int64_t, cv::cuda::GpuMat>> m_lTile;
+    std::map<int64_t, std::list<std::pair<int64_t, cv::cuda::GpuMat>>::iterator> m_mTile;
+    size_t m_nCacheBytes, m_nCachedBytes = 0;
+    int m_nRead = 0, m_nBuild = 0, m_nHit = 0;
+
+    // Pinned staging of full resolution tiles, one per level for building
+    // tiles from the level above, and the tiles of the current frame
+    cv::cuda::HostMem m_host;
+    std::vector<cv::cuda::GpuMat> m_vCompose;
+    cv::cuda::GpuMat m_mosaic;
+};
@@ -0,0 +1,136 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "LayerFanoutSink.h"
+
+double GetCpuSeconds(bool bProcess)
+{
+#ifdef _WIN32
+    FILETIME ftCreation, ftExit, ftKernel, ftUser;
+    BOOL bOk = bProcess ? GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser)
+        : GetThreadTimes(GetCurrentThread(), &ftCreation, &ftExit, &ftKernel, &ftUser);
+    if (!bOk)
+    {
+        return 0;
+    }
+    // In units of 100 ns
+    return ((((uint64_t)ftKernel.dwHighDateTime << 32) | ftKernel.dwLowDateTime)
+        + (((uint64_t)ftUser.dwHighDateTime << 32) | ftUser.dwLowDateTime)) * 1e-7;
+#else
+    timespec ts;
+    if (clock_gettime(bProcess ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID, &ts))
+    {
+        return 0;
+    }
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+int GetTemporalId(const uint8_t *pPacket, size_t nSize, bool bHevc)
+{
+    for (size_t i = 0; i + 3 < nSize; i++)
+    {
+        if (pPacket[i] || pPacket[i + 1] || pPacket[i + 2] != 1)
+        {
+            continue;
+        }
+        const uint8_t *pNal = pPacket + i + 3;
+        size_t nLeft = nSize - i - 3;
+        if (bHevc)
+        {
+            int nType = (pNal[0] >> 1) & 0x3F;
+            if (nType < 32)
+            {
+                // VCL NAL unit
+                return nLeft >= 2 ? std::max((pNal[1] & 7) - 1, 0) : 0;
+            }
+        }
+        else
+        {
+            int nType = pNal[0] & 0x1F;
+            if (nType == 14 || nType == 20)
+            {
+                // temporal_id is the top 3 bits of the last byte of the SVC extension
+                return nLeft >= 4 ? pNal[3] >> 5 : 0;
+            }
+            if (nType == 1 || nType == 5)
+            {
+                return 0;
+            }
+        }
+        i += 2;
+    }
+    return 0;
+}
+
+int LayerFanoutSink::AddOutput(OutputSink *pSink, int nMaxLayer)
+{
+    m_vOutput.push_back(Output{pSink, nMaxLayer, 0});
+    return (int)m_vOutput.size() - 1;
+}
+
+void LayerFanoutSink::SetMaxLayer(int iOutput, int nMaxLayer)
+{
+    m_vOutput.at(iOutput).nMaxLayer = nMaxLayer;
+}
+
+void LayerFanoutSink::Write(const uint8_t *pData, size_t nSize)
+{
+    WritePacket(pData, nSize, 0);
+}
+
+void LayerFanoutSink::WritePacket(const uint8_t *pData, size_t nSize, int nTemporalId)
+{
+    double fStart = GetCpuSeconds();
+    for (Output &output : m_vOutput)
+    {
+        if (output.nMaxLayer >= 0 && nTemporalId > output.nMaxLayer)
+        {
+            output.nDrop++;
+            continue;
+        }
+        output.pSink->Write(pData, nSize);
+    }
+    m_nBytesWritten += nSize;
+    m_fCpuSeconds += GetCpuSeconds() - fStart;
+}
+
+void LayerFanoutSink::Flush()
+{
+    for (Output &output : m_vOutput)
+    {
+        output.pSink->Flush();
+    }
+}
+
+void LayerFanoutSink::Close()
+{
+    for (Output &output : m_vOutput)
+    {
+        output.pSink->Close();
+    }
+}
+
+size_t LayerFanoutSink::GetQueuedBytes()
+{
+    size_t nQueued = 0;
+    for (Output &output : m_vOutput)
+    {
+        nQueued = std::max(nQueued, output.pSink->GetQueuedBytes());
+    }
+    return nQueued;
+}
@@ -0,0 +1,77 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "OutputSink.h"
+
+/**
+*  @brief Temporal layer of an Annex B packet: nuh_temporal_id_plus1 - 1 of
+*  its first slice for HEVC, temporal_id of its SVC prefix NAL unit for
+*  H.264. Packets without either are of the base layer, 0.
+*/
+int GetTemporalId(const uint8_t *pPacket, size_t nSize, bool bHevc);
+
+/**
+*  @brief CPU seconds used so far by the calling thread, or by every thread
+*  of the process with bProcess; for comparing the fan-out with encodes.
+*/
+double GetCpuSeconds(bool bProcess = false);
+
+/**
+*  @brief Sends one temporally layered stream to several outputs, each with
+*  the layers it can take: a slow client gets the base layer only, at a
+*  fraction of the frame rate, with no re-encode. Packets written without a
+*  layer go to every output. The outputs are not owned.
+*/
+class LayerFanoutSink : public OutputSink
+{
+public:
+    /**
+    *  @brief Adds an output for the layers up to nMaxLayer, all if negative,
+    *  and returns its index.
+    */
+    int AddOutput(OutputSink *pSink, int nMaxLayer = -1);
+    /**
+    *  @brief Changes the layers of output iOutput, e.g. for a client that
+    *  falls behind. Takes effect with the next packet.
+    */
+    void SetMaxLayer(int iOutput, int nMaxLayer);
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void WritePacket(const uint8_t *pData, size_t nSize, int nTemporalId) override;
+    void Flush() override;
+    void Close() override;
+    /**
+    *  @brief Of the output furthest behind, the one a bitrate adapted to the
+    *  stream has to suit.
+    */
+    size_t GetQueuedBytes() override;
+
+    long long GetDropCount(int iOutput) const { return m_vOutput[iOutput].nDrop; }
+    /**
+    *  @brief CPU seconds spent passing packets on, dropping included; all
+    *  the fan-out costs on top of the single encode.
+    */
+    double GetFanoutCpuTime() const { return m_fCpuSeconds; }
+
+private:
+    struct Output
+    {
+        OutputSink *pSink;
+        int nMaxLayer;
+        long long nDrop;
+    };
+    std::vector<Output> m_vOutput;
+    double m_fCpuSeconds = 0;
+};
@@ -0,0 +1,125 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <stdexcept>
+#include "LtrController.h"
+
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudawarping.hpp>
+
+// Block means that differ by more than noise does
+static const double fBlockThreshold = 3;
+
+template<class CodecPicParams>
+static void SetLtrFields(CodecPicParams &params, int iMark, int iUse)
+{
+    if (iMark >= 0)
+    {
+        params.ltrMarkFrame = 1;
+        params.ltrMarkFrameIdx = iMark;
+    }
+    if (iUse >= 0)
+    {
+        params.ltrUseFrames = 1;
+        params.ltrUseFrameBitmap = 1u << iUse;
+    }
+}
+
+LtrController::LtrController(double fStaticRatio, int nSettle) : m_fStaticRatio(fStaticRatio), m_nSettle(nSettle)
+{
+    if (fStaticRatio < 0 || fStaticRatio > 1 || nSettle < 1)
+    {
+        throw std::invalid_argument("Invalid long-term reference settings\n");
+    }
+}
+
+double LtrController::ChangedRatio(const cv::cuda::GpuMat &thumbnail, const cv::cuda::GpuMat &reference, cv::cuda::Stream &stream)
+{
+    cv::cuda::absdiff(thumbnail, reference, m_diff, stream);
+    cv::cuda::threshold(m_diff, m_diff, fBlockThreshold, 1, cv::THRESH_BINARY, stream);
+    cv::cuda::calcSum(m_diff, m_sum, cv::cuda::GpuMat(), stream);
+    m_sum.download(m_hostSum, stream);
+    stream.waitForCompletion();
+    return cv::sum(m_hostSum)[0] / thumbnail.size().area();
+}
+
+void LtrController::Measure(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream)
+{
+    if (frame.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Long-term reference control needs RGBA frames\n");
+    }
+    cv::Size blockSize((frame.cols + 15) / 16, (frame.rows + 15) / 16);
+    cv::cuda::resize(frame, m_blocks, blockSize, 0, 0, cv::INTER_AREA, stream);
+    cv::cuda::GpuMat &gray = m_gray[m_iGray];
+    cv::cuda::cvtColor(m_blocks, gray, cv::COLOR_RGBA2GRAY, 0, stream);
+
+    const cv::cuda::GpuMat &previous = m_gray[1 - m_iGray];
+    // Another size is a new stream, coded as IDR
+    bool bComparable = m_bPrevious && previous.size() == blockSize;
+    m_fToPrevious = bComparable ? ChangedRatio(gray, previous, stream) : 1;
+    m_fToLtr = bComparable && m_iLtr >= 0 ? ChangedRatio(gray, m_ltrGray[m_iLtr], stream) : 1;
+    if (!bComparable)
+    {
+        m_iLtr = -1;
+        stream.waitForCompletion();
+    }
+    m_bPrevious = true;
+}
+
+void LtrController::SetPicParams(bool bIdr, bool bHevc, NV_ENC_PIC_PARAMS &picParams)
+{
+    const cv::cuda::GpuMat &gray = m_gray[m_iGray];
+    m_iGray = 1 - m_iGray;
+    m_nFrame++;
+
+    int iMark = -1, iUse = -1;
+    if (bIdr || m_iLtr < 0)
+    {
+        // The long-term references are gone, the first one is this frame
+        iMark = 0;
+        m_nStill = 0;
+    }
+    else if (m_fToLtr <= m_fStaticRatio)
+    {
+        iUse = m_iLtr;
+        m_nStill = 0;
+    }
+    else
+    {
+        m_nStill = m_fToPrevious <= m_fStaticRatio ? m_nStill + 1 : 0;
+        if (m_nStill >= m_nSettle)
+        {
+            // Still again on something else, it becomes the background
+            iMark = 1 - m_iLtr;
+            m_nStill = 0;
+        }
+    }
+    if (iMark >= 0)
+    {
+        gray.copyTo(m_ltrGray[iMark]);
+        m_iLtr = iMark;
+        m_nMark++;
+    }
+    if (iUse >= 0)
+    {
+        m_nUse++;
+    }
+    if (bHevc)
+    {
+        SetLtrFields(picParams.codecPicParams.hevcPicParams, iMark, iUse);
+    }
+    else
+    {
+        SetLtrFields(picParams.codecPicParams.h264PicParams, iMark, iUse);
+    }
+}
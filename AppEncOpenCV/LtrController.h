@@ -0,0 +1,74 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include "NvEncoder/NvEncoderCuda.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief Marks clean backgrounds as long-term reference frames and has the
+*  frames that still show them predicted from them, for mostly static content
+*  (lectures, surveillance, a repeated still): a speaker walking in front of
+*  the background and away again costs next to nothing once they are gone.
+*
+*  Frames are compared as 16x16 block means of their luma, on the GPU, with
+*  the frame before and with the current long-term reference. While few
+*  blocks differ from the reference, the frame uses it. Once the reference no
+*  longer matches but the content has been still for a while, the current
+*  frame replaces it, in the other of two slots. An IDR flushes the long-term
+*  references, the IDR frame becomes the first.
+*/
+class LtrController
+{
+public:
+    /**
+    *  @brief fStaticRatio is the share of changed blocks up to which a frame
+    *  counts as showing the reference or as still; a new reference is marked
+    *  after nSettle still frames.
+    */
+    LtrController(double fStaticRatio = 0.1, int nSettle = 15);
+
+    /**
+    *  @brief Compares frame (RGBA), the next to be encoded, on stream. Waits
+    *  for stream.
+    */
+    void Measure(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream);
+    /**
+    *  @brief Sets the long-term reference fields of picParams for the frame
+    *  measured last. bIdr if it is coded as IDR.
+    */
+    void SetPicParams(bool bIdr, bool bHevc, NV_ENC_PIC_PARAMS &picParams);
+
+    long long GetFrameCount() const { return m_nFrame; }
+    long long GetMarkCount() const { return m_nMark; }
+    long long GetUseCount() const { return m_nUse; }
+
+private:
+    // Share of the blocks of thumbnail that differ from reference
+    double ChangedRatio(const cv::cuda::GpuMat &thumbnail, const cv::cuda::GpuMat &reference, cv::cuda::Stream &stream);
+
+    double m_fStaticRatio;
+    int m_nSettle;
+
+    cv::cuda::GpuMat m_blocks, m_gray[2], m_ltrGray[2], m_diff, m_sum;
+    cv::Mat m_hostSum;
+    int m_iGray = 0;
+    bool m_bPrevious = false;
+    // Slot of the reference in use, -1 for none
+    int m_iLtr = -1;
+    double m_fToPrevious = 1, m_fToLtr = 1;
+    int m_nStill = 0;
+
+    long long m_nFrame = 0, m_nMark = 0, m_nUse = 0;
+};
@@ -0,0 +1,281 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "MosaicSource.h"
+#include "ImageDecoder.h"
+#include "VideoFrameSource.h"
+
+#include <opencv2/cudawarping.hpp>
+
+std::vector<MosaicFeed> ReadMosaicFeeds(const std::string &strPath)
+{
+    std::ifstream fList(strPath);
+    if (!fList)
+    {
+        std::ostringstream err;
+        err << "Unable to open feed list " << strPath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    std::vector<MosaicFeed> vFeed;
+    std::string strLine;
+    for (int iLine = 1; std::getline(fList, strLine); iLine++)
+    {
+        strLine.erase(strLine.find_last_not_of(" \t\r\n") + 1);
+        if (strLine.empty() || strLine[0] == '#')
+        {
+            continue;
+        }
+        MosaicFeed feed;
+        size_t iTab = strLine.find('\t');
+        feed.strPath = strLine.substr(0, iTab);
+        if (iTab != std::string::npos && (feed.nInterval = atoi(strLine.c_str() + iTab + 1)) <= 0)
+        {
+            std::ostringstream err;
+            err << strPath << ":" << iLine << ": invalid frame interval" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        vFeed.push_back(feed);
+    }
+    if (vFeed.empty())
+    {
+        std::ostringstream err;
+        err << "No feeds in " << strPath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    return vFeed;
+}
+
+// Largest even sized rectangle of the aspect ratio of size, centered in cell
+static cv::Rect FitInto(cv::Size size, cv::Rect cell)
+{
+    double fScale = std::min((double)cell.width / size.width, (double)cell.height / size.height);
+    int nWidth = std::max(std::min((int)std::lround(size.width * fScale) & ~1, cell.width), 2);
+    int nHeight = std::max(std::min((int)std::lround(size.height * fScale) & ~1, cell.height), 2);
+    return cv::Rect(cell.x + ((cell.width - nWidth) / 2 & ~1), cell.y + ((cell.height - nHeight) / 2 & ~1), nWidth, nHeight);
+}
+
+MosaicSource::MosaicSource(const std::vector<MosaicFeed> &vFeed, cv::Size outSize, int nCol, int nThread)
+    : m_outSize(outSize)
+{
+    int nFeed = (int)vFeed.size();
+    if (!nFeed)
+    {
+        throw std::invalid_argument("Mosaic has no feeds\n");
+    }
+    if (outSize.width <= 0 || outSize.height <= 0 || outSize.width % 2 || outSize.height % 2)
+    {
+        std::ostringstream err;
+        err << "Invalid mosaic size " << outSize.width << "x" << outSize.height << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    if (nCol <= 0)
+    {
+        nCol = (int)std::ceil(std::sqrt((double)nFeed));
+    }
+    nCol = std::min(nCol, nFeed);
+    int nRow = (nFeed + nCol - 1) / nCol;
+    if (outSize.width / nCol < 2 || outSize.height / nRow < 2)
+    {
+        throw std::invalid_argument("Too many feeds for the mosaic size\n");
+    }
+
+    m_iDevice = cv::cuda::getDevice();
+    ImageDecoder decoder(1);
+    m_vCell.resize(nFeed);
+    for (int i = 0; i < nFeed; i++)
+    {
+        Cell &cell = m_vCell[i];
+        int c = i % nCol, r = i / nCol;
+        int x0 = (c * outSize.width / nCol) & ~1, x1 = ((c + 1) * outSize.width / nCol) & ~1;
+        int y0 = (r * outSize.height / nRow) & ~1, y1 = ((r + 1) * outSize.height / nRow) & ~1;
+        cell.rect = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+        cell.fit = cell.rect;
+        cell.nInterval = vFeed[i].nInterval;
+        if (VideoFrameSource::IsVideoFile(vFeed[i].strPath))
+        {
+            cell.pSource.reset(new VideoFrameSource(vFeed[i].strPath));
+        }
+        else
+        {
+            // Shown once, the cell then stays as it is
+            cell.pSource.reset(new StillFrameSource(decoder.Decode(vFeed[i].strPath), 1));
+        }
+    }
+    m_vLastGeneration.assign(nFeed, 0);
+
+    if (nThread <= 0)
+    {
+        nThread = (int)std::max(1u, std::min(std::thread::hardware_concurrency(), 8u));
+    }
+    nThread = std::min(nThread, nFeed);
+    for (int i = 0; i < nThread; i++)
+    {
+        m_vThread.emplace_back(&MosaicSource::FetchWorker, this, i);
+    }
+}
+
+MosaicSource::~MosaicSource()
+{
+    Stop();
+}
+
+void MosaicSource::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+        m_cvFetch.notify_all();
+    }
+    for (std::thread &thread : m_vThread)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+}
+
+void MosaicSource::FetchWorker(int iThread)
+{
+    bool bDevice = false;
+    long long nRound = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cvFetch.wait(lock, [this, nRound] { return m_bStop || m_nRound > nRound; });
+            if (m_bStop)
+            {
+                return;
+            }
+            nRound = m_nRound;
+        }
+        try
+        {
+            if (!bDevice)
+            {
+                cv::cuda::setDevice(m_iDevice);
+                bDevice = true;
+            }
+            for (size_t i = iThread; i < m_vCell.size(); i += m_vThread.size())
+            {
+                Cell &cell = m_vCell[i];
+                if (cell.bEnded || m_iFrame % cell.nInterval)
+                {
+                    continue;
+                }
+                if (cell.pSource->GetNextFrame(cell.frame))
+                {
+                    cell.nGeneration++;
+                }
+                else
+                {
+                    cell.bEnded = true;
+                }
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pError = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!--m_nBusy)
+        {
+            m_cvDone.notify_all();
+        }
+    }
+}
+
+void MosaicSource::FetchFrames()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_nBusy = (int)m_vThread.size();
+    m_nRound++;
+    m_cvFetch.notify_all();
+    m_cvDone.wait(lock, [this] { return !m_nBusy; });
+    if (m_pError)
+    {
+        std::rethrow_exception(m_pError);
+    }
+}
+
+bool MosaicSource::RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream)
+{
+    if (dst.size() != m_outSize)
+    {
+        std::ostringstream err;
+        err << "Mosaic of " << m_outSize.width << "x" << m_outSize.height << " rendered into a frame of "
+            << dst.cols << "x" << dst.rows << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    FetchFrames();
+    if (std::all_of(m_vCell.begin(), m_vCell.end(), [](const Cell &cell) { return cell.bEnded; }))
+    {
+        return false;
+    }
+
+    BufferState &buffer = m_mBuffer[dst.data];
+    if (buffer.vGeneration.empty())
+    {
+        // First use of this input buffer, the space between cells is black
+        dst.setTo(cv::Scalar::all(0), stream);
+        buffer.vGeneration.assign(m_vCell.size(), 0);
+        buffer.vFitChange.assign(m_vCell.size(), 0);
+    }
+    m_vChanged.clear();
+    for (size_t i = 0; i < m_vCell.size(); i++)
+    {
+        Cell &cell = m_vCell[i];
+        if (cell.nGeneration != m_vLastGeneration[i])
+        {
+            m_vLastGeneration[i] = cell.nGeneration;
+            cv::Rect fit = FitInto(cell.frame.size(), cell.rect);
+            if (fit != cell.fit)
+            {
+                cell.fit = fit;
+                cell.nFitChange++;
+            }
+            m_vChanged.push_back(cell.rect);
+        }
+        if (buffer.vGeneration[i] == cell.nGeneration && buffer.vFitChange[i] == cell.nFitChange)
+        {
+            m_nSkip++;
+            continue;
+        }
+        if (buffer.vFitChange[i] != cell.nFitChange)
+        {
+            // Bars of a frame of another aspect ratio
+            cv::cuda::GpuMat cellRoi = dst(cell.rect);
+            cellRoi.setTo(cv::Scalar::all(0), stream);
+        }
+        cv::cuda::GpuMat fitRoi = dst(cell.fit);
+        if (cell.frame.size() == cell.fit.size())
+        {
+            cell.frame.copyTo(fitRoi, stream);
+        }
+        else
+        {
+            bool bShrink = cell.frame.cols > cell.fit.width && cell.frame.rows > cell.fit.height;
+            cv::cuda::resize(cell.frame, fitRoi, cell.fit.size(), 0, 0, bShrink ? cv::INTER_AREA : cv::INTER_LINEAR, stream);
+        }
+        buffer.vGeneration[i] = cell.nGeneration;
+        buffer.vFitChange[i] = cell.nFitChange;
+        m_nDraw++;
+    }
+    m_iFrame++;
+    return true;
+}
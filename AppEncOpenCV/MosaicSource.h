@@ -0,0 +1,120 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameSource.h"
+
+/**
+*  @brief One input of a mosaic: an image or video file, and how many output
+*  frames each of its frames is shown for (2 for a 30 fps feed in a 60 fps
+*  mosaic).
+*/
+struct MosaicFeed
+{
+    std::string strPath;
+    int nInterval = 1;
+};
+
+/**
+*  @brief Reads one feed per line, "path" or "path<tab>interval". Empty lines
+*  and lines starting with # are skipped.
+*/
+std::vector<MosaicFeed> ReadMosaicFeeds(const std::string &strPath);
+
+/**
+*  @brief Composes N feeds into a grid in the encoder input buffers, so a
+*  video wall is one encode on one NVENC session instead of N.
+*
+*  Every feed is scaled into its cell with its aspect ratio kept. A cell is
+*  only drawn when its feed has a new frame, or when the input buffer it is
+*  drawn into does not hold the current one yet: feeds that run slower than
+*  the mosaic, still images and feeds that ended cost no GPU work. The cells
+*  that changed are reported as changed regions, so the encoder spends its
+*  bits on them. Feeds are read by nThread threads in parallel, a frame of the
+*  mosaic waits for all of them; the mosaic ends with its last feed.
+*/
+class MosaicSource : public FrameSource
+{
+public:
+    /**
+    *  @brief outSize must be even. nCol 0 makes the grid as square as
+    *  possible; nThread 0 uses one thread per core, up to 8. Throws if a feed
+    *  cannot be opened.
+    */
+    MosaicSource(const std::vector<MosaicFeed> &vFeed, cv::Size outSize, int nCol = 0, int nThread = 0);
+    ~MosaicSource();
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override { return false; }
+    bool IsRenderer() const override { return true; }
+    bool RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) override;
+    bool HasChangedRegions() const override { return true; }
+    void GetChangedRegion(std::vector<cv::Rect> &vRect) const override { vRect = m_vChanged; }
+
+    /**
+    *  @brief Cells drawn and cells left as they were, over all frames.
+    */
+    long long GetDrawCount() const { return m_nDraw; }
+    long long GetSkipCount() const { return m_nSkip; }
+
+private:
+    struct Cell
+    {
+        std::unique_ptr<FrameSource> pSource;
+        int nInterval = 1;
+        bool bEnded = false;
+        cv::cuda::GpuMat frame;
+        // Incremented with every new frame, 0 before the first one
+        long long nGeneration = 0;
+        // Cell in the mosaic, and the part of it the frame is scaled into
+        cv::Rect rect, fit;
+        int nFitChange = 0;
+    };
+    // Drawn into an input buffer: the generation and fit of every cell
+    struct BufferState
+    {
+        std::vector<long long> vGeneration;
+        std::vector<int> vFitChange;
+    };
+
+    void FetchWorker(int iThread);
+    // Gets the frame of every cell due at m_iFrame, on the worker threads
+    void FetchFrames();
+    void Stop();
+
+    std::vector<Cell> m_vCell;
+    cv::Size m_outSize;
+    int m_iDevice = 0;
+    int m_iFrame = 0;
+
+    // By input buffer address
+    std::map<const uchar *, BufferState> m_mBuffer;
+    std::vector<long long> m_vLastGeneration;
+    std::vector<cv::Rect> m_vChanged;
+    long long m_nDraw = 0, m_nSkip = 0;
+
+    std::vector<std::thread> m_vThread;
+    std::mutex m_mutex;
+    std::condition_variable m_cvFetch, m_cvDone;
+    // Fetch rounds started, and threads still busy with the current one
+    long long m_nRound = 0;
+    int m_nBusy = 0;
+    bool m_bStop = false;
+    std::exception_ptr m_pError;
+};
@@ -0,0 +1,82 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <sstream>
+#include "NvEncoderGpuMat.h"
+
+cv::cuda::GpuMat NvEncoderGpuMat::GetInputGpuMat(int iHandle)
+{
+    if (iHandle < 0 || iHandle >= m_nEncoderBuffer)
+    {
+        NVENC_THROW_ERROR("Invalid input buffer handle", NV_ENC_ERR_INVALID_PARAM);
+    }
+    const NvEncInputFrame &inputFrame = m_vInputFrames[iHandle];
+    int nType;
+    switch (inputFrame.bufferFormat)
+    {
+    case NV_ENC_BUFFER_FORMAT_ARGB:
+    case NV_ENC_BUFFER_FORMAT_ABGR:
+        nType = CV_8UC4;
+        break;
+    case NV_ENC_BUFFER_FORMAT_ARGB10:
+    case NV_ENC_BUFFER_FORMAT_ABGR10:
+        nType = CV_32SC1;
+        break;
+    default:
+        NVENC_THROW_ERROR("GpuMat input buffers need a packed RGB format", NV_ENC_ERR_UNSUPPORTED_PARAM);
+    }
+    return cv::cuda::GpuMat(GetEncodeHeight(), GetEncodeWidth(), nType, inputFrame.inputPtr, inputFrame.pitch);
+}
+
+int NvEncoderGpuMat::GetFreeInputCount() const
+{
+    // Submitted frames keep their buffer mapped until they are output
+    return m_nEncoderBuffer - (m_iToSend - m_iGot) - m_nAcquired;
+}
+
+int NvEncoderGpuMat::AcquireInput()
+{
+    if (GetFreeInputCount() <= 0)
+    {
+        std::ostringstream err;
+        err << "All " << m_nEncoderBuffer << " encoder input buffers are in use" << std::endl;
+        NVENC_THROW_ERROR(err.str(), NV_ENC_ERR_OUT_OF_MEMORY);
+    }
+    return (m_iToSend + m_nAcquired++) % m_nEncoderBuffer;
+}
+
+void NvEncoderGpuMat::CancelInput(int iHandle)
+{
+    if (!m_nAcquired || iHandle != (m_iToSend + m_nAcquired - 1) % m_nEncoderBuffer)
+    {
+        NVENC_THROW_ERROR("Only the most recently acquired input buffer can be cancelled", NV_ENC_ERR_INVALID_PARAM);
+    }
+    m_nAcquired--;
+}
+
+void NvEncoderGpuMat::SubmitInput(int iHandle, std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams)
+{
+    if (!m_nAcquired || iHandle != m_iToSend % m_nEncoderBuffer)
+    {
+        NVENC_THROW_ERROR("Input buffers must be submitted in the order they were acquired", NV_ENC_ERR_INVALID_PARAM);
+    }
+    // EncodeFrame() encodes the buffer GetNextInputFrame() points to, which is iHandle
+    m_nAcquired--;
+    try
+    {
+        EncodeFrame(vPacket, pPicParams);
+    }
+    catch (...)
+    {
+        m_nAcquired++;
+        throw;
+    }
+}
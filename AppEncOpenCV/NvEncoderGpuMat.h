@@ -0,0 +1,67 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <cuda.h>
+#include "NvEncoder/NvEncoderCuda.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief NvEncoderCuda whose input buffers, allocated and registered with
+*  NVENC when the encoder is created, are handed out as cv::cuda::GpuMat
+*  headers. Producers draw into a buffer and submit it by handle, without the
+*  GetNextInputFrame() plus copy round of NvEncoderCuda.
+*
+*  The buffers form a ring: handles come out of AcquireInput() in the order
+*  the encoder consumes them and must be submitted in that order. A buffer is
+*  free again once the frame it held has been output, so up to
+*  GetFreeInputCount() frames can be drawn ahead of the encoder.
+*/
+class NvEncoderGpuMat : public NvEncoderCuda
+{
+public:
+    NvEncoderGpuMat(CUcontext cuContext, uint32_t nWidth, uint32_t nHeight, NV_ENC_BUFFER_FORMAT eBufferFormat)
+        : NvEncoderCuda(cuContext, nWidth, nHeight, eBufferFormat) {}
+
+    /**
+    *  @brief Header on input buffer iHandle at the current encode size. The
+    *  type is CV_8UC4 for the 8 bit packed RGB formats (ABGR is RGBA byte
+    *  order) and CV_32SC1 for the 10 bit ones.
+    */
+    cv::cuda::GpuMat GetInputGpuMat(int iHandle);
+
+    /**
+    *  @brief Number of buffers that can be acquired before the oldest
+    *  submitted one has to come out of the encoder.
+    */
+    int GetFreeInputCount() const;
+    /**
+    *  @brief Takes the next buffer of the ring; throws if none is free.
+    */
+    int AcquireInput();
+    /**
+    *  @brief Returns the most recently acquired buffer unused.
+    */
+    void CancelInput(int iHandle);
+    /**
+    *  @brief Encodes the oldest acquired buffer, which must be iHandle, and
+    *  returns the packets that became available as EncodeFrame() does.
+    */
+    void SubmitInput(int iHandle, std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams = nullptr);
+
+private:
+    // Acquired but not yet submitted
+    int m_nAcquired = 0;
+};
@@ -0,0 +1,504 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include "OutputSink.h"
+#include "IoUringSink.h"
+#include "ShmRingSink.h"
+
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static void ThrowIoError(const char *szWhat, const char *szFilePath)
+{
+    std::ostringstream err;
+    err << szWhat << " failed";
+    if (szFilePath)
+    {
+        err << " for " << szFilePath;
+    }
+    err << ": " << strerror(errno) << std::endl;
+    throw std::runtime_error(err.str());
+}
+
+OstreamSink::OstreamSink(const char *szFilePath) : m_fpOut(szFilePath, std::ios::out | std::ios::binary)
+{
+    if (!m_fpOut)
+    {
+        std::ostringstream err;
+        err << "Unable to open output file: " << szFilePath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+}
+
+OstreamSink::~OstreamSink()
+{
+    m_fpOut.close();
+}
+
+void OstreamSink::Write(const uint8_t *pData, size_t nSize)
+{
+    m_fpOut.write(reinterpret_cast<const char*>(pData), nSize);
+    m_nBytesWritten += nSize;
+}
+
+void OstreamSink::Flush()
+{
+    m_fpOut.flush();
+}
+
+void OstreamSink::Close()
+{
+    m_fpOut.close();
+}
+
+MemoryRingSink::MemoryRingSink(size_t nCapacity) : m_vRing(nCapacity)
+{
+    if (nCapacity == 0)
+    {
+        throw std::invalid_argument("MemoryRingSink capacity must not be zero");
+    }
+}
+
+void MemoryRingSink::Write(const uint8_t *pData, size_t nSize)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (nSize)
+    {
+        m_cvNotFull.wait(lock, [this] { return m_bClosed || m_nQueued < m_vRing.size(); });
+        if (m_bClosed)
+        {
+            throw std::runtime_error("MemoryRingSink::Write() called after Close()");
+        }
+        size_t iTail = (m_iHead + m_nQueued) % m_vRing.size();
+        size_t nChunk = std::min(nSize, std::min(m_vRing.size() - m_nQueued, m_vRing.size() - iTail));
+        memcpy(m_vRing.data() + iTail, pData, nChunk);
+        m_nQueued += nChunk;
+        m_nBytesWritten += nChunk;
+        pData += nChunk;
+        nSize -= nChunk;
+        m_cvNotEmpty.notify_one();
+    }
+}
+
+void MemoryRingSink::Close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bClosed = true;
+    m_cvNotEmpty.notify_all();
+    m_cvNotFull.notify_all();
+}
+
+size_t MemoryRingSink::Read(uint8_t *pDst, size_t nMaxSize, bool bWait)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (bWait)
+    {
+        m_cvNotEmpty.wait(lock, [this] { return m_bClosed || m_nQueued; });
+    }
+    size_t nRead = 0;
+    while (nRead < nMaxSize && m_nQueued)
+    {
+        size_t nChunk = std::min(nMaxSize - nRead, std::min(m_nQueued, m_vRing.size() - m_iHead));
+        memcpy(pDst + nRead, m_vRing.data() + m_iHead, nChunk);
+        m_iHead = (m_iHead + nChunk) % m_vRing.size();
+        m_nQueued -= nChunk;
+        nRead += nChunk;
+    }
+    if (nRead)
+    {
+        m_cvNotFull.notify_one();
+    }
+    return nRead;
+}
+
+size_t MemoryRingSink::GetQueuedBytes()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nQueued;
+}
+
+#ifndef _WIN32
+
+static const size_t nPageSize = 4096;
+
+void WriteAll(int fd, const uint8_t *pData, size_t nSize)
+{
+    while (nSize)
+    {
+        ssize_t nWritten = write(fd, pData, nSize);
+        if (nWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ThrowIoError("write()", NULL);
+        }
+        pData += nWritten;
+        nSize -= nWritten;
+    }
+}
+
+BufferedFileSink::BufferedFileSink(const char *szFilePath, size_t nBufferSize, bool bDirectIO)
+    : m_nBufferSize((std::max(nBufferSize, nPageSize) + nPageSize - 1) / nPageSize * nPageSize), m_bDirectIO(bDirectIO)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (m_bDirectIO)
+    {
+        flags |= O_DIRECT;
+    }
+#endif
+    m_fd = open(szFilePath, flags, 0644);
+    if (m_fd < 0 && m_bDirectIO)
+    {
+        // Not every file system supports O_DIRECT (tmpfs for one); fall back to buffered I/O
+        m_bDirectIO = false;
+        m_fd = open(szFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (m_fd < 0)
+    {
+        std::ostringstream err;
+        err << "Unable to open output file: " << szFilePath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    if (posix_memalign(reinterpret_cast<void**>(&m_pBuffer), nPageSize, m_nBufferSize))
+    {
+        close(m_fd);
+        throw std::bad_alloc();
+    }
+}
+
+BufferedFileSink::~BufferedFileSink()
+{
+    try
+    {
+        Close();
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << ex.what();
+    }
+    free(m_pBuffer);
+}
+
+void BufferedFileSink::WriteAligned(size_t nSize)
+{
+    WriteAll(m_fd, m_pBuffer, nSize);
+    m_nBuffered -= nSize;
+    if (m_nBuffered)
+    {
+        memmove(m_pBuffer, m_pBuffer + nSize, m_nBuffered);
+    }
+}
+
+void BufferedFileSink::Write(const uint8_t *pData, size_t nSize)
+{
+    m_nBytesWritten += nSize;
+    while (nSize)
+    {
+        size_t nChunk = std::min(nSize, m_nBufferSize - m_nBuffered);
+        memcpy(m_pBuffer + m_nBuffered, pData, nChunk);
+        m_nBuffered += nChunk;
+        pData += nChunk;
+        nSize -= nChunk;
+        if (m_nBuffered == m_nBufferSize)
+        {
+            WriteAligned(m_nBufferSize);
+        }
+    }
+}
+
+void BufferedFileSink::Flush()
+{
+    // Only whole pages can be written while keeping the file offset aligned;
+    // the remainder stays buffered until Close()
+    size_t nAligned = m_nBuffered / nPageSize * nPageSize;
+    if (nAligned)
+    {
+        WriteAligned(nAligned);
+    }
+}
+
+void BufferedFileSink::Close()
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+    Flush();
+    if (m_nBuffered)
+    {
+#ifdef O_DIRECT
+        if (m_bDirectIO)
+        {
+            fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+        }
+#endif
+        WriteAll(m_fd, m_pBuffer, m_nBuffered);
+        m_nBuffered = 0;
+    }
+    int fd = m_fd;
+    m_fd = -1;
+    if (close(fd))
+    {
+        ThrowIoError("close()", NULL);
+    }
+}
+
+PipeSink::PipeSink(int fd, bool bCloseFd, int nPipeSize) : m_fd(fd), m_bCloseFd(bCloseFd)
+{
+    struct stat st;
+    if (fstat(m_fd, &st))
+    {
+        int e = errno;
+        if (m_bCloseFd)
+        {
+            close(m_fd);
+        }
+        errno = e;
+        ThrowIoError("fstat()", NULL);
+    }
+    if (!S_ISFIFO(st.st_mode))
+    {
+        return;
+    }
+#ifdef F_SETPIPE_SZ
+    if (nPipeSize <= 0)
+    {
+        std::ifstream fpMax("/proc/sys/fs/pipe-max-size");
+        if (!(fpMax >> nPipeSize))
+        {
+            nPipeSize = 1 << 20;
+        }
+    }
+    // An unprivileged process may be refused sizes above pipe-max-size;
+    // keep halving until the kernel accepts the request
+    while (nPipeSize >= (1 << 16) && fcntl(m_fd, F_SETPIPE_SZ, nPipeSize) < 0)
+    {
+        nPipeSize /= 2;
+    }
+    m_nPipeSize = fcntl(m_fd, F_GETPIPE_SZ);
+#endif
+}
+
+PipeSink::~PipeSink()
+{
+    try
+    {
+        Close();
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << ex.what();
+    }
+}
+
+void PipeSink::Write(const uint8_t *pData, size_t nSize)
+{
+    WriteAll(m_fd, pData, nSize);
+    m_nBytesWritten += nSize;
+}
+
+void PipeSink::Close()
+{
+    int fd = m_fd;
+    m_fd = -1;
+    if (fd >= 0 && m_bCloseFd && close(fd))
+    {
+        ThrowIoError("close()", NULL);
+    }
+}
+
+size_t PipeSink::GetQueuedBytes()
+{
+    struct stat st;
+    int nQueued = 0;
+    if (m_fd < 0 || fstat(m_fd, &st))
+    {
+        return 0;
+    }
+#ifdef TIOCOUTQ
+    if (S_ISSOCK(st.st_mode))
+    {
+        return ioctl(m_fd, TIOCOUTQ, &nQueued) ? 0 : (size_t)nQueued;
+    }
+#endif
+    return S_ISFIFO(st.st_mode) && !ioctl(m_fd, FIONREAD, &nQueued) ? (size_t)nQueued : 0;
+}
+
+MmapFileSink::MmapFileSink(const char *szFilePath, size_t nChunkSize)
+    : m_nChunkSize((std::max(nChunkSize, nPageSize) + nPageSize - 1) / nPageSize * nPageSize)
+{
+    m_fd = open(szFilePath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+    {
+        std::ostringstream err;
+        err << "Unable to open output file: " << szFilePath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+}
+
+MmapFileSink::~MmapFileSink()
+{
+    try
+    {
+        Close();
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << ex.what();
+    }
+}
+
+void MmapFileSink::Grow(size_t nMinSize)
+{
+    size_t nNewSize = (nMinSize + m_nChunkSize - 1) / m_nChunkSize * m_nChunkSize;
+    int e = posix_fallocate(m_fd, 0, nNewSize);
+    if (e)
+    {
+        // posix_fallocate() does not set errno
+        errno = e;
+        ThrowIoError("posix_fallocate()", NULL);
+    }
+    if (m_pMap)
+    {
+        munmap(m_pMap, m_nMapSize);
+        m_pMap = NULL;
+    }
+    void *pMap = mmap(NULL, nNewSize, PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (pMap == MAP_FAILED)
+    {
+        ThrowIoError("mmap()", NULL);
+    }
+    madvise(pMap, nNewSize, MADV_SEQUENTIAL);
+    m_pMap = static_cast<uint8_t*>(pMap);
+    m_nMapSize = nNewSize;
+}
+
+void MmapFileSink::Write(const uint8_t *pData, size_t nSize)
+{
+    if (m_nBytesWritten + nSize > m_nMapSize)
+    {
+        Grow(m_nBytesWritten + nSize);
+    }
+    memcpy(m_pMap + m_nBytesWritten, pData, nSize);
+    m_nBytesWritten += nSize;
+}
+
+void MmapFileSink::Flush()
+{
+    if (m_pMap)
+    {
+        msync(m_pMap, m_nMapSize, MS_ASYNC);
+    }
+}
+
+void MmapFileSink::Close()
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+    if (m_pMap)
+    {
+        munmap(m_pMap, m_nMapSize);
+        m_pMap = NULL;
+    }
+    int fd = m_fd;
+    m_fd = -1;
+    if (ftruncate(fd, m_nBytesWritten))
+    {
+        close(fd);
+        ThrowIoError("ftruncate()", NULL);
+    }
+    if (close(fd))
+    {
+        ThrowIoError("close()", NULL);
+    }
+}
+
+#endif
+
+std::unique_ptr<OutputSink> CreateOutputSink(const std::string &strType, const char *szFilePath)
+{
+#ifndef _WIN32
+    if (!strcmp(szFilePath, "-") || strType == "pipe")
+    {
+        if (!strcmp(szFilePath, "-"))
+        {
+            return std::unique_ptr<OutputSink>(new PipeSink(STDOUT_FILENO));
+        }
+        int fd = open(szFilePath, O_WRONLY);
+        if (fd < 0)
+        {
+            std::ostringstream err;
+            err << "Unable to open output file: " << szFilePath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        return std::unique_ptr<OutputSink>(new PipeSink(fd, true));
+    }
+    if (strType == "file")
+    {
+        return std::unique_ptr<OutputSink>(new BufferedFileSink(szFilePath));
+    }
+    if (strType == "direct")
+    {
+        return std::unique_ptr<OutputSink>(new BufferedFileSink(szFilePath, 8 << 20, true));
+    }
+    if (strType == "mmap")
+    {
+        return std::unique_ptr<OutputSink>(new MmapFileSink(szFilePath));
+    }
+    if (strType == "shm")
+    {
+        // -o names the POSIX shared memory object
+        std::string strName = szFilePath[0] == '/' ? szFilePath : std::string("/") + szFilePath;
+        return std::unique_ptr<OutputSink>(new ShmRingSink(strName.c_str()));
+    }
+    if (strType == "uring")
+    {
+#ifdef HAVE_LIBURING
+        if (IoUringWriter::IsAvailable())
+        {
+            return std::unique_ptr<OutputSink>(new IoUringSink(IoUringWriter::GetShared(), szFilePath));
+        }
+#endif
+        // Sinks are created by the batch, watch and daemon threads at once
+        static std::atomic<bool> bWarned(false);
+        if (!bWarned.exchange(true))
+        {
+            std::cout << "io_uring is not available, using the file sink" << std::endl;
+        }
+        return std::unique_ptr<OutputSink>(new BufferedFileSink(szFilePath));
+    }
+#endif
+    if (strType == "fstream")
+    {
+        return std::unique_ptr<OutputSink>(new OstreamSink(szFilePath));
+    }
+    std::ostringstream err;
+    err << "Output sink \"" << strType << "\" is not supported on this platform" << std::endl;
+    throw std::invalid_argument(err.str());
+}
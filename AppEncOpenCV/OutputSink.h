@@ -0,0 +1,203 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+*  @brief Destination of the encoded bitstream.
+*  EncodeGpuMat() passes every packet returned by NvEncoder to Write(). Close()
+*  flushes pending data and releases the underlying resource; it is also called
+*  from the destructor of every implementation. I/O errors are reported by
+*  throwing std::runtime_error.
+*/
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+
+    virtual void Write(const uint8_t *pData, size_t nSize) = 0;
+    /**
+    *  @brief Used instead of Write() for sessions with temporal layers;
+    *  nTemporalId is the layer of the packet, 0 for the base layer. Sinks that
+    *  fan out can drop enhancement layers, the others just write it.
+    */
+    virtual void WritePacket(const uint8_t *pData, size_t nSize, int nTemporalId) { Write(pData, nSize); }
+    virtual void Flush() {}
+    virtual void Close() { Flush(); }
+    /**
+    *  @brief Bytes written but not yet taken by the other end, e.g. a reader
+    *  or the network; 0 for sinks that cannot tell.
+    */
+    virtual size_t GetQueuedBytes() { return 0; }
+
+    uint64_t GetBytesWritten() const { return m_nBytesWritten; }
+
+protected:
+    uint64_t m_nBytesWritten = 0;
+};
+
+/**
+*  @brief Writes through std::ofstream. This is the behavior the sample had
+*  before the sink abstraction and is kept as the portable fallback.
+*/
+class OstreamSink : public OutputSink
+{
+public:
+    OstreamSink(const char *szFilePath);
+    ~OstreamSink();
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Flush() override;
+    void Close() override;
+
+private:
+    std::ofstream m_fpOut;
+};
+
+/**
+*  @brief Discards the packets and only counts their bytes, for measurements.
+*/
+class NullSink : public OutputSink
+{
+public:
+    void Write(const uint8_t *pData, size_t nSize) override { m_nBytesWritten += nSize; }
+};
+
+/**
+*  @brief Collects packets in a ring of nCapacity bytes that the sink
+*  allocates and owns, and lets another thread of the embedding application
+*  drain it. Write() blocks while the ring is full; Read() blocks while it is
+*  empty unless the sink has been closed.
+*/
+class MemoryRingSink : public OutputSink
+{
+public:
+    MemoryRingSink(size_t nCapacity);
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Close() override;
+
+    /**
+    *  @brief Copies up to nMaxSize bytes into pDst. Returns 0 once the sink is
+    *  closed and drained, or immediately if bWait is false and the ring is empty.
+    */
+    size_t Read(uint8_t *pDst, size_t nMaxSize, bool bWait = true);
+    size_t GetQueuedBytes() override;
+
+private:
+    std::vector<uint8_t> m_vRing;
+    size_t m_iHead = 0, m_nQueued = 0;
+    bool m_bClosed = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cvNotFull, m_cvNotEmpty;
+};
+
+#ifndef _WIN32
+
+/**
+*  @brief Buffered file writer that accumulates packets in a page aligned
+*  buffer and issues large writes at aligned file offsets. With bDirectIO the
+*  file is opened with O_DIRECT so the page cache is bypassed; the unaligned
+*  tail is written after O_DIRECT has been cleared in Close().
+*/
+class BufferedFileSink : public OutputSink
+{
+public:
+    BufferedFileSink(const char *szFilePath, size_t nBufferSize = 8 << 20, bool bDirectIO = false);
+    ~BufferedFileSink();
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Flush() override;
+    void Close() override;
+
+private:
+    void WriteAligned(size_t nSize);
+
+    int m_fd = -1;
+    uint8_t *m_pBuffer = NULL;
+    size_t m_nBufferSize = 0, m_nBuffered = 0;
+    bool m_bDirectIO = false;
+};
+
+/**
+*  @brief Writes to stdout or any other file descriptor. When the descriptor
+*  is a pipe its capacity is raised with F_SETPIPE_SZ (up to
+*  /proc/sys/fs/pipe-max-size) so that one encoded frame fits into the pipe
+*  and the encoder does not stall on a slow reader for every packet. The
+*  descriptor is closed on Close() only if bCloseFd is set.
+*/
+class PipeSink : public OutputSink
+{
+public:
+    PipeSink(int fd, bool bCloseFd = false, int nPipeSize = 0);
+    ~PipeSink();
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Close() override;
+    /**
+    *  @brief Bytes in the pipe, or in the send queue if the descriptor is a
+    *  socket.
+    */
+    size_t GetQueuedBytes() override;
+
+    int GetPipeSize() const { return m_nPipeSize; }
+
+private:
+    int m_fd = -1;
+    bool m_bCloseFd = false;
+    int m_nPipeSize = 0;
+};
+
+/**
+*  @brief Writes into a memory mapped file that is preallocated in chunks of
+*  nChunkSize bytes, so packets are plain memcpy()s into the page cache. The
+*  file is truncated to the number of bytes written on Close().
+*/
+class MmapFileSink : public OutputSink
+{
+public:
+    MmapFileSink(const char *szFilePath, size_t nChunkSize = 64 << 20);
+    ~MmapFileSink();
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Flush() override;
+    void Close() override;
+
+private:
+    void Grow(size_t nMinSize);
+
+    int m_fd = -1;
+    uint8_t *m_pMap = NULL;
+    size_t m_nMapSize = 0, m_nChunkSize = 0;
+};
+
+/**
+*  @brief Writes a full buffer to fd, retrying on EINTR and partial writes.
+*/
+void WriteAll(int fd, const uint8_t *pData, size_t nSize);
+
+#endif
+
+/**
+*  @brief Creates the sink selected with -sink. strType is one of fstream, file,
+*  direct, pipe, mmap, uring or shm; a file path of "-" always selects a
+*  PipeSink on stdout. uring falls back to the file sink where io_uring is
+*  unavailable; for shm the file path is the name of the shared memory object.
+*/
+std::unique_ptr<OutputSink> CreateOutputSink(const std::string &strType, const char *szFilePath);
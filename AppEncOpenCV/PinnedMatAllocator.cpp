@@ -0,0 +1,170 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "PinnedMatAllocator.h"
+
+PinnedMatAllocator::PinnedMatAllocator(size_t nMaxFreeBytes, size_t nBlockAlign)
+    : m_nMaxFreeBytes(nMaxFreeBytes), m_nBlockAlign(nBlockAlign)
+{
+}
+
+cv::UMatData *PinnedMatAllocator::allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+    cv::AccessFlag, cv::UMatUsageFlags) const
+{
+    // Dense layout, as cv::Mat's default allocator computes it
+    size_t nTotal = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--)
+    {
+        if (step)
+        {
+            if (data && step[i] != CV_AUTOSTEP)
+            {
+                nTotal = step[i];
+            }
+            else
+            {
+                step[i] = nTotal;
+            }
+        }
+        nTotal *= sizes[i];
+    }
+
+    cv::UMatData *u = new cv::UMatData(this);
+    u->size = nTotal;
+    if (data)
+    {
+        u->data = u->origdata = static_cast<uchar*>(data);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    cv::cuda::HostMem block;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Smallest free block that fits, unless it is more than twice the size
+        auto it = m_mFree.lower_bound(nTotal);
+        if (it != m_mFree.end() && it->first / 2 <= nTotal)
+        {
+            block = it->second;
+            m_nFreeBytes -= it->first;
+            m_mFree.erase(it);
+            m_nReused++;
+        }
+    }
+    if (block.empty())
+    {
+        size_t nBlock = (nTotal + m_nBlockAlign - 1) / m_nBlockAlign * m_nBlockAlign;
+        try
+        {
+            block.create(1, (int)nBlock, CV_8UC1);
+        }
+        catch (...)
+        {
+            delete u;
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_nCreated++;
+    }
+    u->data = u->origdata = block.data;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_mUsed[block.data] = block;
+    return u;
+}
+
+bool PinnedMatAllocator::allocate(cv::UMatData *u, cv::AccessFlag, cv::UMatUsageFlags) const
+{
+    // Host memory is always accessible
+    return u != NULL;
+}
+
+void PinnedMatAllocator::deallocate(cv::UMatData *u) const
+{
+    if (!u)
+    {
+        return;
+    }
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_mUsed.find(u->origdata);
+        if (it != m_mUsed.end())
+        {
+            size_t nBlock = (size_t)it->second.cols;
+            if (m_nFreeBytes + nBlock <= m_nMaxFreeBytes)
+            {
+                m_mFree.emplace(nBlock, it->second);
+                m_nFreeBytes += nBlock;
+            }
+            // Otherwise the HostMem going out of scope releases the block
+            m_mUsed.erase(it);
+        }
+    }
+    delete u;
+}
+
+int PinnedMatAllocator::GetCreatedCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nCreated;
+}
+
+int PinnedMatAllocator::GetReusedCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nReused;
+}
+
+PinnedMatAllocator *PinnedMatAllocator::GetInstance()
+{
+    // Leaked on purpose: decoded Mats may be released after static destruction
+    // and the CUDA runtime may already be gone by then
+    static PinnedMatAllocator *pInstance = new PinnedMatAllocator();
+    return pInstance;
+}
+
+cv::Mat ReadImagePinned(const std::string &strPath, int flags)
+{
+    // The compressed file is read into a buffer kept per thread, so a stream
+    // of images does no heap allocation once the pool is warm
+    thread_local std::vector<uchar> vFile;
+    std::ifstream fpIn(strPath, std::ios::in | std::ios::binary);
+    if (!fpIn)
+    {
+        return cv::Mat();
+    }
+    fpIn.seekg(0, std::ios::end);
+    std::streamoff nSize = fpIn.tellg();
+    if (nSize <= 0)
+    {
+        return cv::Mat();
+    }
+    fpIn.seekg(0, std::ios::beg);
+    vFile.resize((size_t)nSize);
+    if (!fpIn.read(reinterpret_cast<char*>(vFile.data()), nSize))
+    {
+        return cv::Mat();
+    }
+
+    return DecodeImagePinned(vFile, flags);
+}
+
+cv::Mat DecodeImagePinned(const std::vector<uchar> &vData, int flags)
+{
+    // imdecode() creates its output through the allocator set on it
+    cv::Mat image;
+    image.allocator = PinnedMatAllocator::GetInstance();
+    cv::imdecode(vData, flags, &image);
+    return image;
+}
@@ -0,0 +1,78 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+/**
+*  @brief cv::MatAllocator handing out page-locked memory, so that
+*  GpuMat::upload() of a cv::Mat it allocated is a direct DMA instead of a
+*  copy through the driver's pageable staging buffer.
+*
+*  Blocks are cv::cuda::HostMem allocations rounded up to nBlockAlign bytes.
+*  A released block goes back to a free list and is handed out again for any
+*  Mat that fits it without wasting more than half of it, so decoding a
+*  stream of images of similar sizes allocates pinned memory only for the
+*  first few. Free blocks beyond nMaxFreeBytes are released.
+*
+*  Thread safe. Mats allocated here must not outlive the allocator; use
+*  GetInstance() unless the pool has to be bounded per use.
+*/
+class PinnedMatAllocator : public cv::MatAllocator
+{
+public:
+    PinnedMatAllocator(size_t nMaxFreeBytes = 512 << 20, size_t nBlockAlign = 1 << 20);
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+        cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *u) const override;
+
+    /**
+    *  @brief Blocks allocated from the driver and allocations served by a
+    *  recycled block.
+    */
+    int GetCreatedCount() const;
+    int GetReusedCount() const;
+
+    /**
+    *  @brief Process wide allocator, never destroyed.
+    */
+    static PinnedMatAllocator *GetInstance();
+
+private:
+    mutable std::mutex m_mutex;
+    // Blocks backing live Mats, by data pointer
+    mutable std::map<const uchar*, cv::cuda::HostMem> m_mUsed;
+    // Released blocks, by size
+    mutable std::multimap<size_t, cv::cuda::HostMem> m_mFree;
+    mutable size_t m_nFreeBytes = 0;
+    mutable int m_nCreated = 0, m_nReused = 0;
+    size_t m_nMaxFreeBytes, m_nBlockAlign;
+};
+
+/**
+*  @brief cv::imread() that decodes into memory of PinnedMatAllocator::GetInstance().
+*  Returns an empty Mat if the file cannot be read or decoded.
+*/
+cv::Mat ReadImagePinned(const std::string &strPath, int flags = cv::IMREAD_COLOR);
+
+/**
+*  @brief cv::imdecode() of an encoded image in memory, into pinned memory.
+*/
+cv::Mat DecodeImagePinned(const std::vector<uchar> &vData, int flags = cv::IMREAD_COLOR);
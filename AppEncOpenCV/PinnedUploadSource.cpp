@@ -0,0 +1,122 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <stdexcept>
+#include "PinnedUploadSource.h"
+
+PinnedUploadSource::PinnedUploadSource(int nWidth, int nHeight, HostFrameReader fnRead, int nSlots)
+    : m_fnRead(fnRead), m_vSlot(nSlots)
+{
+    if (nSlots < 2)
+    {
+        throw std::invalid_argument("PinnedUploadSource needs two slots to overlap uploads\n");
+    }
+    for (Slot &slot : m_vSlot)
+    {
+        slot.host.create(nHeight, nWidth, CV_8UC4);
+        slot.device.create(nHeight, nWidth, CV_8UC4);
+        slot.start = cv::cuda::Event(cv::cuda::Event::DEFAULT);
+        slot.done = cv::cuda::Event(cv::cuda::Event::BLOCKING_SYNC);
+    }
+    m_thread = std::thread(&PinnedUploadSource::Run, this, cv::cuda::getDevice());
+}
+
+PinnedUploadSource::~PinnedUploadSource()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+    // Uploads still queued read from the HostMem buffers about to be freed
+    m_stream.waitForCompletion();
+}
+
+void PinnedUploadSource::Run(int iDevice)
+{
+    cv::cuda::setDevice(iDevice);
+    try
+    {
+        for (;;)
+        {
+            Slot &slot = m_vSlot[m_iNextRead];
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this, &slot] { return m_bStop || slot.eState == SLOT_FREE; });
+                if (m_bStop)
+                {
+                    return;
+                }
+            }
+            // The slot is ours until it is marked queued
+            cv::Mat host = slot.host.createMatHeader();
+            bool bFrame = m_fnRead(host);
+            if (bFrame)
+            {
+                slot.start.record(m_stream);
+                // Asynchronous because host is page-locked; a 2D copy, the GpuMat is pitched
+                slot.device.upload(host, m_stream);
+                slot.done.record(m_stream);
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!bFrame)
+            {
+                m_bEnd = true;
+                m_cv.notify_all();
+                return;
+            }
+            slot.eState = SLOT_QUEUED;
+            m_iNextRead = (m_iNextRead + 1) % (int)m_vSlot.size();
+            m_cv.notify_all();
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pError = std::current_exception();
+        m_bEnd = true;
+        m_cv.notify_all();
+    }
+}
+
+bool PinnedUploadSource::GetNextFrame(cv::cuda::GpuMat &frame)
+{
+    Slot &slot = m_vSlot[m_iNextFrame];
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_iInUse >= 0)
+        {
+            // The caller is done with the previous frame
+            m_vSlot[m_iInUse].eState = SLOT_FREE;
+            m_iInUse = -1;
+            m_cv.notify_all();
+        }
+        m_cv.wait(lock, [this, &slot] { return slot.eState == SLOT_QUEUED || m_bEnd; });
+        if (slot.eState != SLOT_QUEUED)
+        {
+            if (m_pError)
+            {
+                std::rethrow_exception(m_pError);
+            }
+            return false;
+        }
+        slot.eState = SLOT_IN_USE;
+        m_iInUse = m_iNextFrame;
+    }
+    m_iNextFrame = (m_iNextFrame + 1) % (int)m_vSlot.size();
+
+    slot.done.waitForCompletion();
+    m_dUploadedBytes += (double)slot.device.cols * slot.device.rows * 4;
+    m_dUploadMs += cv::cuda::Event::elapsedTime(slot.start, slot.done);
+    frame = slot.device;
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FrameSource.h"
+
+/**
+*  @brief Fills host, a pinned RGBA (CV_8UC4) frame, with the next frame.
+*  Returns false once there are no more frames.
+*/
+typedef std::function<bool(cv::Mat &host)> HostFrameReader;
+
+/**
+*  @brief FrameSource for frames produced in host memory. A reader thread
+*  writes frames into a ring of page-locked cv::cuda::HostMem buffers and
+*  queues their upload on a stream of its own, so the DMA of the next frames
+*  runs while the current one is encoded; GetNextFrame() only waits for the
+*  CUDA event recorded after the upload of its frame. A GpuMat.upload() from
+*  pageable memory instead blocks the caller and goes through a driver
+*  staging copy.
+*/
+class PinnedUploadSource : public FrameSource
+{
+public:
+    PinnedUploadSource(int nWidth, int nHeight, HostFrameReader fnRead, int nSlots = 3);
+    ~PinnedUploadSource();
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override;
+
+    /**
+    *  @brief Uploaded bytes and the time the copies took on the GPU.
+    */
+    double GetUploadedBytes() const { return m_dUploadedBytes; }
+    double GetUploadMs() const { return m_dUploadMs; }
+
+private:
+    enum SlotState
+    {
+        SLOT_FREE,
+        // Upload queued, event recorded
+        SLOT_QUEUED,
+        // Handed out by GetNextFrame()
+        SLOT_IN_USE
+    };
+    struct Slot
+    {
+        cv::cuda::HostMem host;
+        cv::cuda::GpuMat device;
+        cv::cuda::Event start, done;
+        SlotState eState = SLOT_FREE;
+    };
+
+    void Run(int iDevice);
+
+    HostFrameReader m_fnRead;
+    std::vector<Slot> m_vSlot;
+    cv::cuda::Stream m_stream;
+    int m_iNextRead = 0, m_iNextFrame = 0;
+    // Slot handed out last, freed by the next GetNextFrame()
+    int m_iInUse = -1;
+    bool m_bEnd = false, m_bStop = false;
+    std::exception_ptr m_pError;
+    double m_dUploadedBytes = 0, m_dUploadMs = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+};
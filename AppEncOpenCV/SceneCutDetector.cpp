@@ -0,0 +1,78 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <cstdlib>
+#include <stdexcept>
+#include "SceneCutDetector.h"
+
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudawarping.hpp>
+
+// Enough to tell shots apart, small enough to cost next to nothing
+static const cv::Size thumbnailSize(128, 72);
+
+SceneCutDetector::SceneCutDetector(double fHistThreshold, double fSadThreshold, int nMinInterval)
+    : m_fHistThreshold(fHistThreshold), m_fSadThreshold(fSadThreshold), m_nMinInterval(nMinInterval)
+{
+    if (fHistThreshold < 0 || fHistThreshold > 1 || fSadThreshold < 0 || fSadThreshold > 1)
+    {
+        throw std::invalid_argument("Scene cut thresholds must be between 0 and 1\n");
+    }
+}
+
+bool SceneCutDetector::Detect(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream)
+{
+    if (frame.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Scene cut detection needs RGBA frames\n");
+    }
+    m_start.record(stream);
+    bool bShrink = frame.cols > thumbnailSize.width && frame.rows > thumbnailSize.height;
+    cv::cuda::resize(frame, m_thumbnail, thumbnailSize, 0, 0, bShrink ? cv::INTER_AREA : cv::INTER_LINEAR, stream);
+    cv::cuda::GpuMat &gray = m_gray[m_iCurrent];
+    cv::cuda::cvtColor(m_thumbnail, gray, cv::COLOR_RGBA2GRAY, 0, stream);
+    cv::cuda::calcHist(gray, m_hist, stream);
+    m_hist.download(m_hostHist[m_iCurrent], stream);
+    if (m_bPrevious)
+    {
+        cv::cuda::calcNormDiff(gray, m_gray[1 - m_iCurrent], m_sad, cv::NORM_L1, stream);
+        m_sad.download(m_hostSad, stream);
+    }
+    m_end.record(stream);
+    stream.waitForCompletion();
+    m_fGpuMs += cv::cuda::Event::elapsedTime(m_start, m_end);
+    m_nFrame++;
+    m_nSinceCut++;
+
+    bool bCut = false;
+    if (m_bPrevious && m_nSinceCut > m_nMinInterval)
+    {
+        const int *pHist = m_hostHist[m_iCurrent].ptr<int>(0), *pPrevious = m_hostHist[1 - m_iCurrent].ptr<int>(0);
+        long long nDistance = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            nDistance += std::abs(pHist[i] - pPrevious[i]);
+        }
+        double fPixel = (double)thumbnailSize.area();
+        double fHist = nDistance / (2 * fPixel);
+        double fSad = cv::sum(m_hostSad)[0] / (255 * fPixel);
+        bCut = fHist > m_fHistThreshold && fSad > m_fSadThreshold;
+    }
+    if (bCut)
+    {
+        m_nCut++;
+        m_nSinceCut = 0;
+    }
+    m_bPrevious = true;
+    m_iCurrent = 1 - m_iCurrent;
+    return bCut;
+}
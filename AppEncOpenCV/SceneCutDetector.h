@@ -0,0 +1,71 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief Finds scene cuts between consecutive frames on the GPU, for the
+*  encoder to place keyframes at cuts without a lookahead.
+*
+*  Every frame is shrunk to a small luma thumbnail. A cut needs both the luma
+*  histogram and the thumbnail to differ from the previous frame's by more
+*  than the thresholds: the histogram alone misses cuts between shots of
+*  similar tone, the mean absolute difference alone fires on fast motion.
+*  Only the 256 histogram bins and one sum come back to the host.
+*/
+class SceneCutDetector
+{
+public:
+    /**
+    *  @brief fHistThreshold is the histogram distance (half the L1 distance of
+    *  the normalized histograms, 0 to 1) and fSadThreshold the mean absolute
+    *  luma difference (0 to 1) a cut exceeds. No cut is reported within
+    *  nMinInterval frames of the last one, so flashes and fades do not fire
+    *  again and again.
+    */
+    SceneCutDetector(double fHistThreshold = 0.4, double fSadThreshold = 0.1, int nMinInterval = 12);
+
+    /**
+    *  @brief Compares frame (RGBA) with the frame passed before, on stream,
+    *  and returns true at a cut. Waits for stream.
+    */
+    bool Detect(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream);
+    /**
+    *  @brief Forgets the previous frame; the next one is never a cut.
+    */
+    void Reset() { m_bPrevious = false; }
+
+    long long GetFrameCount() const { return m_nFrame; }
+    long long GetCutCount() const { return m_nCut; }
+    /**
+    *  @brief GPU time spent detecting, in ms.
+    */
+    double GetGpuTime() const { return m_fGpuMs; }
+
+private:
+    double m_fHistThreshold, m_fSadThreshold;
+    int m_nMinInterval;
+
+    cv::cuda::GpuMat m_thumbnail, m_gray[2], m_hist, m_sad;
+    // Index of the current frame in m_gray and m_hostHist
+    int m_iCurrent = 0;
+    bool m_bPrevious = false;
+    cv::Mat m_hostHist[2], m_hostSad;
+    cv::cuda::Event m_start, m_end;
+
+    long long m_nFrame = 0, m_nCut = 0;
+    // Frames since the last cut
+    long long m_nSinceCut = 0;
+    double m_fGpuMs = 0;
+};
@@ -0,0 +1,78 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Layout of the POSIX shared memory ring written by ShmRingSink and read by
+*  ShmRingReader. There is exactly one writer and any number of readers; the
+*  writer never waits for readers.
+*
+*  Positions are byte counters that only grow; the offset of a position in the
+*  data area is position % nCapacity. Every packet is stored as a
+*  ShmRingRecord followed by its payload, padded to 8 bytes and never split at
+*  the end of the data area (a padding record, or a tail shorter than a record
+*  header, is skipped instead). The writer publishes a packet as follows:
+*   1. advance nTailPos past the records that are about to be overwritten,
+*   2. copy the record,
+*   3. store the new nWritePos and wake readers waiting on nNotify.
+*  A reader copies (or uses in place) the record at its position and then
+*  re-reads nTailPos: if the tail has moved past the record meanwhile, the data
+*  may be torn and the reader resynchronizes at the tail, counting the lost
+*  packets. Readers that fall behind therefore lose data but never block the
+*  writer.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory ring needs address-free 64 bit atomics");
+
+#define SHM_RING_MAGIC 0x4e525353
+#define SHM_RING_VERSION 1
+
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t nCapacity;
+    // Position after the last published record
+    std::atomic<uint64_t> nWritePos;
+    // Oldest position that is still guaranteed to hold a complete record
+    std::atomic<uint64_t> nTailPos;
+    // Incremented with every publication; futex word for waiting readers
+    std::atomic<uint32_t> nNotify;
+    std::atomic<uint32_t> nWaiters;
+    std::atomic<uint32_t> bClosed;
+    // Process of the writer; a ring whose writer is gone may be replaced
+    uint32_t nWriterPid;
+};
+
+enum ShmRingRecordFlags
+{
+    SHM_RING_RECORD_PADDING = 1,
+};
+
+struct ShmRingRecord
+{
+    uint32_t nSize;
+    uint32_t flags;
+    // Sequence number of the packet, lets readers count lost packets
+    uint64_t iPacket;
+};
+
+static const uint64_t nShmRingDataOffset = 64;
+static_assert(sizeof(ShmRingHeader) <= nShmRingDataOffset, "ShmRingHeader must fit in front of the data area");
+
+inline uint64_t ShmRingAlign(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t)7;
+}
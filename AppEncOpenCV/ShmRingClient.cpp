@@ -0,0 +1,208 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include "ShmRingClient.h"
+
+#ifndef _WIN32
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+ShmRingReader::ShmRingReader(const char *szName, bool bFromOldest)
+{
+    // Readers write nWaiters, so the mapping has to be writable
+    int fd = shm_open(szName, O_RDWR, 0);
+    if (fd < 0)
+    {
+        std::ostringstream err;
+        err << "Unable to open shared memory ring " << szName << ": " << strerror(errno) << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    struct stat st;
+    void *pMap = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > nShmRingDataOffset)
+    {
+        m_nMapSize = st.st_size;
+        pMap = mmap(NULL, m_nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (pMap == MAP_FAILED)
+    {
+        std::ostringstream err;
+        err << "Unable to map shared memory ring " << szName << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    m_pHeader = static_cast<ShmRingHeader*>(pMap);
+    m_pData = static_cast<const uint8_t*>(pMap) + nShmRingDataOffset;
+    uint32_t magic = reinterpret_cast<std::atomic<uint32_t>*>(&m_pHeader->magic)->load(std::memory_order_acquire);
+    if (magic != SHM_RING_MAGIC || m_pHeader->version != SHM_RING_VERSION
+        || nShmRingDataOffset + m_pHeader->nCapacity > m_nMapSize)
+    {
+        munmap(pMap, m_nMapSize);
+        std::ostringstream err;
+        err << "Shared memory object " << szName << " is not a ring of version " << SHM_RING_VERSION << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    m_nReadPos = bFromOldest ? m_pHeader->nTailPos.load(std::memory_order_acquire)
+        : m_pHeader->nWritePos.load(std::memory_order_acquire);
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    munmap(m_pHeader, m_nMapSize);
+}
+
+bool ShmRingReader::IsClosed() const
+{
+    return m_pHeader->bClosed.load() != 0;
+}
+
+void ShmRingReader::Resync()
+{
+    // m_iNextPacket is left alone: the gap to the next record read is
+    // accounted as lost
+    m_nReadPos = m_pHeader->nTailPos.load(std::memory_order_acquire);
+}
+
+bool ShmRingReader::WaitForData(int nTimeoutMs)
+{
+    auto tEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMs);
+    for (;;)
+    {
+        uint32_t nNotify = m_pHeader->nNotify.load();
+        if (m_nReadPos < m_pHeader->nWritePos.load(std::memory_order_acquire))
+        {
+            return true;
+        }
+        if (m_pHeader->bClosed.load())
+        {
+            return false;
+        }
+        // Negative for no timeout
+        long nWaitNs = -1;
+        if (nTimeoutMs >= 0)
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tEnd - std::chrono::steady_clock::now()).count();
+            if (ns <= 0)
+            {
+                return false;
+            }
+            nWaitNs = (long)std::min<long long>(ns, 1000000000);
+        }
+#ifdef __linux__
+        // The writer bumps nNotify after publishing and wakes only if it sees
+        // a waiter, so register first and let the kernel compare nNotify
+        m_pHeader->nWaiters.fetch_add(1);
+        struct timespec ts = {nWaitNs / 1000000000, nWaitNs % 1000000000};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_pHeader->nNotify), FUTEX_WAIT, nNotify, nWaitNs < 0 ? NULL : &ts,
+            NULL, 0);
+        m_pHeader->nWaiters.fetch_sub(1);
+#else
+        (void)nNotify;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(nWaitNs < 0 ? 100000L : std::min(nWaitNs, 100000L)));
+#endif
+    }
+}
+
+bool ShmRingReader::Peek(const uint8_t **ppData, size_t *pnSize, int nTimeoutMs)
+{
+    const uint64_t nCapacity = m_pHeader->nCapacity;
+    for (;;)
+    {
+        if (m_nReadPos >= m_pHeader->nWritePos.load(std::memory_order_acquire) && !WaitForData(nTimeoutMs))
+        {
+            return false;
+        }
+        if (m_nReadPos < m_pHeader->nTailPos.load(std::memory_order_acquire))
+        {
+            Resync();
+            continue;
+        }
+        uint64_t iOffset = m_nReadPos % nCapacity;
+        if (nCapacity - iOffset < sizeof(ShmRingRecord))
+        {
+            m_nReadPos += nCapacity - iOffset;
+            continue;
+        }
+        ShmRingRecord record;
+        memcpy(&record, m_pData + iOffset, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_nReadPos < m_pHeader->nTailPos.load(std::memory_order_relaxed))
+        {
+            Resync();
+            continue;
+        }
+        if (sizeof(record) + (uint64_t)record.nSize > nCapacity - iOffset)
+        {
+            throw std::runtime_error("Corrupt record in shared memory ring");
+        }
+        if (record.flags & SHM_RING_RECORD_PADDING)
+        {
+            m_nReadPos += ShmRingAlign(sizeof(record) + record.nSize);
+            continue;
+        }
+        if (m_bNextKnown && record.iPacket > m_iNextPacket)
+        {
+            m_nLost += record.iPacket - m_iNextPacket;
+        }
+        m_iNextPacket = record.iPacket;
+        m_bNextKnown = true;
+        m_nPeekPos = m_nReadPos;
+        m_nNextPos = m_nReadPos + ShmRingAlign(sizeof(record) + record.nSize);
+        *ppData = m_pData + iOffset + sizeof(record);
+        *pnSize = record.nSize;
+        return true;
+    }
+}
+
+bool ShmRingReader::Release()
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_nPeekPos < m_pHeader->nTailPos.load(std::memory_order_relaxed))
+    {
+        // Overwritten while in use; the packet counts as lost
+        Resync();
+        return false;
+    }
+    m_nReadPos = m_nNextPos;
+    m_iNextPacket++;
+    return true;
+}
+
+bool ShmRingReader::Read(std::vector<uint8_t> &vPacket, int nTimeoutMs)
+{
+    const uint8_t *pData = NULL;
+    size_t nSize = 0;
+    do
+    {
+        if (!Peek(&pData, &nSize, nTimeoutMs))
+        {
+            return false;
+        }
+        vPacket.assign(pData, pData + nSize);
+    } while (!Release());
+    return true;
+}
+
+#endif
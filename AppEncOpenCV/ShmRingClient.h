@@ -0,0 +1,78 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Client library for consumers of the shared memory ring written by
+*  AppEncOpenCV -sink shm. Link against ShmRingClient and read packets with
+*
+*      ShmRingReader reader("/cam0");
+*      std::vector<uint8_t> vPacket;
+*      while (reader.Read(vPacket, 1000)) { ... }
+*
+*  or, without copying, with Peek() / Release().
+*/
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <string>
+#include <vector>
+#include "ShmRing.h"
+
+class ShmRingReader
+{
+public:
+    /**
+    *  @brief Attaches to the ring szName. With bFromOldest the reader starts at
+    *  the oldest packet still in the ring, otherwise at the next new packet.
+    */
+    ShmRingReader(const char *szName, bool bFromOldest = false);
+    ~ShmRingReader();
+
+    /**
+    *  @brief Returns a pointer to the next packet inside the shared memory
+    *  without copying it. Waits up to nTimeoutMs milliseconds (-1 forever).
+    *  Returns false on timeout or once the writer has closed the ring and all
+    *  packets were consumed. The pointer must be given back with Release().
+    */
+    bool Peek(const uint8_t **ppData, size_t *pnSize, int nTimeoutMs = -1);
+    /**
+    *  @brief Moves past the packet returned by Peek(). Returns false if the
+    *  writer overwrote the packet while it was in use, in which case whatever
+    *  was read from it must be discarded.
+    */
+    bool Release();
+    /**
+    *  @brief Copies the next packet into vPacket; Peek() + Release() that
+    *  retries when the packet was overwritten during the copy.
+    */
+    bool Read(std::vector<uint8_t> &vPacket, int nTimeoutMs = -1);
+
+    /**
+    *  @brief Number of packets the writer overwrote before this reader got to them.
+    */
+    uint64_t GetLostPackets() const { return m_nLost; }
+    bool IsClosed() const;
+
+private:
+    bool WaitForData(int nTimeoutMs);
+    void Resync();
+
+    ShmRingHeader *m_pHeader = NULL;
+    const uint8_t *m_pData = NULL;
+    size_t m_nMapSize = 0;
+    uint64_t m_nReadPos = 0, m_nPeekPos = 0, m_nNextPos = 0;
+    uint64_t m_iNextPacket = 0, m_nLost = 0;
+    bool m_bNextKnown = false;
+};
+
+#endif
@@ -0,0 +1,187 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include "ShmRingSink.h"
+
+#ifndef _WIN32
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// True if the ring szName was closed or its writer no longer runs. Objects
+// that are not complete rings may be a writer that is still creating them.
+static bool IsAbandonedRing(const char *szName)
+{
+    int fd = shm_open(szName, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    void *pMap = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= nShmRingDataOffset)
+    {
+        pMap = mmap(NULL, nShmRingDataOffset, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (pMap == MAP_FAILED)
+    {
+        return false;
+    }
+    ShmRingHeader *pHeader = static_cast<ShmRingHeader*>(pMap);
+    bool bAbandoned = reinterpret_cast<std::atomic<uint32_t>*>(&pHeader->magic)->load(std::memory_order_acquire) == SHM_RING_MAGIC
+        && (pHeader->bClosed.load() || (kill((pid_t)pHeader->nWriterPid, 0) && errno == ESRCH));
+    munmap(pMap, nShmRingDataOffset);
+    return bAbandoned;
+}
+
+ShmRingSink::ShmRingSink(const char *szName, size_t nCapacity) : m_strName(szName), m_nCapacity(ShmRingAlign(nCapacity))
+{
+    if (m_nCapacity < 4 * sizeof(ShmRingRecord))
+    {
+        throw std::invalid_argument("ShmRingSink capacity is too small");
+    }
+    int fd = shm_open(szName, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 && errno == EEXIST && IsAbandonedRing(szName))
+    {
+        // Left behind by a crashed encoder; stale readers stay attached to the
+        // old object and see no more packets
+        shm_unlink(szName);
+        fd = shm_open(szName, O_RDWR | O_CREAT | O_EXCL, 0666);
+    }
+    if (fd < 0)
+    {
+        int e = errno;
+        std::ostringstream err;
+        err << "Unable to create shared memory ring " << szName << ": " << strerror(e);
+        if (e == EEXIST)
+        {
+            err << ", another encoder writes it";
+        }
+        err << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    m_nMapSize = nShmRingDataOffset + m_nCapacity;
+    void *pMap = MAP_FAILED;
+    if (ftruncate(fd, m_nMapSize) == 0)
+    {
+        pMap = mmap(NULL, m_nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int e = errno;
+    close(fd);
+    if (pMap == MAP_FAILED)
+    {
+        shm_unlink(szName);
+        std::ostringstream err;
+        err << "Unable to map shared memory ring " << szName << ": " << strerror(e) << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    m_pHeader = new (pMap) ShmRingHeader();
+    m_pData = static_cast<uint8_t*>(pMap) + nShmRingDataOffset;
+    m_pHeader->version = SHM_RING_VERSION;
+    m_pHeader->nCapacity = m_nCapacity;
+    m_pHeader->nWritePos.store(0);
+    m_pHeader->nTailPos.store(0);
+    m_pHeader->nNotify.store(0);
+    m_pHeader->nWaiters.store(0);
+    m_pHeader->bClosed.store(0);
+    m_pHeader->nWriterPid = (uint32_t)getpid();
+    // Readers refuse to attach until the magic is visible
+    std::atomic_thread_fence(std::memory_order_release);
+    reinterpret_cast<std::atomic<uint32_t>*>(&m_pHeader->magic)->store(SHM_RING_MAGIC, std::memory_order_release);
+}
+
+ShmRingSink::~ShmRingSink()
+{
+    Close();
+}
+
+void ShmRingSink::Write(const uint8_t *pData, size_t nSize)
+{
+    uint64_t nRecord = ShmRingAlign(sizeof(ShmRingRecord) + nSize);
+    if (nRecord > m_nCapacity / 2)
+    {
+        std::ostringstream err;
+        err << "Packet of " << nSize << " bytes does not fit into shared memory ring " << m_strName << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    uint64_t iOffset = m_nWritePos % m_nCapacity;
+    uint64_t nPad = nRecord > m_nCapacity - iOffset ? m_nCapacity - iOffset : 0;
+    uint64_t nEnd = m_nWritePos + nPad + nRecord;
+
+    // Retire the records that the new one overlaps. The tail is published
+    // before the data is touched so that readers validating after their copy
+    // notice the overwrite.
+    while (!m_qRecordPos.empty() && m_qRecordPos.front() + m_nCapacity < nEnd)
+    {
+        m_qRecordPos.pop_front();
+    }
+    uint64_t nTail = m_qRecordPos.empty() ? m_nWritePos + nPad : m_qRecordPos.front();
+    if (nTail != m_pHeader->nTailPos.load(std::memory_order_relaxed))
+    {
+        m_pHeader->nTailPos.store(nTail, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    if (nPad >= sizeof(ShmRingRecord))
+    {
+        ShmRingRecord pad = {(uint32_t)(nPad - sizeof(ShmRingRecord)), SHM_RING_RECORD_PADDING, 0};
+        memcpy(m_pData + iOffset, &pad, sizeof(pad));
+    }
+    ShmRingRecord record = {(uint32_t)nSize, 0, m_iPacket++};
+    uint8_t *pRecord = m_pData + (m_nWritePos + nPad) % m_nCapacity;
+    memcpy(pRecord, &record, sizeof(record));
+    memcpy(pRecord + sizeof(record), pData, nSize);
+    m_qRecordPos.push_back(m_nWritePos + nPad);
+    m_nWritePos = nEnd;
+    m_nBytesWritten += nSize;
+    Publish();
+}
+
+void ShmRingSink::Publish()
+{
+    m_pHeader->nWritePos.store(m_nWritePos, std::memory_order_release);
+    m_pHeader->nNotify.fetch_add(1);
+    // Only pay for the system call when a reader actually sleeps
+    if (m_pHeader->nWaiters.load())
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_pHeader->nNotify), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+    }
+}
+
+void ShmRingSink::Close()
+{
+    if (!m_pHeader)
+    {
+        return;
+    }
+    m_pHeader->bClosed.store(1);
+    Publish();
+    munmap(m_pHeader, m_nMapSize);
+    m_pHeader = NULL;
+    shm_unlink(m_strName.c_str());
+}
+
+#endif
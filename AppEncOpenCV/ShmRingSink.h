@@ -0,0 +1,50 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <deque>
+#include "OutputSink.h"
+#include "ShmRing.h"
+
+/**
+*  @brief Publishes every packet into a POSIX shared memory ring (see
+*  ShmRing.h) that same-host consumers read with ShmRingReader. Each Write()
+*  call becomes one record, so readers get whole packets. The shared memory
+*  object is created on construction and unlinked on Close(); readers that are
+*  attached keep their mapping and see the ring as closed. A ring of the same
+*  name is only replaced if it is closed or its writer has exited, otherwise
+*  construction fails.
+*/
+class ShmRingSink : public OutputSink
+{
+public:
+    ShmRingSink(const char *szName, size_t nCapacity = 64 << 20);
+    ~ShmRingSink();
+
+    void Write(const uint8_t *pData, size_t nSize) override;
+    void Close() override;
+
+private:
+    void Publish();
+
+    std::string m_strName;
+    ShmRingHeader *m_pHeader = NULL;
+    uint8_t *m_pData = NULL;
+    size_t m_nMapSize = 0;
+    uint64_t m_nCapacity = 0, m_nWritePos = 0, m_iPacket = 0;
+    // Start positions of the records still in the ring, oldest first
+    std::deque<uint64_t> m_qRecordPos;
+};
+
+#endif
@@ -0,0 +1,244 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Measures the throughput of the output sinks with a synthetic bitstream whose
+*  packet sizes follow a high bitrate encode: one large IDR packet per GOP and
+*  P-frame packets of bitrate / fps bytes in between. No GPU is needed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "OutputSink.h"
+#include "IoUringSink.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+void ShowHelpAndExit(const char *szBadOption = NULL)
+{
+    std::ostringstream oss;
+    if (szBadOption)
+    {
+        oss << "Error parsing \"" << szBadOption << "\"" << std::endl;
+    }
+    oss << "Options:" << std::endl
+        << "-o               Output file path prefix (default: sink_bench)" << std::endl
+        << "-size            Megabytes to write per sink (default: 2048)" << std::endl
+        << "-bitrate         Simulated bitrate in Mbit/s (default: 400)" << std::endl
+        << "-fps             Simulated frame rate (default: 60)" << std::endl
+        << "-gop             Simulated GOP length (default: 60)" << std::endl
+        << "-sink            Comma separated sinks to measure (default: fstream,file,direct,mmap,uring,pipe,ring)" << std::endl
+        << "-streams         Number of concurrent streams for the file sinks (default: 1)" << std::endl
+        ;
+    std::cout << oss.str();
+    exit(szBadOption ? 1 : 0);
+}
+
+static double Measure(OutputSink &sink, const std::vector<uint8_t> &vData, const std::vector<size_t> &vPacketSize, uint64_t nTotal)
+{
+    auto tStart = std::chrono::high_resolution_clock::now();
+    uint64_t nWritten = 0;
+    size_t iPacket = 0, iOffset = 0;
+    while (nWritten < nTotal)
+    {
+        size_t nSize = vPacketSize[iPacket++ % vPacketSize.size()];
+        if (iOffset + nSize > vData.size())
+        {
+            iOffset = 0;
+        }
+        sink.Write(vData.data() + iOffset, nSize);
+        iOffset += nSize;
+        nWritten += nSize;
+    }
+    sink.Close();
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+}
+
+int main(int argc, char **argv)
+{
+    std::string strPrefix = "sink_bench", strSinks = "fstream,file,direct,mmap,uring,pipe,ring";
+    int nSizeMB = 2048, nBitrateMbps = 400, nFps = 60, nGop = 60, nStreams = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-h"))
+        {
+            ShowHelpAndExit();
+        }
+        if (i + 1 == argc)
+        {
+            ShowHelpAndExit(argv[i]);
+        }
+        if (!strcmp(argv[i], "-o"))
+        {
+            strPrefix = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-size"))
+        {
+            nSizeMB = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-bitrate"))
+        {
+            nBitrateMbps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-fps"))
+        {
+            nFps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-gop"))
+        {
+            nGop = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-streams"))
+        {
+            nStreams = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-sink"))
+        {
+            strSinks = argv[++i];
+        }
+        else
+        {
+            ShowHelpAndExit(argv[i]);
+        }
+    }
+    if (nSizeMB <= 0 || nBitrateMbps <= 0 || nFps <= 0 || nGop <= 0 || nStreams <= 0)
+    {
+        ShowHelpAndExit("-size/-bitrate/-fps/-gop/-streams");
+    }
+
+    // IDR frames are assumed to be 8x the size of a P frame; jitter of +-25%
+    // keeps packet sizes from being page multiples by accident
+    size_t nFrameBytes = (size_t)nBitrateMbps * 1000000 / 8 / nFps;
+    size_t nPBytes = nFrameBytes * nGop / (nGop + 7);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> jitter(0.75, 1.25);
+    std::vector<size_t> vPacketSize;
+    for (int i = 0; i < nGop; i++)
+    {
+        vPacketSize.push_back((size_t)((i == 0 ? 8 : 1) * nPBytes * jitter(rng)));
+    }
+    std::vector<uint8_t> vData(nPBytes * 16);
+    for (uint8_t &b : vData)
+    {
+        b = (uint8_t)rng();
+    }
+
+    uint64_t nTotal = (uint64_t)nSizeMB << 20;
+    std::cout << "Packet size: " << nPBytes << " bytes (P), " << 8 * nPBytes << " bytes (IDR), "
+        << nSizeMB << " MB per sink" << std::endl;
+    std::stringstream ss(strSinks);
+    std::string strType;
+    while (std::getline(ss, strType, ','))
+    {
+        double sec = 0;
+        if (strType == "ring")
+        {
+            // Embedding case: a consumer thread drains the ring as fast as it can
+            MemoryRingSink sink(64 << 20);
+            std::thread consumer([&sink]()
+            {
+                std::vector<uint8_t> vBuf(1 << 20);
+                while (sink.Read(vBuf.data(), vBuf.size()))
+                {
+                }
+            });
+            sec = Measure(sink, vData, vPacketSize, nTotal);
+            consumer.join();
+        }
+#ifndef _WIN32
+        else if (strType == "pipe")
+        {
+            // Stands in for a piped consumer such as ffmpeg reading stdin
+            int fds[2];
+            if (pipe(fds))
+            {
+                perror("pipe");
+                return 1;
+            }
+            std::thread consumer([&fds]()
+            {
+                std::vector<uint8_t> vBuf(1 << 20);
+                while (read(fds[0], vBuf.data(), vBuf.size()) > 0)
+                {
+                }
+                close(fds[0]);
+            });
+            PipeSink sink(fds[1], true);
+            std::cout << "Pipe size: " << sink.GetPipeSize() << " bytes" << std::endl;
+            sec = Measure(sink, vData, vPacketSize, nTotal);
+            consumer.join();
+        }
+#endif
+        else
+        {
+#ifdef HAVE_LIBURING
+            IoUringWriter::Stats statsBefore = {};
+            std::shared_ptr<IoUringWriter> pWriter;
+            if (strType == "uring" && IoUringWriter::IsAvailable())
+            {
+                pWriter = IoUringWriter::GetShared();
+                statsBefore = pWriter->GetStats();
+            }
+#endif
+            // Each stream writes nTotal / nStreams bytes from its own thread,
+            // like concurrent encode sessions of one process
+            std::vector<std::unique_ptr<OutputSink>> vpSink;
+            for (int i = 0; i < nStreams; i++)
+            {
+                std::string strPath = strPrefix + "_" + strType + "_" + std::to_string(i) + ".h264";
+                vpSink.push_back(CreateOutputSink(strType, strPath.c_str()));
+            }
+            auto tStart = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> vThread;
+            for (int i = 0; i < nStreams; i++)
+            {
+                OutputSink *pSink = vpSink[i].get();
+                vThread.push_back(std::thread([&, pSink]() { Measure(*pSink, vData, vPacketSize, nTotal / nStreams); }));
+            }
+            for (std::thread &t : vThread)
+            {
+                t.join();
+            }
+            sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+            for (int i = 0; i < nStreams; i++)
+            {
+                remove((strPrefix + "_" + strType + "_" + std::to_string(i) + ".h264").c_str());
+            }
+#ifdef HAVE_LIBURING
+            if (pWriter)
+            {
+                IoUringWriter::Stats stats = pWriter->GetStats();
+                double gb = (stats.nBytes - statsBefore.nBytes) / double(1 << 30);
+                std::cout << "io_uring: " << (stats.nSubmitCalls - statsBefore.nSubmitCalls) / gb << " submits/GB, "
+                    << (stats.nWaitCalls - statsBefore.nWaitCalls) / gb << " waits/GB, "
+                    << (stats.nWrites - statsBefore.nWrites) / gb << " writes/GB, "
+                    << stats.nSpilledBuffers - statsBefore.nSpilledBuffers << " spilled buffers, "
+                    << stats.nBufferWaits - statsBefore.nBufferWaits << " waits for a buffer" << std::endl;
+            }
+#endif
+        }
+        double mbps = nTotal / sec / (1 << 20);
+        std::cout << std::left << std::setw(10) << strType << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << mbps << " MB/s" << std::setw(10) << mbps * 8 * (1 << 20) / 1e6 / nBitrateMbps
+            << "x realtime" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include "SlideshowSource.h"
+
+#include <opencv2/cudaarithm.hpp>
+
+TransitionType ParseTransitionType(const std::string &strTransition)
+{
+    if (strTransition == "crossfade")
+    {
+        return TRANSITION_CROSSFADE;
+    }
+    if (strTransition == "wipe")
+    {
+        return TRANSITION_WIPE;
+    }
+    std::ostringstream err;
+    err << "Unknown transition " << strTransition << ", expected crossfade or wipe" << std::endl;
+    throw std::invalid_argument(err.str());
+}
+
+SlideshowSource::SlideshowSource(const std::vector<std::string> &vPath, cv::Size canvasSize, int nHoldFrame, int nTransitionFrame,
+    TransitionType eTransition, FitMode eFit)
+    : m_vPath(vPath), m_canvasSize(canvasSize), m_nHoldFrame(nHoldFrame), m_nTransitionFrame(nTransitionFrame),
+    m_eTransition(eTransition), m_decoder(1)
+{
+    if (nHoldFrame <= 0 || nTransitionFrame < 0)
+    {
+        throw std::invalid_argument("Slideshow hold must be at least one frame\n");
+    }
+    m_iDevice = cv::cuda::getDevice();
+
+    PrefetchNext();
+    cv::cuda::GpuMat first = m_next.valid() ? m_next.get() : cv::cuda::GpuMat();
+    if (first.empty())
+    {
+        throw std::invalid_argument("None of the slideshow images could be decoded\n");
+    }
+    if (canvasSize.area() == 0)
+    {
+        // 4:2:0 chroma subsampling needs even dimensions
+        m_canvasSize = cv::Size((first.cols + 1) & ~1, (first.rows + 1) & ~1);
+    }
+    if (m_canvasSize.width <= 0 || m_canvasSize.height <= 0 || m_canvasSize.width % 2 || m_canvasSize.height % 2)
+    {
+        std::ostringstream err;
+        err << "Invalid slideshow size " << m_canvasSize.width << "x" << m_canvasSize.height << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    m_normalizer = FrameNormalizer(eFit, m_canvasSize.width, m_canvasSize.height);
+
+    cv::cuda::Stream stream;
+    m_current.create(m_canvasSize, CV_8UC4);
+    m_normalizer.Write(first, m_current, stream);
+    stream.waitForCompletion();
+    PrefetchNext();
+    m_bHasIncoming = TakeNext(m_incoming, stream);
+}
+
+SlideshowSource::~SlideshowSource()
+{
+    if (m_next.valid())
+    {
+        m_next.wait();
+    }
+}
+
+void SlideshowSource::PrefetchNext()
+{
+    if (m_iNextPath >= m_vPath.size())
+    {
+        return;
+    }
+    m_next = std::async(std::launch::async, [this]() {
+        cv::cuda::setDevice(m_iDevice);
+        for (; m_iNextPath < m_vPath.size(); m_iNextPath++)
+        {
+            try
+            {
+                cv::cuda::GpuMat image = m_decoder.Decode(m_vPath[m_iNextPath]);
+                m_iNextPath++;
+                return image;
+            }
+            catch (const std::exception &ex)
+            {
+                std::cout << "Slideshow image skipped: " << ex.what();
+            }
+        }
+        return cv::cuda::GpuMat();
+    });
+}
+
+bool SlideshowSource::TakeNext(cv::cuda::GpuMat &canvas, cv::cuda::Stream &stream)
+{
+    if (!m_next.valid())
+    {
+        return false;
+    }
+    cv::cuda::GpuMat image = m_next.get();
+    if (image.empty())
+    {
+        return false;
+    }
+    canvas.create(m_canvasSize, CV_8UC4);
+    m_normalizer.Write(image, canvas, stream);
+    // The decoded image stays alive until the fit completes
+    stream.waitForCompletion();
+    PrefetchNext();
+    return true;
+}
+
+bool SlideshowSource::RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream)
+{
+    if (m_current.empty())
+    {
+        return false;
+    }
+    if (dst.size() != m_canvasSize)
+    {
+        std::ostringstream err;
+        err << "Slideshow of " << m_canvasSize.width << "x" << m_canvasSize.height << " rendered into a frame of "
+            << dst.cols << "x" << dst.rows << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+
+    if (m_iPhase < m_nHoldFrame)
+    {
+        // Buffers of the ring come round again during a hold; one that was
+        // given the image since it went on screen still has it
+        if (m_sHeld.insert(dst.data).second)
+        {
+            m_current.copyTo(dst, stream);
+            m_nHoldCopy++;
+        }
+        else
+        {
+            m_nHoldSkip++;
+        }
+    }
+    else
+    {
+        // Neither image alone, from just after the hold to just before the next
+        double t = (m_iPhase - m_nHoldFrame + 1.0) / (m_nTransitionFrame + 1);
+        if (m_eTransition == TRANSITION_CROSSFADE)
+        {
+            cv::cuda::addWeighted(m_current, 1 - t, m_incoming, t, 0, dst, -1, stream);
+        }
+        else
+        {
+            int x = std::min(std::max((int)std::lround(t * m_canvasSize.width), 1), m_canvasSize.width - 1);
+            cv::cuda::GpuMat dstLeft = dst.colRange(0, x), dstRight = dst.colRange(x, m_canvasSize.width);
+            m_incoming.colRange(0, x).copyTo(dstLeft, stream);
+            m_current.colRange(x, m_canvasSize.width).copyTo(dstRight, stream);
+        }
+        m_sHeld.erase(dst.data);
+    }
+
+    int nSpan = m_nHoldFrame + (m_bHasIncoming ? m_nTransitionFrame : 0);
+    if (++m_iPhase < nSpan)
+    {
+        return true;
+    }
+    m_iPhase = 0;
+    m_sHeld.clear();
+    if (!m_bHasIncoming)
+    {
+        m_current.release();
+        return true;
+    }
+    // The buffers are only swapped after the frame has been drawn
+    stream.waitForCompletion();
+    std::swap(m_current, m_incoming);
+    m_bHasIncoming = TakeNext(m_incoming, stream);
+    return true;
+}
@@ -0,0 +1,99 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <future>
+#include <set>
+#include <string>
+#include <vector>
+#include "FrameSource.h"
+#include "FrameNormalizer.h"
+#include "ImageDecoder.h"
+
+enum TransitionType
+{
+    TRANSITION_CROSSFADE,
+    // The next image slides in from the left edge
+    TRANSITION_WIPE
+};
+
+/**
+*  @brief Parses "crossfade" or "wipe"; throws std::invalid_argument otherwise.
+*/
+TransitionType ParseTransitionType(const std::string &strTransition);
+
+/**
+*  @brief Renders a slideshow of still images: each image is held for
+*  nHoldFrame frames, followed by nTransitionFrame frames of transition into
+*  the next one, composed on the GPU in the encoder input buffers.
+*
+*  Hold frames are identical, so NVENC codes them as skipped blocks, and the
+*  image is only written into an input buffer the first time that buffer is
+*  used during the hold: once every buffer of the ring holds the image, a hold
+*  frame costs no GPU work at all. Encode time goes mostly into transitions.
+*
+*  Images are fitted into the canvas size with eFit as FrameNormalizer does;
+*  the next image is decoded on a thread while the current one is held.
+*  Images that cannot be decoded are reported and left out.
+*/
+class SlideshowSource : public FrameSource
+{
+public:
+    /**
+    *  @brief canvasSize is the encode size and must be even; an empty one
+    *  takes the size of the first image, rounded up to even. Throws if no
+    *  image can be decoded.
+    */
+    SlideshowSource(const std::vector<std::string> &vPath, cv::Size canvasSize, int nHoldFrame, int nTransitionFrame,
+        TransitionType eTransition = TRANSITION_CROSSFADE, FitMode eFit = FIT_LETTERBOX);
+    ~SlideshowSource();
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override { return false; }
+    bool IsRenderer() const override { return true; }
+    bool RenderNextFrame(cv::cuda::GpuMat &dst, cv::cuda::Stream &stream) override;
+
+    cv::Size GetSize() const { return m_canvasSize; }
+
+    /**
+    *  @brief Frames rendered so far that only needed the hold image copied,
+    *  and those that needed nothing.
+    */
+    int GetHoldCopyCount() const { return m_nHoldCopy; }
+    int GetHoldSkipCount() const { return m_nHoldSkip; }
+
+private:
+    // Starts decoding the next image that decodes, if any
+    void PrefetchNext();
+    // Waits for the prefetched image; false if there is none
+    bool TakeNext(cv::cuda::GpuMat &canvas, cv::cuda::Stream &stream);
+
+    std::vector<std::string> m_vPath;
+    cv::Size m_canvasSize;
+    int m_nHoldFrame, m_nTransitionFrame;
+    TransitionType m_eTransition;
+    FrameNormalizer m_normalizer;
+    int m_iDevice = 0;
+
+    ImageDecoder m_decoder;
+    // Next image to decode, and the decode running on a thread
+    size_t m_iNextPath = 0;
+    std::future<cv::cuda::GpuMat> m_next;
+
+    // Images fitted to the canvas: on screen and coming next
+    cv::cuda::GpuMat m_current, m_incoming;
+    bool m_bHasIncoming = false;
+    // Frame within the hold plus transition of m_current
+    int m_iPhase = 0;
+    // Input buffers known to hold m_current, by address
+    std::set<const uchar *> m_sHeld;
+    int m_nHoldCopy = 0, m_nHoldSkip = 0;
+};
@@ -0,0 +1,86 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include "TemporalDenoiser.h"
+
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudaimgproc.hpp>
+
+TemporalDenoiser::TemporalDenoiser(double fStrength) : m_fStrength(fStrength)
+{
+    if (!(fStrength >= 0 && fStrength <= 1))
+    {
+        std::ostringstream err;
+        err << "Invalid denoise strength " << fStrength << ", expected 0 to 1" << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    m_fMinWeight = 1 - 0.8 * fStrength;
+    // Noise of a few levels is averaged away, more is taken as motion
+    m_fMotion = 4 + 28 * fStrength;
+}
+
+const cv::cuda::GpuMat &TemporalDenoiser::Filter(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream)
+{
+    if (frame.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Denoising needs RGBA frames\n");
+    }
+    if (m_previous.size() != frame.size())
+    {
+        frame.copyTo(m_previous, stream);
+        return m_previous;
+    }
+    cv::cuda::absdiff(frame, m_previous, m_diff, stream);
+    cv::cuda::cvtColor(m_diff, m_diffGray, cv::COLOR_RGBA2GRAY, 0, stream);
+    m_diffGray.convertTo(m_weight, CV_32F, (1 - m_fMinWeight) / m_fMotion, m_fMinWeight, stream);
+    cv::cuda::threshold(m_weight, m_weight, 1, 1, cv::THRESH_TRUNC, stream);
+    m_weight.convertTo(m_previousWeight, CV_32F, -1, 1, stream);
+    cv::cuda::blendLinear(frame, m_previous, m_weight, m_previousWeight, m_output, stream);
+    // The output is the previous frame of the next call
+    m_previous.swap(m_output);
+    return m_previous;
+}
+
+void TemporalDenoiser::FilterReference(const cv::Mat &frame, cv::Mat &previous) const
+{
+    if (frame.type() != CV_8UC4)
+    {
+        throw std::invalid_argument("Denoising needs RGBA frames\n");
+    }
+    if (previous.size() != frame.size() || previous.type() != frame.type())
+    {
+        previous = frame.clone();
+        return;
+    }
+    for (int y = 0; y < frame.rows; y++)
+    {
+        const uchar *pFrame = frame.ptr<uchar>(y);
+        uchar *pPrevious = previous.ptr<uchar>(y);
+        for (int x = 0; x < frame.cols; x++)
+        {
+            const uchar *f = pFrame + 4 * x;
+            uchar *p = pPrevious + 4 * x;
+            // cv::COLOR_RGBA2GRAY in fixed point
+            int nGray = (std::abs(f[0] - p[0]) * 4899 + std::abs(f[1] - p[1]) * 9617 + std::abs(f[2] - p[2]) * 1868 + (1 << 13)) >> 14;
+            float fWeight = std::min((float)(m_fMinWeight + (1 - m_fMinWeight) / m_fMotion * nGray), 1.0f);
+            float fPreviousWeight = 1 - fWeight;
+            for (int c = 0; c < 4; c++)
+            {
+                // As cv::cuda::blendLinear() does it
+                p[c] = cv::saturate_cast<uchar>((f[c] * fWeight + p[c] * fPreviousWeight) / (fWeight + fPreviousWeight + 1e-5f));
+            }
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+/**
+*  @brief Motion adaptive temporal recursive filter for noisy camera and
+*  sensor frames, run on the GPU before the frames reach the encoder.
+*
+*  Every output pixel is a blend of the input and the previous output. The
+*  weight of the input grows with the luma of the absolute difference of the
+*  two: where nothing moves the output averages over many frames and the
+*  noise NVENC would spend bits on fades away, where something moves the
+*  input wins and there is no ghosting. The weight of the input never drops
+*  below 1 - 0.8 * strength.
+*
+*  FilterReference() is the same filter on the CPU, written out pixel by
+*  pixel, to check the GPU path against.
+*/
+class TemporalDenoiser
+{
+public:
+    /**
+    *  @brief fStrength from 0 (off) to 1.
+    */
+    TemporalDenoiser(double fStrength);
+
+    /**
+    *  @brief Filters frame (RGBA) on stream and returns the output, valid
+    *  until the next call. The first frame, and the first of another size,
+    *  passes as it is.
+    */
+    const cv::cuda::GpuMat &Filter(const cv::cuda::GpuMat &frame, cv::cuda::Stream &stream);
+    /**
+    *  @brief Forgets the previous output, for a new stream.
+    */
+    void Reset() { m_previous.release(); }
+
+    /**
+    *  @brief Filters frame (RGBA) on the CPU; previous holds the previous
+    *  output and receives the new one.
+    */
+    void FilterReference(const cv::Mat &frame, cv::Mat &previous) const;
+
+    double GetStrength() const { return m_fStrength; }
+
+private:
+    double m_fStrength;
+    // Weight of the input where nothing changes, and the luma difference
+    // above which the input is taken as it is
+    double m_fMinWeight, m_fMotion;
+
+    cv::cuda::GpuMat m_previous, m_output, m_diff, m_diffGray, m_weight, m_previousWeight;
+};
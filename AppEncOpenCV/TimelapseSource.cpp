@@ -0,0 +1,393 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "TimelapseSource.h"
+#include "ImageDecoder.h"
+
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudawarping.hpp>
+
+// Keeps j * fStep for an exact multiple from rounding down to the previous image
+static const double dStepEpsilon = 1e-9;
+
+TimelapseSource::TimelapseSource(const std::vector<std::string> &vPath, double fStep, bool bBlend, int nThread, int nReorder)
+    : m_vPath(vPath), m_fStep(fStep), m_bBlend(bBlend)
+{
+    if (vPath.empty())
+    {
+        throw std::invalid_argument("Timelapse has no images\n");
+    }
+    if (!(fStep > 0))
+    {
+        throw std::invalid_argument("Timelapse step must be positive\n");
+    }
+    if (nThread <= 0)
+    {
+        nThread = (int)std::max(1u, std::min(std::thread::hardware_concurrency(), 8u));
+    }
+    // A crossfade holds two images while it waits for none
+    m_nReorder = std::max(nReorder > 0 ? nReorder : 2 * nThread, 2);
+    m_nOutFrame = std::max(1, (int)std::ceil(vPath.size() / fStep - dStepEpsilon));
+
+    std::vector<int> vImage;
+    std::vector<double> vWeight;
+    for (int iFrame = 0; iFrame < m_nOutFrame; iFrame++)
+    {
+        GetFrameImages(iFrame, vImage, vWeight);
+        for (int iImage : vImage)
+        {
+            if (m_vImage.empty() || iImage > m_vImage.back())
+            {
+                m_vImage.push_back(iImage);
+            }
+        }
+    }
+
+    m_iDevice = cv::cuda::getDevice();
+    for (int i = 0; i < nThread; i++)
+    {
+        m_vWorker.emplace_back(new Worker);
+    }
+    for (int i = 0; i < nThread; i++)
+    {
+        m_vThread.emplace_back(&TimelapseSource::DecodeWorker, this, i);
+    }
+
+    try
+    {
+        // The first image that decodes sets the frame size
+        for (int iImage : m_vImage)
+        {
+            m_last = WaitImage(iImage);
+            if (!m_last.empty())
+            {
+                break;
+            }
+            ReleaseBefore(iImage + 1);
+        }
+        if (m_last.empty())
+        {
+            throw std::invalid_argument("None of the timelapse images could be decoded\n");
+        }
+        m_size = m_last.size();
+    }
+    catch (...)
+    {
+        Stop();
+        throw;
+    }
+}
+
+TimelapseSource::~TimelapseSource()
+{
+    Stop();
+}
+
+void TimelapseSource::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+        m_cvTask.notify_all();
+    }
+    for (std::thread &thread : m_vThread)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+}
+
+void TimelapseSource::GetFrameImages(int iFrame, std::vector<int> &vImage, std::vector<double> &vWeight) const
+{
+    int nImage = (int)m_vPath.size();
+    double fPos = iFrame * m_fStep + dStepEpsilon;
+    int iFirst = std::min((int)fPos, nImage - 1);
+    vImage.assign(1, iFirst);
+    vWeight.assign(1, 1.0);
+    if (!m_bBlend)
+    {
+        return;
+    }
+    if (m_fStep >= 1)
+    {
+        // Average of the images up to the first one of the next frame
+        int iEnd = std::min(std::max((int)((iFrame + 1) * m_fStep + dStepEpsilon), iFirst + 1), nImage);
+        for (int iImage = iFirst + 1; iImage < iEnd; iImage++)
+        {
+            vImage.push_back(iImage);
+        }
+        vWeight.assign(vImage.size(), 1.0 / vImage.size());
+        return;
+    }
+    double t = fPos - iFirst;
+    if (t > 2 * dStepEpsilon && iFirst + 1 < nImage)
+    {
+        // Crossfade towards the next image
+        vImage.push_back(iFirst + 1);
+        vWeight = {1 - t, t};
+    }
+}
+
+void TimelapseSource::IssueTasks()
+{
+    // Called with m_mutex held
+    bool bIssued = false;
+    while (m_iIssued < (int)m_vImage.size() && m_iIssued - m_iReleased < m_nReorder)
+    {
+        Worker &worker = *m_vWorker[m_iNextWorker];
+        m_iNextWorker = (m_iNextWorker + 1) % (int)m_vWorker.size();
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.qTask.push_back(m_iIssued++);
+        }
+        m_nQueued++;
+        bIssued = true;
+    }
+    if (bIssued)
+    {
+        m_cvTask.notify_all();
+    }
+}
+
+bool TimelapseSource::TakeTask(int iWorker, int &iTask)
+{
+    int nWorker = (int)m_vWorker.size();
+    for (int k = 0; k < nWorker; k++)
+    {
+        Worker &worker = *m_vWorker[(iWorker + k) % nWorker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.qTask.empty())
+        {
+            continue;
+        }
+        // Own tasks in order, so the reorder buffer drains early; stolen ones from the far end
+        if (!k)
+        {
+            iTask = worker.qTask.front();
+            worker.qTask.pop_front();
+        }
+        else
+        {
+            iTask = worker.qTask.back();
+            worker.qTask.pop_back();
+        }
+        m_nQueued--;
+        return true;
+    }
+    return false;
+}
+
+void TimelapseSource::DecodeWorker(int iWorker)
+{
+    try
+    {
+        cv::cuda::setDevice(m_iDevice);
+        ImageDecoder decoder(1, 1);
+        cv::cuda::Stream stream;
+        for (;;)
+        {
+            int iTask;
+            if (!TakeTask(iWorker, iTask))
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cvTask.wait(lock, [this] { return m_bStop || m_nQueued > 0; });
+                if (m_bStop)
+                {
+                    return;
+                }
+                continue;
+            }
+            cv::cuda::GpuMat image;
+            try
+            {
+                image = decoder.Decode(m_vPath[m_vImage[iTask]], stream);
+            }
+            catch (const std::exception &ex)
+            {
+                std::cout << "Timelapse image skipped: " << ex.what();
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_mDecoded[iTask] = image;
+            m_cvDecoded.notify_all();
+        }
+    }
+    catch (...)
+    {
+        // E.g. no CUDA device, handed to the thread waiting for images
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pError = std::current_exception();
+        m_cvDecoded.notify_all();
+    }
+}
+
+cv::cuda::GpuMat TimelapseSource::WaitImage(int iImage)
+{
+    int iTask = (int)(std::lower_bound(m_vImage.begin(), m_vImage.end(), iImage) - m_vImage.begin());
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (iTask < m_iReleased)
+    {
+        // Released after it failed to decode while looking for the first image
+        return cv::cuda::GpuMat();
+    }
+    IssueTasks();
+    m_cvDecoded.wait(lock, [this, iTask] { return m_mDecoded.count(iTask) || m_pError; });
+    if (!m_mDecoded.count(iTask))
+    {
+        std::rethrow_exception(m_pError);
+    }
+    return m_mDecoded[iTask];
+}
+
+void TimelapseSource::ReleaseBefore(int iImage)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (m_iReleased < m_iIssued && m_vImage[m_iReleased] < iImage && m_mDecoded.count(m_iReleased))
+    {
+        m_mDecoded.erase(m_iReleased++);
+    }
+    IssueTasks();
+}
+
+bool TimelapseSource::GetNextFrame(cv::cuda::GpuMat &frame)
+{
+    if (m_iOutFrame >= m_nOutFrame)
+    {
+        return false;
+    }
+    std::vector<int> vImage;
+    std::vector<double> vWeight;
+    GetFrameImages(m_iOutFrame, vImage, vWeight);
+
+    auto GetImage = [this](int iImage) {
+        cv::cuda::GpuMat image = WaitImage(iImage);
+        if (image.empty())
+        {
+            return m_last;
+        }
+        if (image.size() != m_size)
+        {
+            cv::cuda::GpuMat scaled;
+            cv::cuda::resize(image, scaled, m_size, 0, 0, cv::INTER_AREA, m_stream);
+            image = scaled;
+        }
+        m_last = image;
+        return image;
+    };
+
+    if (vImage.size() == 1)
+    {
+        frame = GetImage(vImage[0]);
+    }
+    else if (m_fStep >= 1)
+    {
+        // Accumulated one image at a time, so a long group does not pin the reorder buffer
+        m_acc.create(m_size, CV_32FC4);
+        m_acc.setTo(cv::Scalar::all(0), m_stream);
+        for (size_t i = 0; i < vImage.size(); i++)
+        {
+            cv::cuda::addWeighted(m_acc, 1.0, GetImage(vImage[i]), vWeight[i], 0, m_acc, CV_32F, m_stream);
+            ReleaseBefore(vImage[i] + 1);
+        }
+        m_acc.convertTo(m_blended, CV_8UC4, m_stream);
+        frame = m_blended;
+    }
+    else
+    {
+        cv::cuda::GpuMat first = GetImage(vImage[0]);
+        cv::cuda::addWeighted(first, vWeight[0], GetImage(vImage[1]), vWeight[1], 0, m_blended, -1, m_stream);
+        frame = m_blended;
+    }
+    // The encoder reads the frame on a stream of its own
+    m_stream.waitForCompletion();
+
+    m_iOutFrame++;
+    if (m_iOutFrame < m_nOutFrame)
+    {
+        GetFrameImages(m_iOutFrame, vImage, vWeight);
+        ReleaseBefore(vImage[0]);
+    }
+    return true;
+}
+
+std::vector<std::string> TimelapseSource::ListImages(const std::string &strPath)
+{
+    std::vector<std::string> vPath;
+    struct stat st;
+    if (!stat(strPath.c_str(), &st) && S_ISDIR(st.st_mode))
+    {
+        static const char *aszExtension[] = {"jpg", "jpeg", "png", "bmp", "tif", "tiff", "webp", "ppm", "pgm", "jp2"};
+        DIR *pDir = opendir(strPath.c_str());
+        if (!pDir)
+        {
+            std::ostringstream err;
+            err << "Unable to list " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        while (struct dirent *pEntry = readdir(pDir))
+        {
+            std::string strName = pEntry->d_name;
+            size_t iDot = strName.find_last_of('.');
+            if (strName[0] == '.' || iDot == std::string::npos)
+            {
+                continue;
+            }
+            std::string strExtension = strName.substr(iDot + 1);
+            std::transform(strExtension.begin(), strExtension.end(), strExtension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            if (std::find(std::begin(aszExtension), std::end(aszExtension), strExtension) != std::end(aszExtension))
+            {
+                vPath.push_back(strName);
+            }
+        }
+        closedir(pDir);
+        std::sort(vPath.begin(), vPath.end());
+        for (std::string &strName : vPath)
+        {
+            strName = strPath + "/" + strName;
+        }
+    }
+    else
+    {
+        std::ifstream fList(strPath);
+        if (!fList)
+        {
+            std::ostringstream err;
+            err << "Unable to open image list " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        std::string strLine;
+        while (std::getline(fList, strLine))
+        {
+            strLine.erase(strLine.find_last_not_of(" \t\r\n") + 1);
+            if (!strLine.empty() && strLine[0] != '#')
+            {
+                vPath.push_back(strLine);
+            }
+        }
+    }
+    if (vPath.empty())
+    {
+        std::ostringstream err;
+        err << "No images in " << strPath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    return vPath;
+}
@@ -0,0 +1,110 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameSource.h"
+
+/**
+*  @brief Turns an image sequence into the frames of a timelapse, one output
+*  frame per fStep images: a step of 4 plays the sequence four times faster,
+*  0.5 shows every image for two frames. The clip plays at the encoder frame
+*  rate (-fps). With bBlend, the images falling into a frame are averaged
+*  (step above 1, motion blur) or consecutive images are crossfaded (step
+*  below 1); otherwise images are sampled and skipped ones never decoded.
+*
+*  Images are decoded by nThread workers, each with a deque of images to
+*  decode that idle workers steal from, and put back in order in a reorder
+*  buffer. At most nReorder decoded images are in flight or waiting, so GPU
+*  memory is bounded by nReorder frames whatever the sequence length. Frames
+*  have the size of the first image; images of another size are scaled.
+*/
+class TimelapseSource : public FrameSource
+{
+public:
+    /**
+    *  @brief nThread 0 uses one worker per core, up to 8; nReorder 0 twice
+    *  the number of workers.
+    */
+    TimelapseSource(const std::vector<std::string> &vPath, double fStep = 1, bool bBlend = false, int nThread = 0, int nReorder = 0);
+    ~TimelapseSource();
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override;
+
+    /**
+    *  @brief Size of the first image, decoded by the constructor.
+    */
+    cv::Size GetSize() const { return m_size; }
+    int GetFrameCount() const { return m_nOutFrame; }
+
+    /**
+    *  @brief Image paths of a directory in name order, or the lines of a list file.
+    */
+    static std::vector<std::string> ListImages(const std::string &strPath);
+
+private:
+    struct Worker
+    {
+        // Positions in m_vImage to decode; the owner pops the front, thieves the back
+        std::deque<int> qTask;
+        std::mutex mutex;
+    };
+
+    void DecodeWorker(int iWorker);
+    bool TakeTask(int iWorker, int &iTask);
+    void Stop();
+    void IssueTasks();
+    cv::cuda::GpuMat WaitImage(int iImage);
+    void ReleaseBefore(int iImage);
+    // Images the frame iFrame is made of
+    void GetFrameImages(int iFrame, std::vector<int> &vImage, std::vector<double> &vWeight) const;
+
+    std::vector<std::string> m_vPath;
+    double m_fStep;
+    bool m_bBlend;
+    int m_nReorder;
+    int m_nOutFrame = 0, m_iOutFrame = 0;
+    cv::Size m_size;
+    int m_iDevice = 0;
+
+    // Indices of the images to decode, ascending; tasks are positions in it
+    std::vector<int> m_vImage;
+    // Tasks handed to the workers, and tasks whose image has been released
+    int m_iIssued = 0, m_iReleased = 0;
+    std::vector<std::unique_ptr<Worker>> m_vWorker;
+    std::vector<std::thread> m_vThread;
+    int m_iNextWorker = 0;
+    // Tasks in the worker deques
+    std::atomic<int> m_nQueued{0};
+
+    // Decoded images by task, empty for images that failed
+    std::map<int, cv::cuda::GpuMat> m_mDecoded;
+    bool m_bStop = false;
+    // Set by a worker that cannot decode at all
+    std::exception_ptr m_pError;
+    std::mutex m_mutex;
+    std::condition_variable m_cvTask, m_cvDecoded;
+
+    cv::cuda::Stream m_stream;
+    // Sum of a blended frame, the blended frame and the last image decoded,
+    // which stands in for images that fail to decode
+    cv::cuda::GpuMat m_acc, m_blended, m_last;
+};
@@ -0,0 +1,149 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Measures host to device bandwidth for RGBA frames: GpuMat::upload() from
+*  pageable memory, as cv::imread() output is, from a Mat of
+*  PinnedMatAllocator, and through the pinned staging ring of
+*  PinnedUploadSource. For the ring, the wall clock rate includes the host
+*  copy into the pinned buffer (what a decoder writing there costs) and the
+*  DMA rate is measured with CUDA events.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "PinnedMatAllocator.h"
+#include "PinnedUploadSource.h"
+
+void ShowHelpAndExit(const char *szBadOption = NULL)
+{
+    std::ostringstream oss;
+    if (szBadOption)
+    {
+        oss << "Error parsing \"" << szBadOption << "\"" << std::endl;
+    }
+    oss << "Options:" << std::endl
+        << "-s               Frame size: WxH (default: 3840x2160)" << std::endl
+        << "-frames          Frames to upload per method (default: 300)" << std::endl
+        << "-slots           Pinned ring slots (default: 3)" << std::endl
+        << "-gpu             Ordinal of GPU to use" << std::endl
+        ;
+    std::cout << oss.str();
+    exit(szBadOption ? 1 : 0);
+}
+
+static void Report(const char *szMethod, double dBytes, double dSeconds)
+{
+    std::cout << std::left << std::setw(24) << szMethod << std::right << std::fixed << std::setprecision(2)
+        << std::setw(8) << dBytes / dSeconds / 1e9 << " GB/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int nWidth = 3840, nHeight = 2160, nFrame = 300, nSlots = 3, iGpu = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-h"))
+        {
+            ShowHelpAndExit();
+        }
+        if (i + 1 == argc)
+        {
+            ShowHelpAndExit(argv[i]);
+        }
+        if (!strcmp(argv[i], "-s"))
+        {
+            if (2 != sscanf(argv[++i], "%dx%d", &nWidth, &nHeight))
+            {
+                ShowHelpAndExit("-s");
+            }
+        }
+        else if (!strcmp(argv[i], "-frames"))
+        {
+            nFrame = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-slots"))
+        {
+            nSlots = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-gpu"))
+        {
+            iGpu = atoi(argv[++i]);
+        }
+        else
+        {
+            ShowHelpAndExit(argv[i]);
+        }
+    }
+    if (nWidth <= 0 || nHeight <= 0 || nFrame <= 0)
+    {
+        ShowHelpAndExit("-s");
+    }
+
+    try
+    {
+        cv::cuda::setDevice(iGpu);
+        double dBytes = (double)nWidth * nHeight * 4 * nFrame;
+        std::cout << nFrame << " frames of " << nWidth << "x" << nHeight << " RGBA" << std::endl;
+
+        // Stands in for decoded frames in pageable memory
+        cv::Mat source(nHeight, nWidth, CV_8UC4);
+        source.setTo(cv::Scalar(16, 128, 128, 255));
+        cv::cuda::GpuMat device;
+        device.upload(source);
+
+        auto tStart = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < nFrame; i++)
+        {
+            device.upload(source);
+        }
+        Report("pageable upload", dBytes, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count());
+
+        cv::Mat pinnedSource;
+        pinnedSource.allocator = PinnedMatAllocator::GetInstance();
+        pinnedSource.create(nHeight, nWidth, CV_8UC4);
+        source.copyTo(pinnedSource);
+        tStart = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < nFrame; i++)
+        {
+            device.upload(pinnedSource);
+        }
+        Report("pinned Mat upload", dBytes, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count());
+
+        int iFrame = 0;
+        PinnedUploadSource pinned(nWidth, nHeight, [&](cv::Mat &host) {
+            if (iFrame++ >= nFrame)
+            {
+                return false;
+            }
+            source.copyTo(host);
+            return true;
+        }, nSlots);
+        tStart = std::chrono::high_resolution_clock::now();
+        cv::cuda::GpuMat frame;
+        while (pinned.GetNextFrame(frame))
+        {
+        }
+        Report("pinned ring, wall clock", dBytes, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count());
+        Report("pinned ring, DMA", pinned.GetUploadedBytes(), pinned.GetUploadMs() / 1000);
+    }
+    catch (const std::exception &ex)
+    {
+        std::cout << ex.what();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "VideoFrameSource.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cudaimgproc.hpp>
+
+VideoFrameSource::VideoFrameSource(const std::string &strPath, int nMaxFrame, bool bAllowNvdec)
+    : m_nMaxFrame(nMaxFrame)
+{
+#ifdef HAVE_OPENCV_CUDACODEC
+    if (bAllowNvdec)
+    {
+        try
+        {
+            m_pReader = cv::cudacodec::createVideoReader(strPath);
+            m_bPending = DecodeFrame(m_frame);
+        }
+        catch (const cv::Exception &ex)
+        {
+            // No NVDEC, or a codec or profile it does not support
+            std::cout << "NVDEC cannot decode " << strPath << ", decoding on the CPU: " << ex.what() << std::endl;
+            m_pReader.reset();
+        }
+    }
+    if (m_pReader)
+    {
+        if (!m_bPending)
+        {
+            std::ostringstream err;
+            err << "No frames in " << strPath << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        m_size = m_frame.size();
+        return;
+    }
+#endif
+
+    if (!m_capture.open(strPath))
+    {
+        std::ostringstream err;
+        err << "Unable to open video " << strPath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    m_size = cv::Size((int)m_capture.get(cv::CAP_PROP_FRAME_WIDTH), (int)m_capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+    if (m_size.area() <= 0)
+    {
+        std::ostringstream err;
+        err << "Unknown frame size of " << strPath << std::endl;
+        throw std::invalid_argument(err.str());
+    }
+    // Runs on the upload thread, which owns m_capture from here on
+    m_pUpload.reset(new PinnedUploadSource(m_size.width, m_size.height, [this](cv::Mat &host) {
+        if (!m_capture.read(m_captured) || m_captured.empty())
+        {
+            return false;
+        }
+        if (m_captured.size() != m_size)
+        {
+            cv::resize(m_captured, m_captured, m_size);
+        }
+        cv::cvtColor(m_captured, host, m_captured.channels() == 1 ? cv::COLOR_GRAY2RGBA : cv::COLOR_BGR2RGBA);
+        return true;
+    }));
+}
+
+bool VideoFrameSource::IsNvdec() const
+{
+#ifdef HAVE_OPENCV_CUDACODEC
+    return m_pReader != nullptr;
+#else
+    return false;
+#endif
+}
+
+bool VideoFrameSource::DecodeFrame(cv::cuda::GpuMat &frame)
+{
+#ifdef HAVE_OPENCV_CUDACODEC
+    if (m_pReader)
+    {
+        if (!m_pReader->nextFrame(m_decoded, m_stream))
+        {
+            return false;
+        }
+        cv::cuda::cvtColor(m_decoded, frame, cv::ColorConversionCodes::COLOR_BGRA2RGBA, 0, m_stream);
+        return true;
+    }
+#endif
+    return m_pUpload->GetNextFrame(frame);
+}
+
+bool VideoFrameSource::GetNextFrame(cv::cuda::GpuMat &frame)
+{
+    if (m_nMaxFrame && m_iFrame >= m_nMaxFrame)
+    {
+        return false;
+    }
+    if (!m_bPending && !DecodeFrame(m_frame))
+    {
+        return false;
+    }
+    m_bPending = false;
+    m_iFrame++;
+    if (m_fnFilter)
+    {
+        m_fnFilter(m_frame, m_stream);
+    }
+    // The encoder reads the frame on a stream of its own
+    m_stream.waitForCompletion();
+    frame = m_frame;
+    return true;
+}
+
+bool VideoFrameSource::IsVideoFile(const std::string &strPath)
+{
+    static const char *aszExtension[] = {"mp4", "mov", "mkv", "avi", "webm", "ts", "m2ts", "flv",
+        "h264", "264", "avc", "h265", "265", "hevc", "ivf", "y4m"};
+    size_t iDot = strPath.find_last_of('.');
+    if (iDot == std::string::npos || strPath.find_first_of("/\\", iDot) != std::string::npos)
+    {
+        return false;
+    }
+    std::string strExtension = strPath.substr(iDot + 1);
+    std::transform(strExtension.begin(), strExtension.end(), strExtension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    for (const char *szExtension : aszExtension)
+    {
+        if (strExtension == szExtension)
+        {
+            return true;
+        }
+    }
+    return false;
+}
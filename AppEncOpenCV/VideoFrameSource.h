@@ -0,0 +1,80 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include "FrameSource.h"
+#include "PinnedUploadSource.h"
+
+#include <opencv2/opencv_modules.hpp>
+#include <opencv2/videoio.hpp>
+#ifdef HAVE_OPENCV_CUDACODEC
+#include <opencv2/cudacodec.hpp>
+#endif
+
+/**
+*  @brief Processing applied to every decoded RGBA frame, on the GPU, before
+*  it is encoded. May replace frame by one of another size.
+*/
+typedef std::function<void(cv::cuda::GpuMat &frame, cv::cuda::Stream &stream)> GpuFrameFilter;
+
+/**
+*  @brief Frames of a video file, for transcoding. Decoded with NVDEC through
+*  cv::cudacodec::VideoReader, so frames never leave the GPU; when OpenCV is
+*  built without cudacodec or the GPU cannot decode the stream, with
+*  cv::VideoCapture on the CPU and uploaded through a PinnedUploadSource.
+*/
+class VideoFrameSource : public FrameSource
+{
+public:
+    /**
+    *  @brief nMaxFrame 0 decodes the whole file. Throws if the file cannot
+    *  be opened by either decoder.
+    */
+    VideoFrameSource(const std::string &strPath, int nMaxFrame = 0, bool bAllowNvdec = true);
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override;
+
+    /**
+    *  @brief Size of the first frame.
+    */
+    cv::Size GetSize() const { return m_size; }
+    bool IsNvdec() const;
+    void SetFilter(GpuFrameFilter fnFilter) { m_fnFilter = fnFilter; }
+
+    /**
+    *  @brief Tells video files from images by their extension.
+    */
+    static bool IsVideoFile(const std::string &strPath);
+
+private:
+    bool DecodeFrame(cv::cuda::GpuMat &frame);
+
+#ifdef HAVE_OPENCV_CUDACODEC
+    cv::Ptr<cv::cudacodec::VideoReader> m_pReader;
+    // BGRA output of the reader
+    cv::cuda::GpuMat m_decoded;
+#endif
+    cv::VideoCapture m_capture;
+    cv::Mat m_captured;
+    std::unique_ptr<PinnedUploadSource> m_pUpload;
+
+    cv::cuda::Stream m_stream;
+    cv::cuda::GpuMat m_frame;
+    GpuFrameFilter m_fnFilter;
+    cv::Size m_size;
+    // The first frame is decoded by the constructor to learn the size
+    bool m_bPending = false;
+    int m_nMaxFrame, m_iFrame = 0;
+};
@@ -0,0 +1,632 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+#include "WatchFolder.h"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include "../Utils/NvCodecUtils.h"
+#include "EncoderSessionPool.h"
+#include "ImageDecoder.h"
+#include "VideoFrameSource.h"
+
+namespace
+{
+
+/**
+*  @brief Images of a sequence directory, added by the watcher as they arrive
+*  and decoded by the encoder worker. The sequence ends with Finish() or when
+*  no image arrived for nIdleSeconds.
+*/
+class SequenceSource : public FrameSource
+{
+public:
+    SequenceSource(int nIdleSeconds) : m_nIdleSeconds(nIdleSeconds), m_decoder(1, 1) {}
+
+    void Add(const std::string &strName, const std::string &strPath)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A file can be reported by the startup scan and by inotify
+        if (m_bFinished || !m_sSeen.insert(strName).second)
+        {
+            return;
+        }
+        m_qPath.push_back(strPath);
+        m_cv.notify_all();
+    }
+
+    void Finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bFinished = true;
+        m_cv.notify_all();
+    }
+
+    /**
+    *  @brief Decodes the first frame to learn the size. Returns false if the
+    *  sequence ended without a decodable image.
+    */
+    bool Prefetch(cv::Size &size)
+    {
+        if (!m_bPending && !DecodeNext(m_frame))
+        {
+            return false;
+        }
+        m_bPending = true;
+        size = m_frame.size();
+        return true;
+    }
+
+    bool GetNextFrame(cv::cuda::GpuMat &frame) override
+    {
+        if (!m_bPending && !DecodeNext(m_frame))
+        {
+            return false;
+        }
+        m_bPending = false;
+        frame = m_frame;
+        return true;
+    }
+
+    int GetSkippedCount() const { return m_nSkipped; }
+
+private:
+    bool DecodeNext(cv::cuda::GpuMat &frame)
+    {
+        for (;;)
+        {
+            std::string strPath;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (!m_cv.wait_for(lock, std::chrono::seconds(m_nIdleSeconds), [this] { return !m_qPath.empty() || m_bFinished; }))
+                {
+                    std::cout << "Sequence idle for " << m_nIdleSeconds << " s, closing it" << std::endl;
+                    m_bFinished = true;
+                }
+                if (m_qPath.empty())
+                {
+                    return false;
+                }
+                strPath = m_qPath.front();
+                m_qPath.pop_front();
+            }
+            try
+            {
+                frame = m_decoder.Decode(strPath);
+                return true;
+            }
+            catch (const std::exception &ex)
+            {
+                // One bad upload does not end the sequence
+                std::cout << "Skipping frame: " << ex.what();
+                m_nSkipped++;
+            }
+        }
+    }
+
+    int m_nIdleSeconds;
+    ImageDecoder m_decoder;
+    cv::cuda::GpuMat m_frame;
+    bool m_bPending = false;
+    int m_nSkipped = 0;
+    std::deque<std::string> m_qPath;
+    std::set<std::string> m_sSeen;
+    bool m_bFinished = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+enum WatchJobType
+{
+    WATCH_IMAGE,
+    WATCH_VIDEO,
+    WATCH_SEQUENCE
+};
+
+struct WatchJob
+{
+    WatchJobType eType;
+    std::string strPath;
+    // Output name without extension
+    std::string strName;
+    std::shared_ptr<SequenceSource> pSequence;
+};
+
+static bool IsIgnoredName(const char *szName)
+{
+    return szName[0] == '.';
+}
+
+// Flushes the file or directory at strPath to disk
+static void SyncPath(const std::string &strPath)
+{
+    int fd = open(strPath.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd))
+    {
+        int e = errno;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        std::ostringstream err;
+        err << "Unable to sync " << strPath << ": " << strerror(e) << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    close(fd);
+}
+
+class WatchFolder
+{
+public:
+    WatchFolder(const WatchOptions &options) : m_options(options)
+    {
+        const char *aszFileSink[] = {"file", "direct", "fstream", "mmap", "uring"};
+        if (std::find_if(std::begin(aszFileSink), std::end(aszFileSink),
+            [&options](const char *sz) { return options.strSinkType == sz; }) == std::end(aszFileSink))
+        {
+            std::ostringstream err;
+            err << "Watch folder outputs are renamed into place, sink " << options.strSinkType << " does not write a file" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        char szWatchDir[PATH_MAX], szOutputDir[PATH_MAX];
+        if (!realpath(options.strWatchDir.c_str(), szWatchDir) || !realpath(options.strOutputDir.c_str(), szOutputDir))
+        {
+            std::ostringstream err;
+            err << "Watch and output directory must exist" << std::endl;
+            throw std::invalid_argument(err.str());
+        }
+        if (!strcmp(szWatchDir, szOutputDir))
+        {
+            // Published outputs would be picked up as new videos
+            throw std::invalid_argument("Output directory must differ from the watched directory\n");
+        }
+        NvEncoderInitParam initParam(options.strEncoderParams.c_str());
+        m_strExtension = initParam.IsCodecHEVC() ? ".hevc" : ".h264";
+    }
+
+    ~WatchFolder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+            m_cvJob.notify_all();
+        }
+        for (auto &sequence : m_mSequence)
+        {
+            if (sequence.second.pSource)
+            {
+                sequence.second.pSource->Finish();
+            }
+        }
+        // Jobs in progress are finished
+        for (std::thread &worker : m_vWorker)
+        {
+            worker.join();
+        }
+        m_pPool.reset();
+        if (m_fdNotify >= 0)
+        {
+            close(m_fdNotify);
+        }
+        if (m_cuContext)
+        {
+            CUdevice cuDevice = 0;
+            if (cuDeviceGet(&cuDevice, m_options.iGpu) == CUDA_SUCCESS)
+            {
+                cuDevicePrimaryCtxRelease(cuDevice);
+            }
+        }
+    }
+
+    int Run()
+    {
+        ck(cuInit(0));
+        CUdevice cuDevice = 0;
+        ck(cuDeviceGet(&cuDevice, m_options.iGpu));
+        // Shared with the OpenCV CUDA modules, see EncodeDaemon.cpp
+        ck(cuDevicePrimaryCtxRetain(&m_cuContext, cuDevice));
+        cv::cuda::setDevice(m_options.iGpu);
+        m_pPool.reset(new EncoderSessionPool(m_cuContext, m_options.nSessions));
+
+        m_fdNotify = inotify_init1(IN_CLOEXEC);
+        if (m_fdNotify < 0 || AddWatch(m_options.strWatchDir) < 0)
+        {
+            std::ostringstream err;
+            err << "Unable to watch " << m_options.strWatchDir << ": " << strerror(errno) << std::endl;
+            throw std::runtime_error(err.str());
+        }
+
+        for (int i = 0; i < m_options.nSessions; i++)
+        {
+            m_vWorker.emplace_back(&WatchFolder::EncodeWorker, this);
+        }
+        // Watched before the scan, so nothing dropped in between is missed
+        ScanDirectory();
+        std::cout << "Watching " << m_options.strWatchDir << ", outputs in " << m_options.strOutputDir << std::endl;
+
+        alignas(struct inotify_event) char aBuf[64 * 1024];
+        for (;;)
+        {
+            ssize_t nRead = read(m_fdNotify, aBuf, sizeof(aBuf));
+            if (nRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (nRead <= 0)
+            {
+                std::ostringstream err;
+                err << "inotify read failed: " << strerror(errno) << std::endl;
+                throw std::runtime_error(err.str());
+            }
+            for (char *p = aBuf; p < aBuf + nRead; )
+            {
+                const struct inotify_event *pEvent = reinterpret_cast<const struct inotify_event*>(p);
+                OnEvent(*pEvent);
+                p += sizeof(struct inotify_event) + pEvent->len;
+            }
+        }
+    }
+
+private:
+    int AddWatch(const std::string &strDir)
+    {
+        int wd = inotify_add_watch(m_fdNotify, strDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+        if (wd >= 0 && strDir != m_options.strWatchDir)
+        {
+            m_mSequence[wd].strDir = strDir;
+        }
+        return wd;
+    }
+
+    void OnEvent(const struct inotify_event &event)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            std::cout << "inotify queue overflow, rescanning " << m_options.strWatchDir << std::endl;
+            ScanDirectory();
+            return;
+        }
+        auto itSequence = m_mSequence.find(event.wd);
+        if (event.mask & IN_IGNORED)
+        {
+            // The sequence directory was removed or moved away
+            if (itSequence != m_mSequence.end())
+            {
+                if (itSequence->second.pSource)
+                {
+                    itSequence->second.pSource->Finish();
+                }
+                m_mSequence.erase(itSequence);
+            }
+            return;
+        }
+        if (!event.len)
+        {
+            return;
+        }
+        if (itSequence != m_mSequence.end())
+        {
+            SequenceWatch &sequence = itSequence->second;
+            if (!strcmp(event.name, ".done"))
+            {
+                sequence.pSource->Finish();
+                inotify_rm_watch(m_fdNotify, event.wd);
+            }
+            else if (!IsIgnoredName(event.name) && !(event.mask & IN_ISDIR) && (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+            {
+                sequence.pSource->Add(event.name, sequence.strDir + "/" + event.name);
+            }
+            return;
+        }
+        if (IsIgnoredName(event.name))
+        {
+            return;
+        }
+        if (event.mask & IN_ISDIR)
+        {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                StartSequence(event.name);
+            }
+        }
+        else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        {
+            AddFile(event.name);
+        }
+    }
+
+    void AddFile(const std::string &strName)
+    {
+        WatchJob job;
+        job.strPath = m_options.strWatchDir + "/" + strName;
+        job.eType = VideoFrameSource::IsVideoFile(strName) ? WATCH_VIDEO : WATCH_IMAGE;
+        job.strName = strName.substr(0, strName.find_last_of('.'));
+        Push(job);
+    }
+
+    void StartSequence(const std::string &strName)
+    {
+        std::string strDir = m_options.strWatchDir + "/" + strName;
+        int wd = AddWatch(strDir);
+        if (wd < 0)
+        {
+            std::cout << "Unable to watch " << strDir << ": " << strerror(errno) << std::endl;
+            return;
+        }
+        SequenceWatch &sequence = m_mSequence[wd];
+        if (sequence.pSource)
+        {
+            // Already known, e.g. reported by the startup scan and by inotify
+            return;
+        }
+        sequence.pSource = std::make_shared<SequenceSource>(m_options.nIdleSeconds);
+
+        // Images written before the watch was added, in name order
+        std::vector<std::string> vName;
+        bool bDone = false;
+        if (DIR *pDir = opendir(strDir.c_str()))
+        {
+            while (struct dirent *pEntry = readdir(pDir))
+            {
+                if (!strcmp(pEntry->d_name, ".done"))
+                {
+                    bDone = true;
+                }
+                else if (!IsIgnoredName(pEntry->d_name))
+                {
+                    vName.push_back(pEntry->d_name);
+                }
+            }
+            closedir(pDir);
+        }
+        std::sort(vName.begin(), vName.end());
+        for (const std::string &strImage : vName)
+        {
+            sequence.pSource->Add(strImage, strDir + "/" + strImage);
+        }
+        if (bDone)
+        {
+            sequence.pSource->Finish();
+        }
+
+        WatchJob job;
+        job.eType = WATCH_SEQUENCE;
+        job.strPath = strDir;
+        job.strName = strName;
+        job.pSequence = sequence.pSource;
+        Push(job);
+    }
+
+    void ScanDirectory()
+    {
+        DIR *pDir = opendir(m_options.strWatchDir.c_str());
+        if (!pDir)
+        {
+            return;
+        }
+        std::vector<std::pair<std::string, bool>> vEntry;
+        while (struct dirent *pEntry = readdir(pDir))
+        {
+            if (IsIgnoredName(pEntry->d_name))
+            {
+                continue;
+            }
+            struct stat st;
+            std::string strPath = m_options.strWatchDir + "/" + pEntry->d_name;
+            if (!stat(strPath.c_str(), &st))
+            {
+                vEntry.push_back(std::make_pair(std::string(pEntry->d_name), S_ISDIR(st.st_mode)));
+            }
+        }
+        closedir(pDir);
+        std::sort(vEntry.begin(), vEntry.end());
+        for (const auto &entry : vEntry)
+        {
+            std::string strName = entry.second ? entry.first : entry.first.substr(0, entry.first.find_last_of('.'));
+            struct stat st;
+            if (!stat(GetOutputPath(strName).c_str(), &st))
+            {
+                // Encoded by an earlier run
+                continue;
+            }
+            if (entry.second)
+            {
+                StartSequence(entry.first);
+            }
+            else
+            {
+                AddFile(entry.first);
+            }
+        }
+    }
+
+    std::string GetOutputPath(const std::string &strName) const
+    {
+        return m_options.strOutputDir + "/" + strName + m_strExtension;
+    }
+
+    void Push(const WatchJob &job)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A file written twice before its job started is encoded once
+        for (const WatchJob &queued : m_qJob)
+        {
+            if (queued.strPath == job.strPath && !job.pSequence)
+            {
+                return;
+            }
+        }
+        m_qJob.push_back(job);
+        m_cvJob.notify_one();
+    }
+
+    void EncodeWorker()
+    {
+        cv::cuda::setDevice(m_options.iGpu);
+        FrameNormalizer normalizer(m_options.eFit, m_options.nOutWidth, m_options.nOutHeight);
+        for (;;)
+        {
+            WatchJob job;
+            unsigned iJob;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                std::deque<WatchJob>::iterator it;
+                m_cvJob.wait(lock, [this, &it] { return (it = FindRunnable()) != m_qJob.end() || m_bStop; });
+                if (m_bStop)
+                {
+                    return;
+                }
+                job = *it;
+                m_qJob.erase(it);
+                m_sInFlight.insert(job.strName);
+                iJob = m_iNextJob++;
+            }
+            Encode(job, iJob, normalizer);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_sInFlight.erase(job.strName);
+                // A job deferred for this output may run now
+                m_cvJob.notify_all();
+            }
+        }
+    }
+
+    /**
+    *  @brief First queued job whose output is not being encoded, m_mutex held.
+    *  A second event for a running file, the rescan after a queue overflow or
+    *  inputs with the same stem would otherwise encode the same output twice at
+    *  once; such jobs wait and then encode the newer input.
+    */
+    std::deque<WatchJob>::iterator FindRunnable()
+    {
+        return std::find_if(m_qJob.begin(), m_qJob.end(),
+            [this](const WatchJob &job) { return !m_sInFlight.count(job.strName); });
+    }
+
+    void Encode(const WatchJob &job, unsigned iJob, const FrameNormalizer &normalizer)
+    {
+        std::string strOutput = GetOutputPath(job.strName);
+        std::string strPart = m_options.strOutputDir + "/." + job.strName + m_strExtension + "." + std::to_string(iJob) + ".part";
+        auto tStart = std::chrono::steady_clock::now();
+        try
+        {
+            std::unique_ptr<FrameSource> pSource;
+            cv::Size frameSize;
+            if (job.eType == WATCH_IMAGE)
+            {
+                ImageDecoder decoder(1, 1);
+                cv::cuda::GpuMat image = decoder.Decode(job.strPath);
+                frameSize = image.size();
+                pSource.reset(new StillFrameSource(image, m_options.nFrame));
+            }
+            else if (job.eType == WATCH_VIDEO)
+            {
+                VideoFrameSource *pVideo = new VideoFrameSource(job.strPath);
+                pSource.reset(pVideo);
+                frameSize = pVideo->GetSize();
+            }
+            else if (!job.pSequence->Prefetch(frameSize))
+            {
+                std::cout << job.strPath << ": no images" << std::endl;
+                return;
+            }
+            ValidateResolution(frameSize.width, frameSize.height);
+
+            cv::Size minSize = m_pPool->GetMinSize(m_options.strEncoderParams);
+            cv::Size sessionSize = normalizer.GetSessionSize(frameSize, minSize);
+            EncoderSessionKey key = {sessionSize.width, sessionSize.height, NV_ENC_BUFFER_FORMAT_ABGR, m_options.strEncoderParams, 0};
+            std::unique_ptr<EncoderSession> pSession = m_pPool->Acquire(key);
+            std::unique_ptr<OutputSink> pSink = CreateOutputSink(m_options.strSinkType, strPart.c_str());
+            EncodeControl control;
+            control.pNormalizer = &normalizer;
+            control.minSize = minSize;
+            FrameSource &source = job.pSequence ? *job.pSequence : *pSource;
+            int nPacket = EncodeFrames(pSession->Get(), m_cuContext, source, *pSink, control);
+            pSession->MarkReusable();
+            pSession.reset();
+            pSink->Close();
+            // After a crash the published name must not point at a partial file
+            SyncPath(strPart);
+            if (rename(strPart.c_str(), strOutput.c_str()))
+            {
+                std::ostringstream err;
+                err << "Unable to publish " << strOutput << ": " << strerror(errno) << std::endl;
+                throw std::runtime_error(err.str());
+            }
+            SyncPath(m_options.strOutputDir);
+            std::cout << job.strPath << " -> " << strOutput << ": " << nPacket << " frames, " << pSink->GetBytesWritten()
+                << " bytes, " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count() << " ms";
+            if (job.pSequence && job.pSequence->GetSkippedCount())
+            {
+                std::cout << ", " << job.pSequence->GetSkippedCount() << " images skipped";
+            }
+            std::cout << std::endl;
+        }
+        catch (const std::exception &ex)
+        {
+            unlink(strPart.c_str());
+            std::cout << job.strPath << " failed: " << ex.what();
+        }
+    }
+
+    struct SequenceWatch
+    {
+        std::string strDir;
+        std::shared_ptr<SequenceSource> pSource;
+    };
+
+    WatchOptions m_options;
+    std::string m_strExtension;
+    CUcontext m_cuContext = NULL;
+    std::unique_ptr<EncoderSessionPool> m_pPool;
+    int m_fdNotify = -1;
+    // Sequence directories by watch descriptor, only touched by the watcher thread
+    std::map<int, SequenceWatch> m_mSequence;
+    std::deque<WatchJob> m_qJob;
+    // Output names of the jobs being encoded
+    std::set<std::string> m_sInFlight;
+    unsigned m_iNextJob = 0;
+    bool m_bStop = false;
+    std::vector<std::thread> m_vWorker;
+    std::mutex m_mutex;
+    std::condition_variable m_cvJob;
+};
+
+}
+
+int RunWatchFolder(const WatchOptions &options)
+{
+    WatchFolder watchFolder(options);
+    return watchFolder.Run();
+}
+
+#endif
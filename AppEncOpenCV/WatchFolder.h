@@ -0,0 +1,63 @@
+/*
+* Copyright 2017-2020 NVIDIA Corporation.  All rights reserved.
+*
+* Please refer to the NVIDIA end user license agreement (EULA) associated
+* with this source code for terms and conditions that govern your use of
+* this software. Any use, reproduction, disclosure, or distribution of
+* this software and related documentation outside the terms of the EULA
+* is strictly prohibited.
+*
+*/
+
+/**
+*  Watch folder ingest. A directory is watched with inotify and whatever is
+*  dropped into it is encoded by one resident process, on warm sessions of an
+*  EncoderSessionPool:
+*      image file          nFrame copies, as the single image mode
+*      video file          transcoded, see VideoFrameSource
+*      subdirectory        image sequence, one frame per image in the order
+*                          the images arrive; encoded while it grows and
+*                          complete once a file named .done is written into
+*                          it or no image arrived for nIdleSeconds
+*  Files count once they are closed after writing or moved in, so uploaders
+*  may write in place or rename. Names starting with '.' are ignored.
+*
+*  Outputs are written as .<name>.<job>.part in the output directory, synced
+*  and renamed to <name>.h264 / <name>.hevc when complete, so readers of the
+*  output directory never see partial files, not even after a crash. Jobs for
+*  an output that is being encoded wait for it to finish. Entries present at
+*  startup whose output does not exist yet are encoded too.
+*/
+
+#pragma once
+
+#include <string>
+#include "GpuMatEncoder.h"
+
+struct WatchOptions
+{
+    std::string strWatchDir;
+    std::string strOutputDir;
+    std::string strEncoderParams;
+    // A file sink, outputs are renamed into place
+    std::string strSinkType = "file";
+    // Frames per image file
+    int nFrame = nDefaultFrameCount;
+    int iGpu = 0;
+    // Output geometry, see FrameNormalizer
+    FitMode eFit = FIT_PAD;
+    int nOutWidth = 0, nOutHeight = 0;
+    // Concurrent encoder sessions; a growing sequence holds one while it waits
+    int nSessions = 3;
+    int nIdleSeconds = 10;
+};
+
+#ifdef __linux__
+
+/**
+*  @brief Encodes what arrives in options.strWatchDir until the process is
+*  terminated.
+*/
+int RunWatchFolder(const WatchOptions &options);
+
+#endif